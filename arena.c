@@ -0,0 +1,147 @@
+#include "arena.h"
+
+static uint8_t* pool_region(void);
+
+/**
+ * Slots given back, each holding the address of the next in its first
+ * bytes, and what is left of the newest region. Regions are kept for
+ * the life of the process. Machines may be made and freed on several
+ * threads, so the pool is only touched under pool_lock.
+ */
+static uint8_t*        pool_free = NULL;
+static uint8_t*        pool_next = NULL;
+static uint8_t*        pool_end  = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Allocates size zeroed bytes aligned on align, a power of two, or on
+ * ARENA_ALIGN if it is smaller
+ */
+void* arena_alloc(arena_t* arena, size_t size, size_t align) {
+  if (align < ARENA_ALIGN) {
+    align = ARENA_ALIGN;
+  }
+
+  arena_chunk_t* chunk  = arena->chunks;
+  size_t         offset = 0;
+  if (chunk != NULL) {
+    offset = (chunk->used + align - 1) & ~(align - 1);
+  }
+
+  if (chunk == NULL || offset + size > chunk->size) {
+    size_t page   = (size_t) sysconf(_SC_PAGESIZE);
+    size_t header = (sizeof(arena_chunk_t) + align - 1) & ~(align - 1);
+    size_t length = header + size < ARENA_CHUNK ? ARENA_CHUNK
+        : (header + size + page - 1) / page * page;
+
+    chunk = mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+      fprintf(stderr,"mmap failure");
+      exit(EXIT_FAILURE);
+    }
+    chunk->next    = arena->chunks;
+    chunk->size    = length;
+    arena->chunks  = chunk;
+    offset         = header;
+  }
+
+  chunk->used = offset + size;
+  return (uint8_t*) chunk + offset;
+}
+
+arena_mark_t arena_mark(arena_t* arena) {
+  arena_mark_t mark = { arena->chunks, 0 };
+
+  if (arena->chunks != NULL) {
+    mark.used = arena->chunks->used;
+  }
+  return mark;
+}
+
+/**
+ * Frees everything allocated since the mark was taken, zeroing it to be
+ * allocated again
+ */
+void arena_rewind(arena_t* arena, arena_mark_t mark) {
+  while (arena->chunks != mark.chunk) {
+    arena_chunk_t* chunk = arena->chunks;
+    arena->chunks = chunk->next;
+    munmap(chunk, chunk->size);
+  }
+
+  if (mark.chunk != NULL) {
+    memset((uint8_t*) mark.chunk + mark.used, 0,
+        mark.chunk->used - mark.used);
+    mark.chunk->used = mark.used;
+  }
+}
+
+/**
+ * Unmaps the chunks, which may hold the arena itself
+ */
+void arena_free(arena_t* arena) {
+  arena_chunk_t* chunk = arena->chunks;
+
+  while (chunk != NULL) {
+    arena_chunk_t* next = chunk->next;
+    munmap(chunk, chunk->size);
+    chunk = next;
+  }
+}
+
+/**
+ * Takes a zeroed slot of POOL_SLOT bytes, reusing one given back if any
+ */
+void* pool_take(void) {
+  pthread_mutex_lock(&pool_lock);
+  uint8_t* slot = pool_free;
+
+  if (slot != NULL) {
+    memcpy(&pool_free, slot, sizeof(pool_free));
+    pthread_mutex_unlock(&pool_lock);
+    memset(slot, 0, POOL_SLOT);
+    return slot;
+  }
+
+  if (pool_next == pool_end) {
+    pool_next = pool_region();
+    pool_end  = pool_next + POOL_REGION;
+  }
+  slot       = pool_next;
+  pool_next += POOL_SLOT;
+  pthread_mutex_unlock(&pool_lock);
+  return slot;
+}
+
+void pool_give(void* slot) {
+  pthread_mutex_lock(&pool_lock);
+  memcpy(slot, &pool_free, sizeof(pool_free));
+  pool_free = slot;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Maps a region aligned on its size, for the kernel to back it with a
+ * huge page
+ */
+static uint8_t* pool_region(void) {
+  uint8_t* map = mmap(NULL, 2 * POOL_REGION, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr,"mmap failure");
+    exit(EXIT_FAILURE);
+  }
+
+  uint8_t* start = (uint8_t*) (((uintptr_t) map + POOL_REGION - 1)
+      & ~(uintptr_t) (POOL_REGION - 1));
+  if (start > map) {
+    munmap(map, (size_t) (start - map));
+  }
+  munmap(start + POOL_REGION, (size_t) (map + POOL_REGION - start));
+
+#ifdef MADV_HUGEPAGE
+  madvise(start, POOL_REGION, MADV_HUGEPAGE);
+#endif
+  return start;
+}
@@ -0,0 +1,61 @@
+#ifndef HEADER_ARENA
+#define HEADER_ARENA
+
+#include "common.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Smallest chunk an arena maps, enough for a machine with the default
+ * devices
+ */
+#define ARENA_CHUNK (1 << 16)
+
+/**
+ * Alignment of the allocations not asking for more
+ */
+#define ARENA_ALIGN 16
+
+/**
+ * The RAM pool carves slots of POOL_SLOT bytes out of regions the size
+ * of a transparent huge page, so that the RAM of many machines is mapped
+ * by a few TLB entries. A region is split into small pages once a slot
+ * maps a file, as a loaded image or merged pages do.
+ */
+#define POOL_REGION (1 << 21)
+#define POOL_SLOT   (1 << 16)
+
+typedef struct arena_chunk_struct {
+  struct arena_chunk_struct* next;   // Mapped before this one
+  size_t size;
+  size_t used;                       // From the start of the chunk
+} arena_chunk_t;
+
+/**
+ * Bump allocator over zeroed, page aligned chunks, freed all at once.
+ * Allocating takes bumping the offset into the newest chunk, unless it
+ * is full and another one has to be mapped.
+ */
+typedef struct {
+  arena_chunk_t* chunks;   // Newest first
+} arena_t;
+
+/**
+ * Where an arena had got to, to be rewound to
+ */
+typedef struct {
+  arena_chunk_t* chunk;
+  size_t         used;
+} arena_mark_t;
+
+void*        arena_alloc(arena_t*, size_t, size_t);
+arena_mark_t arena_mark(arena_t*);
+void         arena_rewind(arena_t*, arena_mark_t);
+void         arena_free(arena_t*);
+
+void*        pool_take(void);
+void         pool_give(void*);
+
+#endif
@@ -0,0 +1,246 @@
+#include "armemu.h"
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "memory.h"
+
+struct armemu {
+  cpu_t* cpu;
+};
+
+/**
+ * A device added through the API, its opaque pointer kept as the state.
+ * The memory_t comes first so that the handlers can get back to the
+ * callback, and memory_free releases it all.
+ */
+typedef struct {
+  memory_t         memory;
+  armemu_device_fn callback;
+} armemu_device_t;
+
+static memory_t* armemu_device(cpu_t*, uint32_t);
+static uint32_t  armemu_device_read(memory_t*, uint32_t);
+static void      armemu_device_write(memory_t*, uint32_t, uint32_t);
+
+static const device_ops_t armemu_device_ops = {
+  &armemu_device_read, &armemu_device_write
+};
+
+int armemu_version(void) {
+  return ARMEMU_API_VERSION;
+}
+
+/**
+ * Creates a machine with the default devices and empty RAM.
+ * Returns NULL if it cannot be allocated.
+ */
+armemu_t* armemu_create(void) {
+  armemu_t* emu = malloc(sizeof(armemu_t));
+  if (emu == NULL) {
+    return NULL;
+  }
+  emu->cpu = cpu_new();
+  return emu;
+}
+
+void armemu_destroy(armemu_t* emu) {
+  if (emu == NULL) {
+    return;
+  }
+  cpu_free(emu->cpu);
+  free(emu);
+}
+
+/**
+ * Copies an image into RAM at the given address
+ */
+armemu_status_t armemu_load(armemu_t* emu, const void* image, size_t size,
+    uint32_t address) {
+  memory_t* ram = emu->cpu->ram;
+
+  if (address > ram->size || size > ram->size - address) {
+    return ARMEMU_ERROR;
+  }
+
+  memcpy(ram->mem + address, image, size);
+  memory_mark_dirty(ram, address, (uint32_t) size);
+  return ARMEMU_OK;
+}
+
+/**
+ * Runs until a HALT or, unless max_instructions is 0, until that many
+ * instructions have been executed. The number executed is stored in
+ * executed if it is not NULL.
+ */
+armemu_status_t armemu_run(armemu_t* emu, uint64_t max_instructions,
+    uint64_t* executed) {
+  cpu_t*   cpu   = emu->cpu;
+  uint64_t start = cpu->instructions;
+  bool     halted;
+
+  if (max_instructions == 0) {
+    cpu_loop(cpu);
+    halted = true;
+  } else {
+    halted = cpu_run(cpu, max_instructions);
+  }
+
+  if (executed != NULL) {
+    *executed = cpu->instructions - start;
+  }
+  return halted ? ARMEMU_HALTED : ARMEMU_OK;
+}
+
+/**
+ * Instructions executed since the machine was created
+ */
+uint64_t armemu_instructions(armemu_t* emu) {
+  return emu->cpu->instructions;
+}
+
+/**
+ * Reads a register. ARMEMU_PC gives the address of the next instruction
+ * to execute rather than the pipeline's r15. Returns 0 for an unknown
+ * register.
+ */
+uint32_t armemu_get_register(armemu_t* emu, unsigned reg) {
+  cpu_t* cpu = emu->cpu;
+
+  if (reg == ARMEMU_PC) {
+    if (cpu->decoded_inst.type != EMPTY) {
+      return cpu->decoded_pc;
+    }
+    // Nothing decoded yet: the next one is the fetched instruction, or
+    // the one about to be fetched
+    return cpu->has_instruction ? cpu->fetched_pc : cpu->registers[15];
+  }
+  return reg < REG_NUM ? cpu->registers[reg] : 0;
+}
+
+/**
+ * Writes a register. Writing ARMEMU_PC continues execution there, and
+ * writing ARMEMU_CPSR switches mode as MSR would.
+ */
+armemu_status_t armemu_set_register(armemu_t* emu, unsigned reg,
+    uint32_t value) {
+  cpu_t* cpu = emu->cpu;
+
+  if (reg >= REG_NUM) {
+    return ARMEMU_ERROR;
+  }
+
+  if (reg == ARMEMU_CPSR) {
+    cpu_write_cpsr(cpu, value);
+    return ARMEMU_OK;
+  }
+  cpu->registers[reg] = value;
+  if (reg == ARMEMU_PC) {
+    cpu_flush_pipeline(cpu);
+  }
+  return ARMEMU_OK;
+}
+
+/**
+ * Copies guest memory out, from RAM or any device. Device callbacks are
+ * not triggered.
+ */
+armemu_status_t armemu_read(armemu_t* emu, uint32_t address, void* buffer,
+    size_t size) {
+  uint8_t* out = buffer;
+
+  for (size_t i = 0; i < size; i++) {
+    memory_t* device = armemu_device(emu->cpu, address + (uint32_t) i);
+    if (device == NULL) {
+      return ARMEMU_ERROR;
+    }
+    out[i] = device->mem[address + i - device->start];
+  }
+  return ARMEMU_OK;
+}
+
+/**
+ * Copies into guest memory, RAM or any device. Device callbacks are not
+ * triggered. Like a store from the guest, it does not change the two
+ * instructions already in the pipeline.
+ */
+armemu_status_t armemu_write(armemu_t* emu, uint32_t address,
+    const void* buffer, size_t size) {
+  const uint8_t* in = buffer;
+
+  for (size_t i = 0; i < size; i++) {
+    memory_t* device = armemu_device(emu->cpu, address + (uint32_t) i);
+    if (device == NULL) {
+      return ARMEMU_ERROR;
+    }
+    uint32_t offset = address + (uint32_t) i - device->start;
+    device->mem[offset] = in[i];
+    memory_mark_dirty(device, offset, 1);
+  }
+  return ARMEMU_OK;
+}
+
+/**
+ * Maps a device of size bytes at start. Guest accesses to it call
+ * callback (if not NULL) with opaque.
+ * Fails if the range overlaps another device.
+ */
+armemu_status_t armemu_add_device(armemu_t* emu, uint32_t start,
+    uint32_t size, armemu_device_fn callback, void* opaque) {
+  cpu_t* cpu = emu->cpu;
+
+  if (size < 4 || start + size < start || cpu->devicesc == UINT8_MAX) {
+    return ARMEMU_ERROR;
+  }
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    memory_t* other = cpu->devices[i];
+    if (start < other->start + other->size && other->start < start + size) {
+      return ARMEMU_ERROR;
+    }
+  }
+
+  armemu_device_t* device = malloc(sizeof(armemu_device_t));
+  if (device == NULL) {
+    return ARMEMU_ERROR;
+  }
+  memory_init(&device->memory, start, size);
+  device->memory.ops   = &armemu_device_ops;
+  device->memory.state = opaque;
+  device->callback     = callback;
+
+  cpu_add_device(cpu, &device->memory);
+  return ARMEMU_OK;
+}
+
+static uint32_t armemu_device_read(memory_t* memory, uint32_t rel_address) {
+  armemu_device_t* device = (armemu_device_t *) memory;
+
+  if (device->callback != NULL) {
+    device->callback(memory->state, rel_address, false, memory->mem);
+  }
+  return memory_read_unsafe(memory, rel_address);
+}
+
+static void armemu_device_write(memory_t* memory, uint32_t rel_address,
+    uint32_t value) {
+  armemu_device_t* device = (armemu_device_t *) memory;
+
+  if (device->callback != NULL) {
+    device->callback(memory->state, rel_address, true, memory->mem);
+  }
+  memory_write_unsafe(memory, rel_address, value);
+}
+
+/**
+ * Device holding the byte at address, or NULL
+ */
+static memory_t* armemu_device(cpu_t* cpu, uint32_t address) {
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    memory_t* device = cpu->devices[i];
+    if (address >= device->start && address - device->start < device->size) {
+      return device;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef HEADER_ARMEMU
+#define HEADER_ARMEMU
+
+/**
+ * libarmemu: the emulator as a library.
+ *
+ * Everything goes through an opaque armemu_t handle, so the internals can
+ * change without breaking programs built against this header. Machines
+ * are independent of each other; a machine must only be used by one
+ * thread at a time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARMEMU_API_VERSION 1
+
+/**
+ * Register numbers: r0-r15 and the CPSR
+ */
+#define ARMEMU_PC   15
+#define ARMEMU_CPSR 16
+
+typedef struct armemu armemu_t;
+
+typedef enum {
+  ARMEMU_ERROR  = -1,
+  ARMEMU_OK     = 0,   // Done, or the instruction budget is used up
+  ARMEMU_HALTED = 1    // The next instruction is a HALT (all zero word)
+} armemu_status_t;
+
+/**
+ * Called before a guest load or store hits a custom device, with the
+ * offset of the word in the device and the device's backing memory.
+ * A read returns what mem holds once the callback returns; a write
+ * stores the new value after it.
+ */
+typedef void (*armemu_device_fn)(void* opaque, uint32_t offset, bool write,
+    uint8_t* mem);
+
+int             armemu_version(void);
+
+armemu_t*       armemu_create(void);
+void            armemu_destroy(armemu_t*);
+
+armemu_status_t armemu_load(armemu_t*, const void* image, size_t size,
+    uint32_t address);
+armemu_status_t armemu_run(armemu_t*, uint64_t max_instructions,
+    uint64_t* executed);
+uint64_t        armemu_instructions(armemu_t*);
+
+uint32_t        armemu_get_register(armemu_t*, unsigned reg);
+armemu_status_t armemu_set_register(armemu_t*, unsigned reg, uint32_t value);
+
+armemu_status_t armemu_read(armemu_t*, uint32_t address, void* buffer,
+    size_t size);
+armemu_status_t armemu_write(armemu_t*, uint32_t address, const void* buffer,
+    size_t size);
+
+armemu_status_t armemu_add_device(armemu_t*, uint32_t start, uint32_t size,
+    armemu_device_fn callback, void* opaque);
+
+#endif
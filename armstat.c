@@ -0,0 +1,217 @@
+#include "common.h"
+#include <dirent.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "instruction.h"
+#include "stats.h"
+
+/**
+ * armstat: samples the stats pages published by emulate -s, without
+ * stopping the instances.
+ *
+ *   armstat [-d] [-r] [-i seconds] [name...]
+ *
+ * With no names every page in STATS_DIR is shown. -i keeps sampling and
+ * adds the instruction rate, -d lists instruction types and device
+ * accesses, -r removes the pages of instances that are gone.
+ */
+
+typedef struct {
+  char     name[256];
+  uint64_t instructions; // At the previous sample
+} armstat_seen_t;
+
+static armstat_seen_t* seen;
+static uint32_t        seenc;
+
+static const char* inst_names[STATS_INST_TYPES] = {
+  "proc", "mult", "sdt", "branch", "bx", "bdt", "psr", "swi", "halt", "empty"
+};
+
+static uint64_t*   armstat_previous(const char*);
+static const char* armstat_state(stats_t*);
+static void        armstat_show(const char*, stats_t*, const char*, bool,
+    double);
+static uint32_t    armstat_list(char***);
+
+int main(int argc, char** argv) {
+  bool   detail   = false;
+  bool   cleanup  = false;
+  double interval = 0;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "dri:")) != -1) {
+    switch (opt) {
+      case 'd':
+        detail = true;
+        break;
+      case 'r':
+        cleanup = true;
+        break;
+      case 'i':
+        interval = strtod(optarg, NULL);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-d] [-r] [-i seconds] [name...]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  do {
+    char**   names  = argv + optind;
+    uint32_t namesc = (uint32_t) (argc - optind);
+    bool     listed = namesc == 0;
+    uint64_t total  = 0;
+    uint32_t live   = 0;
+
+    if (listed) {
+      namesc = armstat_list(&names);
+    }
+
+    printf("%-24s %8s %5s %16s %12s %14s %12s\n", "name", "pid", "state",
+        "instructions", "flushes", "virtual us", interval > 0 ? "MIPS" : "");
+    for (uint32_t i = 0; i < namesc; i++) {
+      stats_t* stats = stats_open(names[i]);
+      if (stats == NULL) {
+        fprintf(stderr, "%s: no stats page\n", names[i]);
+        continue;
+      }
+
+      const char* state = armstat_state(stats);
+      bool        gone  = strcmp(state, "run") != 0;
+
+      armstat_show(names[i], stats, state, detail, interval);
+      total += stats_get(&stats->instructions);
+      live  += !gone;
+
+      munmap(stats, sizeof(stats_t));
+      if (cleanup && gone) {
+        stats_remove(names[i]);
+      }
+    }
+    printf("%u instances, %u running, %llu instructions\n", namesc, live,
+        (unsigned long long) total);
+
+    if (listed) {
+      for (uint32_t i = 0; i < namesc; i++) {
+        free(names[i]);
+      }
+      free(names);
+    }
+
+    if (interval > 0) {
+      struct timespec wait;
+      wait.tv_sec  = (time_t) interval;
+      wait.tv_nsec = (long) ((interval - (double) wait.tv_sec) * 1e9);
+      fflush(stdout);
+      nanosleep(&wait, NULL);
+      printf("\n");
+    }
+  } while (interval > 0);
+
+  return EXIT_SUCCESS;
+}
+
+static void armstat_show(const char* name, stats_t* stats, const char* state,
+    bool detail, double interval) {
+  uint64_t instructions = stats_get(&stats->instructions);
+
+  printf("%-24s %8llu %5s %16llu %12llu %14llu", name,
+      (unsigned long long) stats->pid, state,
+      (unsigned long long) instructions,
+      (unsigned long long) stats_get(&stats->flushes),
+      (unsigned long long) (stats_get(&stats->virtual_time) / 1000));
+
+  if (interval > 0) {
+    uint64_t* previous = armstat_previous(name);
+    double    rate = (double) (instructions - *previous) / interval / 1e6;
+    printf(" %12.2f", *previous ? rate : 0.0);
+    *previous = instructions;
+  }
+  printf("\n");
+
+  if (!detail) {
+    return;
+  }
+  for (uint32_t i = 0; i < STATS_INST_TYPES; i++) {
+    printf("    %-8s %16llu\n", inst_names[i],
+        (unsigned long long) stats_get(&stats->inst_counts[i]));
+  }
+  for (uint64_t i = 0; i < stats->devicesc && i < STATS_DEVICES; i++) {
+    stats_device_t* device = &stats->devices[i];
+    printf("    0x%08llx %16llu reads %16llu writes\n",
+        (unsigned long long) device->start,
+        (unsigned long long) stats_get(&device->reads),
+        (unsigned long long) stats_get(&device->writes));
+  }
+}
+
+/**
+ * run while the instance updates the page, exit once it has stopped and
+ * dead if it went away without saying so
+ */
+static const char* armstat_state(stats_t* stats) {
+  if (!stats_get(&stats->running)) {
+    return "exit";
+  }
+  return kill((pid_t) stats->pid, 0) == 0 ? "run" : "dead";
+}
+
+/**
+ * Instruction count of the previous sample of name
+ */
+static uint64_t* armstat_previous(const char* name) {
+  for (uint32_t i = 0; i < seenc; i++) {
+    if (strcmp(seen[i].name, name) == 0) {
+      return &seen[i].instructions;
+    }
+  }
+
+  seen = realloc(seen, (seenc + 1) * sizeof(armstat_seen_t));
+  if (seen == NULL) {
+    fprintf(stderr,"realloc failure");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(seen[seenc].name, sizeof(seen[seenc].name), "%s", name);
+  seen[seenc].instructions = 0;
+  return &seen[seenc++].instructions;
+}
+
+/**
+ * Names of all the stats pages in STATS_DIR
+ */
+static uint32_t armstat_list(char*** names) {
+  DIR*           dir    = opendir(STATS_DIR);
+  uint32_t       count  = 0;
+  size_t         prefix = strlen(STATS_PREFIX);
+  struct dirent* entry;
+
+  *names = NULL;
+  if (dir == NULL) {
+    perror(STATS_DIR);
+    return 0;
+  }
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, STATS_PREFIX, prefix) != 0) {
+      continue;
+    }
+    *names = realloc(*names, (count + 1) * sizeof(char *));
+    if (*names == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+    (*names)[count] = malloc(strlen(entry->d_name) - prefix + 1);
+    if ((*names)[count] == NULL) {
+      fprintf(stderr,"malloc failure");
+      exit(EXIT_FAILURE);
+    }
+    strcpy((*names)[count++], entry->d_name + prefix);
+  }
+  closedir(dir);
+
+  return count;
+}
@@ -0,0 +1,190 @@
+#include "cache.h"
+
+static void cache_setup(cache_t*, const char*, cache_config_t*, uint32_t);
+static void cache_report_one(caches_t*, cache_t*, FILE*);
+
+/**
+ * Parses a "size,ways,line" geometry, in bytes. The line size and the
+ * number of sets have to be powers of two.
+ * Returns false if the geometry is invalid.
+ */
+bool cache_parse(const char* text, cache_config_t* config) {
+  if (sscanf(text, "%u,%u,%u", &config->size, &config->ways,
+      &config->line) != 3) {
+    return false;
+  }
+
+  uint32_t line = config->line;
+  if (line < 4 || (line & (line - 1)) || config->ways == 0
+      || config->size % (config->ways * line)) {
+    return false;
+  }
+
+  uint32_t sets = config->size / (config->ways * line);
+  return sets > 0 && (sets & (sets - 1)) == 0;
+}
+
+caches_t* cache_init(cpu_t* cpu, cache_config_t* icache,
+    cache_config_t* dcache) {
+  caches_t* caches = calloc(1, sizeof(caches_t));
+  if (caches == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  caches->cpu   = cpu;
+  caches->slots = cpu->ram->size >> 2;
+
+  cache_setup(&caches->icache, "L1 I", icache, caches->slots);
+  cache_setup(&caches->dcache, "L1 D", dcache, caches->slots);
+
+  return caches;
+}
+
+static void cache_setup(cache_t* cache, const char* name,
+    cache_config_t* config, uint32_t slots) {
+  uint32_t sets = config->size / (config->ways * config->line);
+
+  cache->name       = name;
+  cache->ways       = config->ways;
+  cache->set_mask   = sets - 1;
+  cache->line_shift = 0;
+  while ((1u << cache->line_shift) < config->line) {
+    cache->line_shift++;
+  }
+
+  cache->tags      = calloc((size_t) sets * config->ways, sizeof(uint32_t));
+  cache->pc_misses = calloc(slots, sizeof(uint32_t));
+  if (cache->tags == NULL || cache->pc_misses == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * cpu_loop, passing every fetch and every RAM transfer through the caches.
+ * Transfers to the devices are not cached.
+ */
+void cache_loop(caches_t* caches) {
+  cache_run(caches, UINT64_MAX);
+}
+
+/**
+ * cache_loop for at most max instructions.
+ * Returns true once the instruction to execute next is a HALT.
+ */
+bool cache_run(caches_t* caches, uint64_t max) {
+  cpu_t*   cpu    = caches->cpu;
+  cache_t* icache = &caches->icache;
+  cache_t* dcache = &caches->dcache;
+  uint64_t end    = max < UINT64_MAX - cpu->instructions
+      ? cpu->instructions + max : UINT64_MAX;
+
+  while (cpu->decoded_inst.type != HALT && cpu->instructions < end) {
+    decoded_t* inst = &cpu->decoded_inst;
+    uint32_t   low, high;
+
+    if ((inst->type == SDT || inst->type == BDT)
+        && cpu_eval(cpu, inst->fields.generic.cond)
+        && cpu_transfer_range(cpu, inst, &low, &high)
+        && high <= cpu->ram->size && low < high) {
+      uint32_t slot = cpu->decoded_pc >> 2;
+      uint32_t line = 1u << dcache->line_shift;
+
+      for (uint32_t a = low & ~(line - 1); a < high; a += line) {
+        if (!cache_access(dcache, a) && slot < caches->slots) {
+          dcache->pc_misses[slot]++;
+        }
+      }
+    }
+
+    cpu_step(cpu);
+
+    uint32_t pc = cpu->fetched_pc;
+    if (!cache_access(icache, pc) && (pc >> 2) < caches->slots) {
+      icache->pc_misses[pc >> 2]++;
+    }
+  }
+  return cpu->decoded_inst.type == HALT;
+}
+
+/**
+ * Looks the line holding address up and makes it the most recently used
+ * of its set, evicting the least recently used on a miss.
+ * Returns true on a hit.
+ */
+bool cache_access(cache_t* cache, uint32_t address) {
+  uint32_t  line = address >> cache->line_shift;
+  uint32_t  tag  = line + 1;
+  uint32_t* set  = &cache->tags[(line & cache->set_mask) * cache->ways];
+  uint32_t  way;
+
+  cache->accesses++;
+
+  if (set[0] == tag) {
+    return true;
+  }
+
+  for (way = 1; way < cache->ways && set[way] != tag; way++) {
+  }
+
+  bool hit = way < cache->ways;
+  if (!hit) {
+    way = cache->ways - 1;
+    cache->misses++;
+  }
+
+  memmove(set + 1, set, way * sizeof(uint32_t));
+  set[0] = tag;
+
+  return hit;
+}
+
+static void cache_report_one(caches_t* caches, cache_t* cache, FILE* out) {
+  uint64_t hits = cache->accesses - cache->misses;
+
+  fprintf(out, "%s: %llu accesses, %llu misses, hit rate %.2f%%\n",
+      cache->name, (unsigned long long) cache->accesses,
+      (unsigned long long) cache->misses, cache->accesses
+      ? 100.0 * (double) hits / (double) cache->accesses : 100.0);
+
+  // Highest miss counts, picked one at a time as the list is short
+  uint32_t shown = 0;
+  uint32_t last  = UINT32_MAX;
+  while (shown < CACHE_REPORT_PCS) {
+    uint32_t best = 0;
+    for (uint32_t slot = 0; slot < caches->slots; slot++) {
+      uint32_t misses = cache->pc_misses[slot];
+      if (misses > best && misses <= last) {
+        best = misses;
+      }
+    }
+    if (best == 0) {
+      break;
+    }
+
+    for (uint32_t slot = 0; slot < caches->slots
+        && shown < CACHE_REPORT_PCS; slot++) {
+      if (cache->pc_misses[slot] == best) {
+        fprintf(out, "  0x%08x %12u misses\n", slot << 2, best);
+        shown++;
+      }
+    }
+    last = best - 1;
+  }
+}
+
+/**
+ * Prints the hit rates and the instructions that missed the most
+ */
+void cache_report(caches_t* caches, FILE* out) {
+  cache_report_one(caches, &caches->icache, out);
+  cache_report_one(caches, &caches->dcache, out);
+}
+
+void cache_free(caches_t* caches) {
+  free(caches->icache.tags);
+  free(caches->icache.pc_misses);
+  free(caches->dcache.tags);
+  free(caches->dcache.pc_misses);
+  free(caches);
+}
@@ -0,0 +1,61 @@
+#ifndef HEADER_CACHE
+#define HEADER_CACHE
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "instruction.h"
+
+/**
+ * Default geometry, that of the ARM1176 L1 caches:
+ * 16 KiB, 4 ways, 32 byte lines
+ */
+#define CACHE_SIZE 16384
+#define CACHE_WAYS 4
+#define CACHE_LINE 32
+
+/**
+ * Number of instructions listed for each cache in the report
+ */
+#define CACHE_REPORT_PCS 10
+
+typedef struct {
+  uint32_t size;
+  uint32_t ways;
+  uint32_t line;
+} cache_config_t;
+
+/**
+ * A set-associative cache with LRU replacement. Only the tags are kept:
+ * the ways of a set are next to each other, most recently used first,
+ * and a tag is the line number plus one so that 0 marks an empty way.
+ */
+typedef struct {
+  const char* name;
+  uint32_t*   tags;
+  uint32_t    ways;
+  uint32_t    set_mask;
+  uint8_t     line_shift;
+
+  uint64_t    accesses;
+  uint64_t    misses;
+  uint32_t*   pc_misses;  // Indexed by the word address of the instruction
+} cache_t;
+
+typedef struct {
+  cpu_t*   cpu;
+  cache_t  icache;
+  cache_t  dcache;
+  uint32_t slots;
+} caches_t;
+
+bool      cache_parse(const char*, cache_config_t*);
+caches_t* cache_init(cpu_t*, cache_config_t*, cache_config_t*);
+void      cache_loop(caches_t*);
+bool      cache_run(caches_t*, uint64_t);
+bool      cache_access(cache_t*, uint32_t);
+void      cache_report(caches_t*, FILE*);
+void      cache_free(caches_t*);
+
+#endif
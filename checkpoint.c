@@ -0,0 +1,310 @@
+#include "checkpoint.h"
+
+static void     checkpoint_merge(checkpoints_t*);
+static size_t   checkpoint_size(checkpoints_t*, checkpoint_t*);
+static uint8_t* checkpoint_page(checkpoint_t*, uint32_t);
+static void     checkpoint_release(checkpoints_t*, checkpoint_t*);
+
+/**
+ * Sets up checkpoints of the cpu every interval instructions, keeping at
+ * most budget bytes, and takes the first one straight away.
+ */
+checkpoints_t* checkpoint_init(cpu_t* cpu, uint64_t interval, size_t budget) {
+  checkpoints_t* store = calloc(1, sizeof(checkpoints_t));
+  if (store == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  store->cpu      = cpu;
+  store->interval = interval ? interval : CHECKPOINT_INTERVAL;
+  store->budget   = budget;
+
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    if (cpu->devices[i] != cpu->ram) {
+      store->devices_size += cpu->devices[i]->size;
+    }
+  }
+
+  // Every page written so far still has its delta flag set, e.g. by
+  // load_binary, so the first checkpoint is a full one
+  checkpoint_take(store);
+
+  return store;
+}
+
+/**
+ * cpu_loop, taking a checkpoint whenever the interval has passed
+ */
+void checkpoint_loop(checkpoints_t* store) {
+  cpu_t* cpu = store->cpu;
+
+  while (!cpu_step(cpu)) {
+    if (cpu->instructions >= store->next) {
+      checkpoint_take(store);
+    }
+  }
+}
+
+/**
+ * Saves the registers, the pipeline, the devices and the RAM pages
+ * written since the previous checkpoint.
+ */
+void checkpoint_take(checkpoints_t* store) {
+  cpu_t*    cpu = store->cpu;
+  memory_t* ram = cpu->ram;
+
+  if (store->count == store->capacity) {
+    store->capacity = store->capacity ? store->capacity * 2 : 16;
+    store->checkpoints = realloc(store->checkpoints,
+        store->capacity * sizeof(checkpoint_t));
+    if (store->checkpoints == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  checkpoint_t* c = &store->checkpoints[store->count++];
+  c->id              = store->next_id++;
+  c->instructions    = cpu->instructions;
+  memcpy(c->registers, cpu->registers, sizeof(uint32_t) * REG_NUM);
+  c->banked          = cpu->banked;
+  c->has_instruction = cpu->has_instruction;
+  c->decoded_inst    = cpu->decoded_inst;
+  c->fetched_inst    = cpu->fetched_inst;
+  c->fetched_pc      = cpu->fetched_pc;
+  c->decoded_pc      = cpu->decoded_pc;
+  c->c_temp          = cpu->c_temp;
+  c->poll            = cpu->poll;
+  memcpy(c->events, cpu->events, sizeof(c->events));
+
+  c->devices = malloc(store->devices_size);
+  if (c->devices == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+  uint8_t* out = c->devices;
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    memory_t* device = cpu->devices[i];
+    if (device != ram) {
+      memcpy(out, device->mem, device->size);
+      out += device->size;
+    }
+  }
+
+  uint32_t pages = memory_pages(ram);
+  c->pagec = 0;
+  for (uint32_t page = 0; page < pages; page++) {
+    c->pagec += (ram->dirty[page] & MEMORY_PAGE_DELTA) != 0;
+  }
+
+  c->pages = malloc(c->pagec * sizeof(uint32_t) + 1);
+  c->data  = malloc((size_t) c->pagec * MEMORY_PAGE_SIZE + 1);
+  if (c->pages == NULL || c->data == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t n = 0;
+  for (uint32_t page = 0; page < pages; page++) {
+    if (ram->dirty[page] & MEMORY_PAGE_DELTA) {
+      uint32_t start = page << MEMORY_PAGE_SHIFT;
+      uint32_t bytes = ram->size - start < MEMORY_PAGE_SIZE
+          ? ram->size - start : MEMORY_PAGE_SIZE;
+
+      c->pages[n] = page;
+      memcpy(c->data + (size_t) n * MEMORY_PAGE_SIZE, ram->mem + start, bytes);
+      ram->dirty[page] &= (uint8_t) ~MEMORY_PAGE_DELTA;
+      n++;
+    }
+  }
+
+  store->used += checkpoint_size(store, c);
+  store->next  = cpu->instructions + store->interval;
+
+  while (store->used > store->budget && store->count > 1) {
+    checkpoint_merge(store);
+  }
+}
+
+/**
+ * Restores the state saved by the checkpoint with the given id. Only the
+ * pages written after it are copied back, from the newest checkpoint at or
+ * before it holding them. Later checkpoints are dropped.
+ * Returns false if there is no such checkpoint.
+ */
+bool checkpoint_rewind(checkpoints_t* store, uint32_t id) {
+  cpu_t*    cpu = store->cpu;
+  memory_t* ram = cpu->ram;
+  uint32_t  k;
+
+  for (k = 0; k < store->count && store->checkpoints[k].id != id; k++) {
+  }
+  if (k == store->count) {
+    return false;
+  }
+
+  for (uint32_t page = 0; page < memory_pages(ram); page++) {
+    bool changed = ram->dirty[page] & MEMORY_PAGE_DELTA;
+    for (uint32_t j = k + 1; j < store->count && !changed; j++) {
+      changed = checkpoint_page(&store->checkpoints[j], page) != NULL;
+    }
+    if (!changed) {
+      continue;
+    }
+
+    uint32_t start = page << MEMORY_PAGE_SHIFT;
+    uint32_t bytes = ram->size - start < MEMORY_PAGE_SIZE
+        ? ram->size - start : MEMORY_PAGE_SIZE;
+    uint8_t* data  = NULL;
+
+    for (uint32_t j = k + 1; j-- > 0 && data == NULL; ) {
+      data = checkpoint_page(&store->checkpoints[j], page);
+    }
+
+    // A page no checkpoint holds had not been written yet
+    if (data != NULL) {
+      memcpy(ram->mem + start, data, bytes);
+    } else {
+      memset(ram->mem + start, 0, bytes);
+    }
+    ram->dirty[page] &= (uint8_t) ~MEMORY_PAGE_DELTA;
+  }
+
+  checkpoint_t* c = &store->checkpoints[k];
+  uint8_t* in = c->devices;
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    memory_t* device = cpu->devices[i];
+    if (device != ram) {
+      memcpy(device->mem, in, device->size);
+      memory_mark_dirty(device, 0, device->size);
+      in += device->size;
+    }
+  }
+
+  memcpy(cpu->registers, c->registers, sizeof(uint32_t) * REG_NUM);
+  cpu->banked          = c->banked;
+  cpu->has_instruction = c->has_instruction;
+  cpu->decoded_inst    = c->decoded_inst;
+  cpu->fetched_inst    = c->fetched_inst;
+  cpu->fetched_pc      = c->fetched_pc;
+  cpu->decoded_pc      = c->decoded_pc;
+  cpu->c_temp          = c->c_temp;
+  cpu->poll            = c->poll;
+  memcpy(cpu->events, c->events, sizeof(cpu->events));
+  cpu->instructions    = c->instructions;
+  cpu_poll(cpu);
+
+  while (store->count > k + 1) {
+    checkpoint_release(store, &store->checkpoints[--store->count]);
+  }
+  store->next = cpu->instructions + store->interval;
+
+  return true;
+}
+
+/**
+ * Folds the oldest checkpoint into the one after it, which then holds
+ * every page written up to it.
+ */
+static void checkpoint_merge(checkpoints_t* store) {
+  checkpoint_t* old  = &store->checkpoints[0];
+  checkpoint_t* next = &store->checkpoints[1];
+  uint32_t      n    = 0;
+  uint32_t      i    = 0;
+  uint32_t      j    = 0;
+
+  store->used -= checkpoint_size(store, next);
+
+  uint32_t* pages = malloc((old->pagec + next->pagec) * sizeof(uint32_t) + 1);
+  uint8_t*  data  = malloc((size_t) (old->pagec + next->pagec)
+      * MEMORY_PAGE_SIZE + 1);
+  if (pages == NULL || data == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  // Both page lists are sorted, the newer copy of a page wins
+  while (i < old->pagec || j < next->pagec) {
+    uint8_t* src;
+    if (j < next->pagec && (i == old->pagec || next->pages[j] <= old->pages[i])) {
+      if (i < old->pagec && old->pages[i] == next->pages[j]) {
+        i++;
+      }
+      pages[n] = next->pages[j];
+      src = next->data + (size_t) j++ * MEMORY_PAGE_SIZE;
+    } else {
+      pages[n] = old->pages[i];
+      src = old->data + (size_t) i++ * MEMORY_PAGE_SIZE;
+    }
+    memcpy(data + (size_t) n++ * MEMORY_PAGE_SIZE, src, MEMORY_PAGE_SIZE);
+  }
+
+  free(next->pages);
+  free(next->data);
+  next->pages = pages;
+  next->data  = data;
+  next->pagec = n;
+
+  checkpoint_release(store, old);
+  store->used += checkpoint_size(store, next);
+  store->count--;
+  memmove(store->checkpoints, store->checkpoints + 1,
+      store->count * sizeof(checkpoint_t));
+  store->merged++;
+}
+
+/**
+ * Bytes held by a checkpoint
+ */
+static size_t checkpoint_size(checkpoints_t* store, checkpoint_t* c) {
+  return sizeof(checkpoint_t) + store->devices_size
+      + (size_t) c->pagec * (MEMORY_PAGE_SIZE + sizeof(uint32_t));
+}
+
+/**
+ * Saved copy of a RAM page, or NULL if the checkpoint does not hold it
+ */
+static uint8_t* checkpoint_page(checkpoint_t* c, uint32_t page) {
+  uint32_t low  = 0;
+  uint32_t high = c->pagec;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (c->pages[mid] < page) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low < c->pagec && c->pages[low] == page) {
+    return c->data + (size_t) low * MEMORY_PAGE_SIZE;
+  }
+  return NULL;
+}
+
+static void checkpoint_release(checkpoints_t* store, checkpoint_t* c) {
+  store->used -= checkpoint_size(store, c);
+  free(c->devices);
+  free(c->pages);
+  free(c->data);
+}
+
+void checkpoint_dump(checkpoints_t* store, FILE* out) {
+  fprintf(out, "checkpoints       : %u (%llu merged)\n", store->count,
+      (unsigned long long) store->merged);
+  fprintf(out, "checkpoint memory : %zu bytes\n", store->used);
+  for (uint32_t i = 0; i < store->count; i++) {
+    checkpoint_t* c = &store->checkpoints[i];
+    fprintf(out, "  #%-4u at %llu instructions, %u pages\n", c->id,
+        (unsigned long long) c->instructions, c->pagec);
+  }
+}
+
+void checkpoint_free(checkpoints_t* store) {
+  while (store->count > 0) {
+    checkpoint_release(store, &store->checkpoints[--store->count]);
+  }
+  free(store->checkpoints);
+  free(store);
+}
@@ -0,0 +1,68 @@
+#ifndef HEADER_CHECKPOINT
+#define HEADER_CHECKPOINT
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "memory.h"
+
+/**
+ * Default number of instructions between two checkpoints
+ */
+#define CHECKPOINT_INTERVAL 100000
+
+/**
+ * Default limit on the memory held by the checkpoints (16 MiB)
+ */
+#define CHECKPOINT_BUDGET (16 << 20)
+
+/**
+ * State of the machine after a given number of instructions.
+ * Only the RAM pages written since the previous checkpoint are kept,
+ * the oldest checkpoint holds every page written up to it.
+ */
+typedef struct {
+  uint32_t  id;
+  uint64_t  instructions;
+
+  uint32_t  registers[REG_NUM];
+  banked_t  banked;
+  bool      has_instruction;
+  decoded_t decoded_inst;
+  uint32_t  fetched_inst;
+  uint32_t  fetched_pc;
+  uint32_t  decoded_pc;
+  uint32_t  c_temp;
+  uint16_t  poll;       // So that a rewound run polls at the same points
+  uint64_t  events[PMU_SOURCES];
+
+  uint8_t*  devices;    // Contents of every other device
+  uint32_t  pagec;
+  uint32_t* pages;      // RAM page numbers, ascending
+  uint8_t*  data;       // pagec * MEMORY_PAGE_SIZE bytes
+} checkpoint_t;
+
+typedef struct {
+  cpu_t*        cpu;
+  uint64_t      interval;
+  uint64_t      next;     // Instruction count of the next checkpoint
+  size_t        budget;
+  size_t        used;     // Bytes held by the checkpoints
+  size_t        devices_size;
+
+  checkpoint_t* checkpoints; // Oldest first
+  uint32_t      count;
+  uint32_t      capacity;
+  uint32_t      next_id;
+  uint64_t      merged;
+} checkpoints_t;
+
+checkpoints_t* checkpoint_init(cpu_t*, uint64_t, size_t);
+void           checkpoint_loop(checkpoints_t*);
+void           checkpoint_take(checkpoints_t*);
+bool           checkpoint_rewind(checkpoints_t*, uint32_t);
+void           checkpoint_dump(checkpoints_t*, FILE*);
+void           checkpoint_free(checkpoints_t*);
+
+#endif
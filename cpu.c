@@ -1,73 +1,264 @@
 #include "cpu.h"
 
-void cpu_init(cpu_t* this) {
-  // Set registers to 0
-  this->registers = calloc(REG_NUM, sizeof(uint32_t));
-  if(this->registers == NULL) {
-    fprintf(stderr,"calloc failure");
-    exit(EXIT_FAILURE);
+static uint8_t cpu_bank(uint8_t);
+static bool    cpu_valid_mode(uint8_t);
+static void    cpu_restore_cpsr(cpu_t*);
+static void    cpu_wait(cpu_t*);
+static void    cpu_init(cpu_t*);
+static void    cpu_advance(cpu_t*);
+static bool    cpu_fusible(cpu_t*, uint8_t);
+static bool    cpu_step_fused(cpu_t*, uint8_t);
+
+/**
+ * Machines freed, for their arenas to be reused. They may be made and
+ * freed on several threads, so the pool is only touched under the lock.
+ */
+static cpu_t*          cpu_pool[CPU_POOL];
+static uint32_t        cpu_pooled    = 0;
+static pthread_mutex_t cpu_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Creates a machine with the default devices, reusing the arena of one
+ * freed before if any. Its RAM comes from the huge page pool.
+ */
+cpu_t* cpu_new(void) {
+  cpu_t* cpu = NULL;
+
+  pthread_mutex_lock(&cpu_pool_lock);
+  if (cpu_pooled > 0) {
+    cpu = cpu_pool[--cpu_pooled];
   }
+  pthread_mutex_unlock(&cpu_pool_lock);
+
+  if (cpu != NULL) {
+    arena_rewind(&cpu->arena, cpu->built);
+  } else {
+    arena_t arena = { NULL };
+    cpu        = arena_alloc(&arena, sizeof(cpu_t), 0);
+    cpu->arena = arena;
+    cpu->built = arena_mark(&cpu->arena);
+  }
+  cpu_init(cpu);
+  return cpu;
+}
+
+static void cpu_init(cpu_t* this) {
+  // Set registers to 0
+  this->registers = arena_alloc(&this->arena, REG_NUM * sizeof(uint32_t),
+      0);
   this->flags = (flags_t *) &(this->registers[16]);
   this->has_instruction = false;
+  this->decoded_inst.type = EMPTY;
   this->instruction_to_execute = &(this->decoded_inst.fields.instruction);
 
   // Set up default devices: ram and timer
   this->devicesc = 0;
-  
-  // Allocate pointer to size zero so that it can be realloc'd
-  // (although this is implementation specific, TODO: test)
-  this->devices = malloc(0);
-  if(this->devices == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
-  }
+  this->devices  = arena_alloc(&this->arena,
+      CPU_MAX_DEVICES * sizeof(memory_t *), 0);
 
-  memory_t* ram = ram_init();
-  cpu_add_device(this, ram);
-  this->ram     = ram; 
+  for (uint8_t i = 0; i < DEVICE_DEFAULTS; i++) {
+    cpu_add_device(this, device_table[i](&this->arena));
+  }
+  this->ram     = this->devices[DEVICE_RAM];
+  this->timer   = this->devices[DEVICE_TIMER];
+  this->mailbox = this->devices[DEVICE_MAILBOX];
+  this->intc    = this->devices[DEVICE_INTC];
+  this->dma     = this->devices[DEVICE_DMA];
+  this->uart    = this->devices[DEVICE_UART];
+  this->pmu     = this->devices[DEVICE_PMU];
+
+  this->c_temp     = 0;
+  this->fetched_pc = 0;
+  this->decoded_pc = 0;
+  this->instructions = 0;
+  this->stats = NULL;
+  this->semihost = NULL;
+  this->image    = NULL;
+  this->replay   = NULL;
+  memset(&this->banked, 0, sizeof(banked_t));
+  this->interrupts = 0;
+  this->poll       = CPU_POLL_INTERVAL;
+  memset(this->events, 0, sizeof(this->events));
+  memset(this->fused, 0, sizeof(this->fused));
+  pmu_attach(this->pmu, &this->instructions, this->events);
+}
 
-  memory_t* timer = timer_init();
-  cpu_add_device(this, timer);
-  this->timer    = timer; 
-  timer->custom_buffer = clock();
+void cpu_add_device(cpu_t* cpu, memory_t* device) {
+  assert(cpu->devicesc < CPU_MAX_DEVICES);
+  cpu->devices[cpu->devicesc++] = device;
+}
 
-  memory_t* mailbox = mailbox_init();
-  cpu_add_device(this, mailbox);
-  this->mailbox = mailbox; 
+/**
+ * Runs the guest until it halts, running the superinstructions of its
+ * image as single steps
+ */
+void cpu_loop(cpu_t* cpu) {
+  image_t* image  = cpu->image;
+  uint32_t words  = image != NULL ? image->size >> 2 : 0;
+  bool     halted = false;
 
-  memory_t* gpio = gpio_init();
-  cpu_add_device(this, gpio);
+  while (!halted) {
+    uint32_t i      = cpu->decoded_pc >> 2;
+    uint8_t  fusion = i < words ? image->fusions[i] : FUSE_NONE;
 
-  this->c_temp   = 0;
+    halted = fusion != FUSE_NONE && cpu_fusible(cpu, fusion)
+        ? cpu_step_fused(cpu, fusion) : cpu_step(cpu);
+  }
 }
 
-void cpu_add_device(cpu_t* cpu, memory_t* device) {
-  ++cpu->devicesc;
-  cpu->devices = realloc(cpu->devices, (cpu->devicesc) * sizeof(memory_t *));
-  cpu->devices[cpu->devicesc - 1] = device;
+/**
+ * Runs at most max instructions, so that the caller can interleave
+ * several machines or stop after a budget.
+ * Returns true once the instruction to execute next is a HALT.
+ */
+bool cpu_run(cpu_t* cpu, uint64_t max) {
+  uint64_t end    = cpu->instructions + max;
+  bool     halted = cpu->decoded_inst.type == HALT;
+
+  while (!halted && cpu->instructions < end) {
+    halted = cpu_step(cpu);
+  }
+  return halted;
 }
 
-void cpu_loop(cpu_t* cpu) {
-  while (cpu->decoded_inst.type != HALT) {
+/**
+ * Runs a single cycle of the execute-decode-fetch pipeline.
+ * Returns true once the instruction to execute next is a HALT.
+ */
+bool cpu_step(cpu_t* cpu) {
+  if (cpu->decoded_inst.type == HALT) {
+    return true;
+  }
+
+  if (--cpu->poll == 0) {
+    cpu->poll = CPU_POLL_INTERVAL;
+    cpu_poll(cpu);
+  }
+
+  if (cpu->interrupts && cpu->decoded_inst.type != EMPTY
+      && cpu_interrupt(cpu)) {
+    // The instruction is run again on return from the handler
+  } else {
+    if (cpu->decoded_inst.type != EMPTY) {
+      cpu->instructions++;
+    }
+    if (cpu->stats != NULL) {
+      stats_step(cpu->stats, cpu->decoded_inst.type, cpu->instructions);
+    }
 
     cpu_execute(cpu);
-    if (cpu->has_instruction) {
-      cpu->decoded_inst = instruction_decode(cpu->fetched_inst);
-    } else {
-      cpu->decoded_inst.type = EMPTY;
-      cpu->has_instruction = true;
+  }
+  cpu_advance(cpu);
+
+  return cpu->decoded_inst.type == HALT;
+}
+
+/**
+ * Moves the fetched instruction to decode and fetches the next one
+ */
+static void cpu_advance(cpu_t* cpu) {
+  if (cpu->has_instruction) {
+    cpu->decoded_inst = image_decode(cpu->image, cpu->fetched_pc,
+        cpu->fetched_inst);
+    cpu->decoded_pc   = cpu->fetched_pc;
+  } else {
+    cpu->decoded_inst.type = EMPTY;
+    cpu->has_instruction = true;
+  }
+
+  cpu_fetch_instruction(cpu);
+
+  // The program counter is incremented by 4
+  // because of the addressing mode of the machine (4 byte words)
+  //TODO: pc
+  cpu->registers[15] += 4;
+}
+
+/**
+ * Whether the superinstruction of the image starting at the decoded
+ * instruction can be run as one step: the decoded and fetched words, and
+ * the word after them for a triple, are the image's at the addresses
+ * that follow each other, and the steps it replaces, with the one
+ * refilling the pipeline after a branch, would neither poll, take an
+ * interrupt nor publish stats in between
+ */
+static bool cpu_fusible(cpu_t* cpu, uint8_t fusion) {
+  image_t* image  = cpu->image;
+  uint32_t pc     = cpu->decoded_pc;
+  uint32_t i      = pc >> 2;
+  uint8_t  length = fuse_length(fusion);
+
+  if ((pc & 3) != 0 || cpu->interrupts || cpu->poll <= length + 1
+      || cpu->stats != NULL
+      || cpu->decoded_inst.type != image->decoded[i].type
+      || cpu->decoded_inst.fields.instruction != image->words[i]
+      || cpu->fetched_pc != pc + 4
+      || cpu->fetched_inst != image->words[i + 1]) {
+    return false;
+  }
+  // The image lies at the start of RAM
+  return length == 2
+      || memory_read_unsafe(cpu->ram, pc + 8) == image->words[i + 2];
+}
+
+/**
+ * Runs a superinstruction, leaving the cpu as the cpu_step calls for each
+ * of its instructions would. They are taken from the image and run
+ * straight through their handlers, the PC set for each as the pipeline
+ * would have it. Only the last may store, so the word after it is
+ * fetched just before it runs. A branch taken at the end is followed by
+ * the step refilling the pipeline.
+ * Returns true once the instruction to execute next is a HALT.
+ */
+static bool cpu_step_fused(cpu_t* cpu, uint8_t fusion) {
+  uint8_t    length = fuse_length(fusion);
+  uint32_t   pc     = cpu->decoded_pc;
+  decoded_t* run    = &cpu->image->decoded[pc >> 2];
+
+  cpu->poll -= length;
+  cpu->fused[fusion]++;
+
+  for (uint8_t k = 0; k < length; k++, pc += 4) {
+    if (k > 0) {
+      cpu->decoded_inst = run[k];
+      cpu->decoded_pc   = pc;
     }
+    if (k == length - 1) {
+      cpu->registers[15] = pc + 4;
+      cpu_fetch_instruction(cpu);
+    }
+    cpu->registers[15] = pc + 8;
+    cpu->instructions++;
 
-    cpu_fetch_instruction(cpu);
+    uint8_t cond = cpu->decoded_inst.fields.generic.cond;
+    if (cond != COND_AL && !cpu_eval(cpu, cond)) {
+      continue;
+    }
+    switch (cpu->decoded_inst.type) {
+      case PROC:
+        cpu_execute_proc(cpu);
+        break;
+      case SDT:
+        cpu_execute_sdt(cpu);
+        break;
+      default:
+        cpu_execute_branch(cpu);
+        break;
+    }
+  }
+  cpu_advance(cpu);
 
-    // The program counter is incremented by 4
-    // because of the addressing mode of the machine (4 byte words)
-    //TODO: pc
-    cpu->registers[15] += 4;
+  // The step after a branch taken only refills the pipeline
+  if (cpu->decoded_inst.type == EMPTY) {
+    cpu->poll--;
+    cpu_advance(cpu);
   }
+
+  return cpu->decoded_inst.type == HALT;
 }
 
 void cpu_fetch_instruction(cpu_t* cpu) {
+  cpu->fetched_pc   = cpu->registers[15];
   cpu->fetched_inst = memory_read(cpu->ram, cpu->registers[15]);
 }
 
@@ -147,6 +338,12 @@ bool cpu_execute(cpu_t* cpu) {
       case BDT:
         cpu_execute_bdt(cpu);
         break;
+      case PSR:
+        cpu_execute_psr(cpu);
+        break;
+      case SWI:
+        cpu_execute_swi(cpu);
+        break;
       default:
         break;
     }
@@ -160,13 +357,7 @@ bool cpu_execute(cpu_t* cpu) {
  */
 void cpu_execute_branch(cpu_t* cpu) {
   inst_branch_t* inst = cpu->instruction_to_execute;
-  uint32_t offset = inst->offset << 2;
-  uint32_t sign_bit = (uint32_t) (get_bit(offset, 23) << 31);
-  
-  for (int i = 0; i < 8; i++) {
-    offset = offset | sign_bit;
-    sign_bit >>= 1;
-  }
+  uint32_t offset = cpu_branch_offset(inst);
 
   // BL instruction
   if (inst->l) { 
@@ -176,11 +367,27 @@ void cpu_execute_branch(cpu_t* cpu) {
   
   //TODO: pc nicer
   cpu->registers[15] += offset;
+  cpu->events[PMU_BRANCHES]++;
   
   cpu_flush_pipeline(cpu);
   
 }
 
+/**
+ * Sign extended byte offset of a branch instruction
+ */
+uint32_t cpu_branch_offset(inst_branch_t* inst) {
+  uint32_t offset = inst->offset << 2;
+  uint32_t sign_bit = (uint32_t) (get_bit(offset, 23) << 31);
+  
+  for (int i = 0; i < 8; i++) {
+    offset = offset | sign_bit;
+    sign_bit >>= 1;
+  }
+
+  return offset;
+}
+
 /**
  * TODO: comment cba, test
  */
@@ -195,10 +402,241 @@ void cpu_execute_bx(cpu_t* cpu) {
   cpu_flush_pipeline(cpu);
 }
 
-//TODO: Need to implement exception handling; P30 in the ARM Document
+/**
+ * MRS, MSR and the hints encoded as MSR with no fields, of which WFI
+ * waits for an interrupt and the others do nothing. User mode may only
+ * write the flags, and a write to the control bits is ignored if it
+ * does not leave the CPSR in a valid mode.
+ */
+void cpu_execute_psr(cpu_t* cpu) {
+  inst_psr_t* inst = cpu->instruction_to_execute;
+  uint32_t*   spsr = &cpu->banked.modes[cpu_bank(cpu->flags->mode)][2];
+  bool        user = cpu->flags->mode == MODE_USR;
+
+  if (!inst->msr) {
+    cpu->registers[inst->r_d] = inst->r ? *spsr : cpu->registers[16];
+    return;
+  }
+
+  if (inst->mask == 0) {
+    if (inst->i && inst->op2 == HINT_WFI) {
+      cpu_wait(cpu);
+    }
+    return;
+  }
+
+  uint32_t value;
+  if (inst->i) {
+    uint32_t imm    = get_bits(inst->op2, 0, 7);
+    uint8_t  rotate = (uint8_t) (get_bits(inst->op2, 8, 11) * 2);
+    value = rotate ? (imm >> rotate) | (imm << (32 - rotate)) : imm;
+  } else {
+    value = cpu->registers[inst->op2 & 0xF];
+  }
+
+  uint32_t fields = 0;
+  for (int i = 0; i < 4; i++) {
+    if (get_bit(inst->mask, i)) {
+      fields |= 0xFFu << (8 * i);
+    }
+  }
+
+  if (inst->r) {
+    if (cpu_bank(cpu->flags->mode) != BANK_USR) {
+      *spsr = (*spsr & ~fields) | (value & fields);
+    }
+    return;
+  }
+
+  if (user) {
+    fields &= 0xFF000000;
+  }
+  cpu_write_cpsr(cpu, (cpu->registers[16] & ~fields) | (value & fields));
+}
+
+/**
+ * Writes the whole CPSR, switching the banked registers over if the mode
+ * changes. A value that is not in a valid mode is ignored.
+ */
+void cpu_write_cpsr(cpu_t* cpu, uint32_t cpsr) {
+  uint8_t mode = (uint8_t) (cpsr & 0x1F);
+
+  if (mode != cpu->flags->mode && !cpu_valid_mode(mode)) {
+    return;
+  }
+  cpu_set_mode(cpu, mode);
+  cpu->registers[16] = cpsr;
+
+  // Interrupts may have been unmasked
+  cpu_poll(cpu);
+}
+
+/**
+ * Enters supervisor mode, returning to the next instruction. Semihosting
+ * calls are run on the host instead when it is enabled.
+ */
+void cpu_execute_swi(cpu_t* cpu) {
+  inst_swi_t* inst = cpu->instruction_to_execute;
+
+  if (cpu->semihost != NULL && inst->comment == SEMIHOST_SWI) {
+    if (semihost_call(cpu->semihost, cpu->registers, cpu->ram)) {
+      cpu_halt(cpu);
+    }
+    return;
+  }
+  cpu_exception(cpu, MODE_SVC, VECTOR_SWI, cpu->registers[15] - 4);
+}
+
+/**
+ * Takes the exception: the CPSR is saved to the SPSR of mode, mode
+ * entered with IRQs (and for a FIQ, FIQs) masked, link put in its r14
+ * and the pipeline refilled from vector.
+ */
+void cpu_exception(cpu_t* cpu, uint8_t mode, uint32_t vector,
+    uint32_t link) {
+  uint32_t cpsr = cpu->registers[16];
+
+  cpu_set_mode(cpu, mode);
+  cpu->banked.modes[cpu_bank(mode)][2] = cpsr;
+  cpu->registers[14] = link;
+  cpu->flags->i = 1;
+  cpu->flags->t = 0;
+  if (mode == MODE_FIQ) {
+    cpu->flags->f = 1;
+  }
+
+  cpu->registers[15] = vector;
+  cpu_flush_pipeline(cpu);
+}
+
+/**
+ * Switches the banked registers over to those of mode and sets the mode
+ * bits. The rest of the CPSR is left as it is.
+ */
+void cpu_set_mode(cpu_t* cpu, uint8_t mode) {
+  uint32_t* reg  = cpu->registers;
+  uint8_t   from = cpu_bank(cpu->flags->mode);
+  uint8_t   to   = cpu_bank(mode);
+
+  if (from != to) {
+    cpu->banked.modes[from][0] = reg[13];
+    cpu->banked.modes[from][1] = reg[14];
+    reg[13] = cpu->banked.modes[to][0];
+    reg[14] = cpu->banked.modes[to][1];
+
+    if ((from == BANK_FIQ) != (to == BANK_FIQ)) {
+      memcpy(cpu->banked.fiq[from == BANK_FIQ], reg + 8, 5 * sizeof(uint32_t));
+      memcpy(reg + 8, cpu->banked.fiq[to == BANK_FIQ], 5 * sizeof(uint32_t));
+    }
+  }
+  cpu->flags->mode = mode;
+}
 
 /**
- * TODO: S bit is ignored
+ * Exception return: the CPSR is restored from the SPSR of the mode
+ */
+static void cpu_restore_cpsr(cpu_t* cpu) {
+  uint32_t spsr = cpu->banked.modes[cpu_bank(cpu->flags->mode)][2];
+
+  cpu_set_mode(cpu, (uint8_t) (spsr & 0x1F));
+  cpu->registers[16] = spsr;
+  cpu_poll(cpu);
+}
+
+static uint8_t cpu_bank(uint8_t mode) {
+  switch (mode) {
+    case MODE_FIQ:
+      return BANK_FIQ;
+    case MODE_IRQ:
+      return BANK_IRQ;
+    case MODE_SVC:
+      return BANK_SVC;
+    case MODE_ABT:
+      return BANK_ABT;
+    case MODE_UND:
+      return BANK_UND;
+    default:
+      return BANK_USR;
+  }
+}
+
+static bool cpu_valid_mode(uint8_t mode) {
+  return mode == MODE_USR || mode == MODE_SYS
+      || cpu_bank(mode) != BANK_USR;
+}
+
+/**
+ * Asks the devices which interrupt lines they raise and the controller
+ * what it makes of them. The timer is only read when one of its lines
+ * is enabled. DMA transfers are run once they are due.
+ */
+void cpu_poll(cpu_t* cpu) {
+  uint64_t lines = 0;
+
+  if (intc_enabled(cpu->intc) & INTC_TIMER_LINES) {
+    lines |= timer_update(cpu->timer, (uint32_t) timer_now(cpu->timer));
+  }
+  lines |= dma_update(cpu->dma, cpu->devices, cpu->devicesc,
+      cpu->instructions);
+  lines |= pmu_update(cpu->pmu);
+  cpu->interrupts = intc_update(cpu->intc, lines);
+}
+
+/**
+ * Takes the pending interrupt the CPSR does not mask, if any, in place of
+ * the decoded instruction: the handler returns to it with
+ * SUBS pc, lr, #4.
+ */
+bool cpu_interrupt(cpu_t* cpu) {
+  uint32_t link = cpu->decoded_pc + 4;
+
+  if ((cpu->interrupts & INTC_FIQ) && !cpu->flags->f) {
+    cpu_exception(cpu, MODE_FIQ, VECTOR_FIQ, link);
+    return true;
+  }
+  if ((cpu->interrupts & INTC_IRQ) && !cpu->flags->i) {
+    cpu_exception(cpu, MODE_IRQ, VECTOR_IRQ, link);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * WFI: sleeps until the next interrupt, whether or not the CPSR masks
+ * it. Only the timer compares can be waited for, without one enabled
+ * and armed WFI does nothing. Neither does it while a DMA transfer, timed
+ * in instructions, is running. A guest on the scheduler's virtual clock
+ * asks it to be put to sleep instead, as polling CS would.
+ */
+static void cpu_wait(cpu_t* cpu) {
+  cpu_poll(cpu);
+  if (cpu->interrupts) {
+    return;
+  }
+
+  uint32_t now   = (uint32_t) timer_now(cpu->timer);
+  uint32_t delay = timer_next(cpu->timer, now,
+      (uint32_t) intc_enabled(cpu->intc) & INTC_TIMER_LINES);
+  if (delay == UINT32_MAX || dma_busy(cpu->dma)) {
+    return;
+  }
+
+  if (cpu->timer->ops != &timer_ops) {
+    memory_write_unsafe(cpu->timer, TIMER_WAKE, now + delay);
+    return;
+  }
+
+  // A replay reads the time slept from the log
+  if (cpu->replay == NULL || !cpu->replay->replaying) {
+    struct timespec wait = { delay / 1000000,
+        (long) (delay % 1000000) * 1000 };
+    nanosleep(&wait, NULL);
+  }
+  cpu_poll(cpu);
+}
+
+/**
+ * The S bit is only used to return from an exception, by loading the pc
  */
 void cpu_execute_bdt(cpu_t* cpu) {
   inst_bdt_t* inst = cpu->instruction_to_execute;
@@ -223,6 +661,11 @@ void cpu_execute_bdt(cpu_t* cpu) {
   if (inst->w) {
     reg[inst->r_n] = inst_p;
   }
+
+  if (inst->l && inst->s && get_bit(inst->reg_bits, 15)
+      && cpu_bank(cpu->flags->mode) != BANK_USR) {
+    cpu_restore_cpsr(cpu);
+  }
 }
 
 void cpu_execute_sdt(cpu_t* cpu) {
@@ -282,6 +725,11 @@ void cpu_execute_sdt(cpu_t* cpu) {
       printf("Error: Out of bounds memory access at address %#010x\n", address);
       return;
   }
+  if (cpu->stats != NULL) {
+    stats_access(cpu->stats, device, !load, 1);
+  }
+  cpu->events[load ? PMU_LOADS : PMU_STORES]++;
+  cpu->events[PMU_DEVICE] += device != cpu->ram;
 
   // transfer data
   if (load) {
@@ -325,6 +773,15 @@ void cpu_execute_proc(cpu_t* cpu) {
     operand_val = get_not_immediate(cpu, operand2, true);
   }
 
+  cpu_alu(cpu, opcode, r_dest, r_n, operand_val, set_condition);
+}
+
+/**
+ * Performs the data processing operation on r_n and the operand value.
+ * c_temp has to hold the carry produced by the operand calculation.
+ */
+void cpu_alu(cpu_t* cpu, uint8_t opcode, uint8_t r_dest, uint8_t r_n,
+    uint32_t operand_val, bool set_condition) {
   int32_t result = 0;
 
   // Store the 64-bit result of the calculations.
@@ -401,6 +858,16 @@ void cpu_execute_proc(cpu_t* cpu) {
     default:break;
   }
 
+  // SUBS pc, lr, #4 and the like return from an exception
+  if (set_condition && r_dest == 15 && cpu_bank(cpu->flags->mode) != BANK_USR
+      && (opcode <= OP_ADD || opcode == OP_ORR || opcode == OP_MOV)) {
+    cpu_restore_cpsr(cpu);
+    if (opcode != OP_MOV) {
+      cpu_flush_pipeline(cpu);
+    }
+    return;
+  }
+
   if (set_condition) {
     cpu->flags->z = (uint32_t) result == 0;
     cpu->flags->n = (int32_t) result < 0;
@@ -430,6 +897,55 @@ void cpu_execute_mult(cpu_t* cpu) {
   }
 }
 
+/**
+ * Computes the addresses [low, high) the data transfer instruction would
+ * access with the current register values.
+ * Returns false if the instruction does not transfer data.
+ */
+bool cpu_transfer_range(cpu_t* cpu, decoded_t* decoded, uint32_t* low,
+    uint32_t* high) {
+  uint32_t* reg = cpu->registers;
+
+  if (decoded->type == SDT) {
+    inst_sdt_t* inst = &decoded->fields.sdt;
+    uint32_t offset = inst->i ? get_not_immediate(cpu, inst->offset, false)
+        : inst->offset;
+    if (!inst->u) {
+      offset = -offset;
+    }
+    *low  = inst->p ? reg[inst->r_n] + offset : reg[inst->r_n];
+    *high = *low + 4;
+    return true;
+  }
+
+  if (decoded->type == BDT) {
+    inst_bdt_t* inst = &decoded->fields.bdt;
+
+    // Block transfers work on 16 bit addresses
+    uint32_t addr  = (uint16_t) reg[inst->r_n];
+    uint32_t bytes = 4 * count_set_bits(inst->reg_bits);
+
+    switch (inst->p_u) {
+      case ADDR_PRE_INC:
+        *low = addr + 4;
+        break;
+      case ADDR_POST_INC:
+        *low = addr;
+        break;
+      case ADDR_PRE_DEC:
+        *low = addr - bytes;
+        break;
+      default:
+        *low = addr - bytes + 4;
+        break;
+    }
+    *high = *low + bytes;
+    return true;
+  }
+
+  return false;
+}
+
 uint16_t cpu_store_blocks(cpu_t* cpu, uint32_t* regv, int regc, uint32_t addr,
     uint8_t address_mode) {
 
@@ -441,6 +957,11 @@ uint16_t cpu_store_blocks(cpu_t* cpu, uint32_t* regv, int regc, uint32_t addr,
     //TODO: error message
     return 0;
   }
+  if (cpu->stats != NULL) {
+    stats_access(cpu->stats, device, true, (uint32_t) regc);
+  }
+  cpu->events[PMU_STORES]++;
+  cpu->events[PMU_DEVICE] += device != cpu->ram;
 
   switch(address_mode) {
     case ADDR_PRE_INC:
@@ -488,6 +1009,11 @@ uint16_t cpu_load_blocks(cpu_t* cpu, uint32_t* regv, int regc, uint32_t addr,
     //TODO: error message
     return 0;
   }
+  if (cpu->stats != NULL) {
+    stats_access(cpu->stats, device, false, (uint32_t) regc);
+  }
+  cpu->events[PMU_LOADS]++;
+  cpu->events[PMU_DEVICE] += device != cpu->ram;
 
   switch(address_mode) {
     case ADDR_PRE_INC:
@@ -537,9 +1063,40 @@ uint16_t cpu_load_blocks(cpu_t* cpu, uint32_t* regv, int regc, uint32_t addr,
 void cpu_flush_pipeline(cpu_t* cpu) {
   cpu->has_instruction = false;
   cpu->decoded_inst.type = EMPTY;
+  cpu->events[PMU_FLUSHES]++;
+  if (cpu->stats != NULL) {
+    stats_add(&cpu->stats->flushes, 1);
+  }
+}
+
+/**
+ * Stops the guest as a HALT would, after the instruction being executed
+ */
+void cpu_halt(cpu_t* cpu) {
+  cpu->has_instruction   = true;
+  cpu->fetched_inst      = 0;
+  cpu->decoded_inst.type = HALT;
+}
+
+/**
+ * How many times each superinstruction ran, and the instructions they
+ * took in all
+ */
+void cpu_dump_fusions(cpu_t* cpu, FILE* out) {
+  uint64_t fused = 0;
+
+  for (uint8_t f = FUSE_NONE + 1; f < FUSE_KINDS; f++) {
+    fprintf(out, "%-18s: %llu\n", fuse_names[f],
+        (unsigned long long) cpu->fused[f]);
+    fused += cpu->fused[f] * fuse_length(f);
+  }
+  fprintf(out, "fused             : %llu of %llu instructions\n",
+      (unsigned long long) fused, (unsigned long long) cpu->instructions);
 }
 
 void cpu_dump_state(cpu_t* cpu) {
+  // What the guest printed comes first
+  uart_flush(cpu->uart);
   printf("Registers:\n");
   for (int i = 0; i < REG_NUM; i++) {
     if(i<13) {
@@ -557,11 +1114,29 @@ void cpu_free(cpu_t* cpu) {
     return; 
   }
 
-  free(cpu->registers);
   for (int i = 0; i < cpu->devicesc; i++) {
     memory_free(cpu->devices[i]);
   }
-  free(cpu);
+  if (cpu->stats != NULL) {
+    stats_close(cpu->stats);
+  }
+  if (cpu->semihost != NULL) {
+    semihost_free(cpu->semihost);
+  }
+  if (cpu->replay != NULL) {
+    replay_free(cpu->replay);
+  }
+
+  pthread_mutex_lock(&cpu_pool_lock);
+  bool pooled = cpu_pooled < CPU_POOL;
+  if (pooled) {
+    cpu_pool[cpu_pooled++] = cpu;
+  }
+  pthread_mutex_unlock(&cpu_pool_lock);
+
+  if (!pooled) {
+    arena_free(&cpu->arena);
+  }
 }
 
 /**
@@ -2,14 +2,28 @@
 #define HEADER_CPU
 
 #include "common.h"
+#include <string.h>
 
 #include "instruction.h"
 #include "memory.h"
 #include "devices.h"
+#include "image.h"
+#include "pmu.h"
+#include "replay.h"
+#include "semihost.h"
+#include "stats.h"
+#include "uart.h"
 
 /**
- * Number of registers.
- * TODO: consider the exception register
+ * Devices a machine can have, and machines freed that are kept for
+ * cpu_new to build again in the same arena
+ */
+#define CPU_MAX_DEVICES UINT8_MAX
+#define CPU_POOL        64
+
+/**
+ * Number of registers: r0-r15 and the CPSR. The banked ones are kept
+ * aside, see banked_t.
  */
 #define REG_NUM 17
 
@@ -49,17 +63,66 @@
 #define ADDR_PRE_DEC  2
 #define ADDR_POST_DEC 0
 
+/**
+ * Processor modes. The emulator starts in none of them (mode 0), which
+ * runs on the user registers but may change the control bits.
+ */
+#define MODE_USR 0x10
+#define MODE_FIQ 0x11
+#define MODE_IRQ 0x12
+#define MODE_SVC 0x13
+#define MODE_ABT 0x17
+#define MODE_UND 0x1B
+#define MODE_SYS 0x1F
+
+/**
+ * Exception vectors
+ */
+#define VECTOR_SWI 0x08
+#define VECTOR_IRQ 0x18
+#define VECTOR_FIQ 0x1C
+
+/**
+ * Register banks: user and system mode share one
+ */
+#define BANK_USR 0
+#define BANK_FIQ 1
+#define BANK_IRQ 2
+#define BANK_SVC 3
+#define BANK_ABT 4
+#define BANK_UND 5
+#define BANKS    6
+
+/**
+ * Instructions between two polls of the interrupt sources
+ */
+#define CPU_POLL_INTERVAL 256
+
 /**
  * CPU flags (CPSR)
  */
 typedef struct {
-  uint32_t   : 28;
+  uint32_t mode : 5;
+  uint32_t t    : 1;
+  uint32_t f    : 1;   // FIQs masked
+  uint32_t i    : 1;   // IRQs masked
+  uint32_t      : 20;
   uint32_t v : 1;
   uint32_t c : 1;
   uint32_t z : 1;
   uint32_t n : 1;
 } flags_t;
 
+/**
+ * Registers of the modes not running: r13, r14 and the SPSR of every
+ * bank, and r8-r12 outside and inside FIQ mode. The running mode's
+ * r13 and r14 are in the registers, its SPSR stays here.
+ */
+typedef struct {
+  uint32_t modes[BANKS][3];
+  uint32_t fiq[2][5];
+} banked_t;
+
 typedef struct {
   bool        has_instruction;
   decoded_t   decoded_inst;
@@ -69,34 +132,68 @@ typedef struct {
   memory_t*  ram;
   memory_t*  timer;
   memory_t*  mailbox;
+  memory_t*  intc;
+  memory_t*  dma;
+  memory_t*  uart;
+  memory_t*  pmu;
 
   uint8_t    devicesc; 
 
   uint32_t  c_temp;
   uint32_t  fetched_inst;
+  uint32_t  fetched_pc;   // Address of fetched_inst
+  uint32_t  decoded_pc;   // Address of decoded_inst
+  uint64_t  instructions; // Instructions executed so far
   uint32_t* registers;
+  stats_t*  stats;        // Published counters, NULL if not monitored
+  semihost_t* semihost;   // Host file access, NULL if not given
+  image_t*  image;        // Binary loaded, not owned, NULL if none
+  replay_t* replay;       // Input log, NULL if not recording
+
+  banked_t  banked;
+  uint8_t   interrupts;   // INTC_IRQ and INTC_FIQ as last polled
+  uint16_t  poll;         // Instructions until the next poll
+  uint64_t  events[PMU_SOURCES]; // Totals the PMU counts from
+  uint64_t  fused[FUSE_KINDS];   // Superinstructions run by cpu_loop
+
+  arena_t      arena;     // Holds the cpu_t and everything above
+  arena_mark_t built;     // Where the arena is rewound to for reuse
 } cpu_t;
 
-void     cpu_init(cpu_t*);
+cpu_t*   cpu_new(void);
 void     cpu_add_device(cpu_t*, memory_t*);
 void     cpu_loop(cpu_t* cpu);
+void     cpu_dump_fusions(cpu_t*, FILE*);
+bool     cpu_step(cpu_t* cpu);
+bool     cpu_run(cpu_t* cpu, uint64_t);
 void     cpu_fetch_instruction(cpu_t* cpu);
 bool     cpu_eval(cpu_t*, uint8_t);
 
 void     cpu_execute_proc(cpu_t*);
+void     cpu_alu(cpu_t*, uint8_t, uint8_t, uint8_t, uint32_t, bool);
 void     cpu_execute_mult(cpu_t*);
 void     cpu_execute_sdt(cpu_t*);
 void     cpu_execute_bdt(cpu_t*);
 void     cpu_execute_branch(cpu_t*);
 void     cpu_execute_bx(cpu_t*);
+void     cpu_execute_psr(cpu_t*);
+void     cpu_execute_swi(cpu_t*);
 bool     cpu_execute(cpu_t*);
+uint32_t cpu_branch_offset(inst_branch_t*);
 
 bool     cpu_get_flag(cpu_t*, uint8_t);
 void     cpu_set_flag(cpu_t*, uint8_t, bool);
 void     cpu_flush_pipeline(cpu_t*);
+void     cpu_halt(cpu_t*);
+void     cpu_poll(cpu_t*);
+bool     cpu_interrupt(cpu_t*);
+void     cpu_set_mode(cpu_t*, uint8_t);
+void     cpu_write_cpsr(cpu_t*, uint32_t);
+void     cpu_exception(cpu_t*, uint8_t, uint32_t, uint32_t);
 void     cpu_dump_state(cpu_t*);
 void     cpu_free(cpu_t*);
 
+bool     cpu_transfer_range(cpu_t*, decoded_t*, uint32_t*, uint32_t*);
 uint16_t cpu_store_blocks(cpu_t*, uint32_t*, int, uint32_t, uint8_t);
 uint16_t cpu_load_blocks(cpu_t*, uint32_t*, int, uint32_t, uint8_t);
 
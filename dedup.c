@@ -0,0 +1,415 @@
+#include "dedup.h"
+
+static void     dedup_start(void);
+static void     dedup_page(dedup_ram_t*, uint32_t);
+static void     dedup_drop(dedup_ram_t*, uint32_t);
+static bool     dedup_zero(const uint8_t*);
+static uint64_t dedup_hash(const uint8_t*);
+static uint32_t dedup_find(uint64_t, const uint8_t*);
+static uint32_t dedup_take(uint64_t, const uint8_t*);
+static void     dedup_insert(uint32_t);
+static void     dedup_remove(uint32_t);
+static void     dedup_release(uint32_t);
+static void*    dedup_grow(void*, size_t);
+
+/**
+ * Machines are made and freed on any thread, so the state is only touched
+ * under dedup_lock
+ */
+static dedup_t         dedup         = { .fd = -1 };
+static bool            dedup_started = false;
+static bool            dedup_off     = false;  // Host pages are not RAM pages
+static pthread_mutex_t dedup_lock    = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Puts a machine's RAM in the list of those scanned, its record in the
+ * machine's arena
+ */
+void dedup_track(arena_t* arena, memory_t* memory) {
+  dedup_ram_t* ram = arena_alloc(arena, sizeof(dedup_ram_t), 0);
+
+  ram->memory = memory;
+  ram->frames = arena_alloc(arena,
+      memory_pages(memory) * sizeof(uint32_t), 0);
+  ram->prev   = NULL;
+
+  pthread_mutex_lock(&dedup_lock);
+  ram->next   = dedup.rams;
+  if (dedup.rams != NULL) {
+    dedup.rams->prev = ram;
+  }
+  dedup.rams     = ram;
+  memory->dedup  = ram;
+  pthread_mutex_unlock(&dedup_lock);
+}
+
+/**
+ * Takes RAM about to be freed out of the list, releasing the frames its
+ * pages map for reuse. memory_free then maps the slot anonymous again.
+ */
+void dedup_forget(memory_t* memory) {
+  dedup_ram_t* ram = memory->dedup;
+
+  if (ram == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&dedup_lock);
+  for (uint32_t page = 0; page < memory_pages(memory); page++) {
+    dedup_drop(ram, page);
+  }
+
+  if (dedup.cursor == ram) {
+    dedup.cursor = ram->next;
+    dedup.page   = 0;
+  }
+  if (ram->prev != NULL) {
+    ram->prev->next = ram->next;
+  } else {
+    dedup.rams = ram->next;
+  }
+  if (ram->next != NULL) {
+    ram->next->prev = ram->prev;
+  }
+  memory->dedup = NULL;
+  pthread_mutex_unlock(&dedup_lock);
+}
+
+/**
+ * A shared page is being written, or has just been: it is given its own
+ * copy of the frame now, rather than by the kernel on the write, so that
+ * the frame can be reused as soon as no page maps it
+ */
+void dedup_unshare(memory_t* memory, uint32_t page) {
+  dedup_ram_t* ram = memory->dedup;
+
+  pthread_mutex_lock(&dedup_lock);
+  if (ram->frames[page] >= DEDUP_FRAME) {
+    volatile uint8_t* byte = memory->mem + (size_t) page * MEMORY_PAGE_SIZE;
+    *byte = *byte;
+  }
+  dedup_drop(ram, page);
+  dedup.stats.unshared++;
+  pthread_mutex_unlock(&dedup_lock);
+}
+
+/**
+ * Scans the given number of pages, carrying on from where the last scan
+ * stopped and going round every machine's RAM in turn. A scan stops at
+ * the end of the round, so that a page is never visited twice in one.
+ */
+void dedup_scan(uint32_t pages) {
+  pthread_mutex_lock(&dedup_lock);
+  if (!dedup_started) {
+    dedup_start();
+  }
+
+  for (uint32_t i = 0; i < pages && !dedup_off && dedup.rams != NULL; i++) {
+    if (dedup.cursor == NULL) {
+      dedup.cursor = dedup.rams;
+      dedup.page   = 0;
+    }
+    dedup_page(dedup.cursor, dedup.page);
+    if (++dedup.page == memory_pages(dedup.cursor->memory)) {
+      dedup.cursor = dedup.cursor->next;
+      dedup.page   = 0;
+      if (dedup.cursor == NULL) {
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&dedup_lock);
+}
+
+/**
+ * Makes the frame file, unlinked at once so that it goes with the
+ * process. Without it only zero pages are merged.
+ */
+static void dedup_start(void) {
+  char path[256];
+
+  dedup_started = true;
+  dedup_off     = sysconf(_SC_PAGESIZE) != MEMORY_PAGE_SIZE;
+  dedup.slots   = DEDUP_GROWTH;
+  dedup.table   = calloc(dedup.slots, sizeof(uint32_t));
+  if (dedup.table == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  snprintf(path, sizeof(path), "%s/armemu.frames.%ld", DEDUP_DIR,
+      (long) getpid());
+  dedup.fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (dedup.fd < 0) {
+    return;
+  }
+  unlink(path);
+
+  dedup.view = mmap(NULL, (size_t) DEDUP_FRAMES * MEMORY_PAGE_SIZE,
+      PROT_READ | PROT_WRITE, MAP_SHARED, dedup.fd, 0);
+  if (dedup.view == MAP_FAILED) {
+    close(dedup.fd);
+    dedup.fd = -1;
+  }
+}
+
+/**
+ * Merges the page if it has not been written since the last scan. Scans
+ * only read it, so that a page being written is neither hashed nor
+ * merged every time around.
+ */
+static void dedup_page(dedup_ram_t* ram, uint32_t page) {
+  uint8_t* dirty = &ram->memory->dirty[page];
+  uint8_t* bytes = ram->memory->mem + (size_t) page * MEMORY_PAGE_SIZE;
+
+  dedup.stats.scanned++;
+  if (*dirty & MEMORY_PAGE_SHARED) {
+    return;
+  }
+  if (!(*dirty & MEMORY_PAGE_STABLE)) {
+    *dirty |= MEMORY_PAGE_STABLE;
+    return;
+  }
+
+  if (dedup_zero(bytes)) {
+    // Not MADV_DONTNEED: a page that once mapped a frame would read the
+    // frame's contents again, not zeros
+    if (mmap(bytes, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      dedup.stats.failures++;
+      return;
+    }
+    ram->frames[page] = DEDUP_ZERO;
+    *dirty |= MEMORY_PAGE_SHARED;
+    dedup.stats.zero++;
+    return;
+  }
+  if (dedup.fd < 0) {
+    return;
+  }
+
+  uint64_t hash  = dedup_hash(bytes);
+  uint32_t frame = dedup_find(hash, bytes);
+  if (frame == UINT32_MAX) {
+    frame = dedup_take(hash, bytes);
+    if (frame == UINT32_MAX) {
+      return;
+    }
+  }
+
+  dedup.refs[frame]++;
+  if (mmap(bytes, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, dedup.fd,
+      (off_t) frame * MEMORY_PAGE_SIZE) == MAP_FAILED) {
+    // Most likely out of mappings; the page keeps its memory
+    dedup_release(frame);
+    dedup.stats.failures++;
+    return;
+  }
+  ram->frames[page]   = frame + DEDUP_FRAME;
+  ram->memory->mapped = true;
+  *dirty |= MEMORY_PAGE_SHARED;
+  dedup.stats.merged++;
+}
+
+/**
+ * Forgets what the page maps, which is its own memory from now on
+ */
+static void dedup_drop(dedup_ram_t* ram, uint32_t page) {
+  uint32_t frame = ram->frames[page];
+
+  if (frame == DEDUP_ZERO) {
+    dedup.stats.zero--;
+  } else if (frame >= DEDUP_FRAME) {
+    dedup.stats.merged--;
+    dedup_release(frame - DEDUP_FRAME);
+  }
+  ram->frames[page] = DEDUP_OWN;
+  ram->memory->dirty[page] &= (uint8_t) ~MEMORY_PAGE_SHARED;
+}
+
+static bool dedup_zero(const uint8_t* bytes) {
+  for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    if (word != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * FNV-1a, a word at a time
+ */
+static uint64_t dedup_hash(const uint8_t* bytes) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * The frame holding the same contents as the page, UINT32_MAX if none
+ */
+static uint32_t dedup_find(uint64_t hash, const uint8_t* bytes) {
+  uint32_t mask = dedup.slots - 1;
+
+  for (uint32_t i = (uint32_t) hash & mask; dedup.table[i] != 0;
+      i = (i + 1) & mask) {
+    uint32_t frame = dedup.table[i] - 1;
+    if (dedup.hashes[frame] == hash && memcmp(dedup.view
+        + (size_t) frame * MEMORY_PAGE_SIZE, bytes, MEMORY_PAGE_SIZE) == 0) {
+      return frame;
+    }
+  }
+  return UINT32_MAX;
+}
+
+/**
+ * Copies the page into a frame no page maps, growing the file if there
+ * is none. Returns UINT32_MAX once the view is full.
+ */
+static uint32_t dedup_take(uint64_t hash, const uint8_t* bytes) {
+  uint32_t frame;
+
+  if (dedup.freec > 0) {
+    frame = dedup.free[--dedup.freec];
+  } else {
+    if (dedup.used == dedup.capacity) {
+      if (dedup.capacity == DEDUP_FRAMES || ftruncate(dedup.fd,
+          (off_t) (dedup.capacity + DEDUP_GROWTH) * MEMORY_PAGE_SIZE) != 0) {
+        dedup.stats.failures++;
+        return UINT32_MAX;
+      }
+      dedup.capacity += DEDUP_GROWTH;
+      dedup.refs   = dedup_grow(dedup.refs, sizeof(uint32_t));
+      dedup.hashes = dedup_grow(dedup.hashes, sizeof(uint64_t));
+      dedup.free   = dedup_grow(dedup.free, sizeof(uint32_t));
+    }
+    frame = dedup.used++;
+  }
+
+  memcpy(dedup.view + (size_t) frame * MEMORY_PAGE_SIZE, bytes,
+      MEMORY_PAGE_SIZE);
+  dedup.hashes[frame] = hash;
+  dedup.refs[frame]   = 0;
+  dedup.stats.frames++;
+  dedup_insert(frame);
+  return frame;
+}
+
+/**
+ * Adds the frame to the table, doubling it first if it would be more
+ * than half full
+ */
+static void dedup_insert(uint32_t frame) {
+  if (dedup.stats.frames * 2 > dedup.slots) {
+    uint32_t* old   = dedup.table;
+    uint32_t  slots = dedup.slots;
+
+    dedup.slots *= 2;
+    dedup.table  = calloc(dedup.slots, sizeof(uint32_t));
+    if (dedup.table == NULL) {
+      fprintf(stderr,"calloc failure");
+      exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+      if (old[i] != 0) {
+        dedup_insert(old[i] - 1);
+      }
+    }
+    free(old);
+  }
+
+  uint32_t mask = dedup.slots - 1;
+  uint32_t i    = (uint32_t) dedup.hashes[frame] & mask;
+  while (dedup.table[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  dedup.table[i] = frame + 1;
+}
+
+/**
+ * Takes the frame out of the table, moving back the ones after it that
+ * would no longer be found past the hole
+ */
+static void dedup_remove(uint32_t frame) {
+  uint32_t mask = dedup.slots - 1;
+  uint32_t i    = (uint32_t) dedup.hashes[frame] & mask;
+
+  while (dedup.table[i] != frame + 1) {
+    i = (i + 1) & mask;
+  }
+
+  for (uint32_t j = i;;) {
+    dedup.table[i] = 0;
+    for (;;) {
+      j = (j + 1) & mask;
+      if (dedup.table[j] == 0) {
+        return;
+      }
+      uint32_t home = (uint32_t) dedup.hashes[dedup.table[j] - 1] & mask;
+      if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+        break;
+      }
+    }
+    dedup.table[i] = dedup.table[j];
+    i = j;
+  }
+}
+
+/**
+ * A page no longer maps the frame. Once none does it is emptied, giving
+ * its memory back, to be reused.
+ */
+static void dedup_release(uint32_t frame) {
+  if (--dedup.refs[frame] > 0) {
+    return;
+  }
+
+  dedup_remove(frame);
+#ifdef MADV_REMOVE
+  madvise(dedup.view + (size_t) frame * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE,
+      MADV_REMOVE);
+#endif
+  dedup.free[dedup.freec++] = frame;
+  dedup.stats.frames--;
+}
+
+/**
+ * Reallocates an array of the frames to the new capacity
+ */
+static void* dedup_grow(void* array, size_t size) {
+  array = realloc(array, dedup.capacity * size);
+  if (array == NULL) {
+    fprintf(stderr,"realloc failure");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+void dedup_dump_stats(FILE* out) {
+  pthread_mutex_lock(&dedup_lock);
+  dedup_stats_t  stats = dedup.stats;
+  dedup_stats_t* s     = &stats;
+  pthread_mutex_unlock(&dedup_lock);
+
+  fprintf(out, "pages scanned     : %llu\n",
+      (unsigned long long) s->scanned);
+  fprintf(out, "zero pages        : %llu\n", (unsigned long long) s->zero);
+  fprintf(out, "merged pages      : %llu\n",
+      (unsigned long long) s->merged);
+  fprintf(out, "frames            : %llu\n",
+      (unsigned long long) s->frames);
+  fprintf(out, "pages unshared    : %llu\n",
+      (unsigned long long) s->unshared);
+  fprintf(out, "merges failed     : %llu\n",
+      (unsigned long long) s->failures);
+  fprintf(out, "memory saved      : %llu KiB\n",
+      (unsigned long long) ((s->zero + s->merged - s->frames)
+      * MEMORY_PAGE_SIZE / 1024));
+}
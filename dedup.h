@@ -0,0 +1,96 @@
+#ifndef HEADER_DEDUP
+#define HEADER_DEDUP
+
+#include "common.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "memory.h"
+
+/**
+ * Directory the frame file is made in, a tmpfs
+ */
+#define DEDUP_DIR "/dev/shm"
+
+/**
+ * Most frames the deduplicator can hold (1 GiB), the size of the view it
+ * maps of them
+ */
+#define DEDUP_FRAMES (1 << 18)
+
+/**
+ * Frames the frame file grows by
+ */
+#define DEDUP_GROWTH 256
+
+/**
+ * What a page of RAM maps, in dedup_ram_t.frames: its own memory, the
+ * kernel's zero page, or frame n of the frame file as n + DEDUP_FRAME
+ */
+#define DEDUP_OWN   0
+#define DEDUP_ZERO  1
+#define DEDUP_FRAME 2
+
+/**
+ * The pages of one machine's RAM, in the list of those scanned
+ */
+typedef struct dedup_ram_struct {
+  memory_t* memory;
+  uint32_t* frames;
+  struct dedup_ram_struct* next;
+  struct dedup_ram_struct* prev;
+} dedup_ram_t;
+
+typedef struct {
+  uint64_t scanned;
+  uint64_t zero;       // Pages given back to the kernel, reading as zero
+  uint64_t merged;     // Pages mapping a frame
+  uint64_t frames;     // Frames they map
+  uint64_t unshared;   // Pages written since, which have their own again
+  uint64_t failures;   // Merges the kernel refused
+} dedup_stats_t;
+
+/**
+ * Merges the pages of the machines' RAM that are zero or identical, in
+ * every machine of the process. Scanning a page the first time marks it
+ * stable; if it is still unwritten on the next visit it is merged: a
+ * zero page is given back to the kernel, any other is hashed and mapped
+ * private to a frame of a shared memory file holding the same contents,
+ * taking a new frame if none does. Reads then hit the shared frame, and
+ * the first write makes the kernel copy it for the writer alone. All
+ * writes to RAM go through memory_write_unsafe or memory_mark_dirty,
+ * which tell the deduplicator that the page has its own memory again, so
+ * that a frame is only reused once nothing maps it.
+ * Frames are indexed by the hash of their contents, in an open addressing
+ * table with linear probing.
+ */
+typedef struct {
+  int           fd;          // Frame file, -1 if it could not be made
+  uint8_t*      view;        // Of all the frames, shared
+  uint32_t      capacity;    // Frames the file holds
+  uint32_t      used;        // Frames ever taken from it
+  uint32_t*     refs;        // Pages mapping each frame
+  uint64_t*     hashes;
+  uint32_t*     free;        // Frames no page maps, to be reused
+  uint32_t      freec;
+
+  uint32_t*     table;       // Frame + 1, 0 if the slot is empty
+  uint32_t      slots;       // A power of two, at most half full
+
+  dedup_ram_t*  rams;
+  dedup_ram_t*  cursor;      // Where the next scan starts
+  uint32_t      page;
+
+  dedup_stats_t stats;
+} dedup_t;
+
+void dedup_track(arena_t*, memory_t*);
+void dedup_forget(memory_t*);
+void dedup_unshare(memory_t*, uint32_t);
+void dedup_scan(uint32_t);
+void dedup_dump_stats(FILE*);
+
+#endif
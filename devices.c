@@ -1,16 +1,72 @@
 #include "devices.h"
+#include "pmu.h"
+#include "uart.h"
+
+static uint32_t gpio_read(memory_t*, uint32_t);
+static void     gpio_write(memory_t*, uint32_t, uint32_t);
+static void     gpio_access(uint32_t);
+static uint32_t timer_read(memory_t*, uint32_t);
+static void     timer_write(memory_t*, uint32_t, uint32_t);
+static uint64_t timer_host_clock();
+static uint32_t intc_read(memory_t*, uint32_t);
+static void     intc_write(memory_t*, uint32_t, uint32_t);
+static uint32_t dma_read_register(memory_t*, uint32_t);
+static void     dma_write_register(memory_t*, uint32_t, uint32_t);
+static uint32_t mailbox_read(memory_t*, uint32_t);
+static void     mailbox_write(memory_t*, uint32_t, uint32_t);
+static void     mailbox_access(uint32_t);
+
+static device_input_t device_input_filter  = NULL;
+static void*          device_input_context = NULL;
+static void     dma_sync(memory_t*);
+static bool     dma_load(memory_t*, uint32_t, memory_t**, uint8_t, uint64_t);
+static void     dma_transfer(memory_t*, uint32_t, memory_t**, uint8_t);
+static void     dma_row(memory_t**, uint8_t, uint32_t, uint32_t, uint32_t,
+    uint32_t);
+static uint8_t* dma_plain(memory_t**, uint8_t, uint32_t, uint32_t,
+    memory_t**);
+static uint32_t dma_read(memory_t**, uint8_t, uint32_t);
+static void     dma_write(memory_t**, uint8_t, uint32_t, uint32_t);
+static uint32_t dma_bus(uint32_t);
+
+const device_ops_t gpio_ops    = { &gpio_read,    &gpio_write };
+const device_ops_t timer_ops   = { &timer_read,   &timer_write };
+const device_ops_t intc_ops    = { &intc_read,    &intc_write };
+const device_ops_t dma_ops     = { &dma_read_register, &dma_write_register };
+const device_ops_t mailbox_ops = { &mailbox_read, &mailbox_write };
+
+memory_t* (* const device_table[DEVICE_DEFAULTS])(arena_t*) = {
+  [DEVICE_RAM]     = &ram_init,
+  [DEVICE_TIMER]   = &timer_init,
+  [DEVICE_MAILBOX] = &mailbox_init,
+  [DEVICE_GPIO]    = &gpio_init,
+  [DEVICE_INTC]    = &intc_init,
+  [DEVICE_DMA]     = &dma_init,
+  [DEVICE_UART]    = &uart_init,
+  [DEVICE_PMU]     = &pmu_init
+};
 
 /**
- * Timer initialiser
+ * Passes what the devices read off the host through input, or nothing if
+ * NULL
  */
-memory_t* ram_init() {
-  memory_t* memory  = malloc(sizeof(memory_t));
-  if(memory == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
+void device_set_input(device_input_t input, void* context) {
+  device_input_filter  = input;
+  device_input_context = context;
+}
+
+uint64_t device_input(uint64_t value) {
+  if (device_input_filter != NULL) {
+    return device_input_filter(device_input_context, value);
   }
-  memory_init(memory, 0, RAM_SIZE);
-  memory->callback = NULL;
+  return value;
+}
+
+/**
+ * RAM initialiser, taking its memory from the huge page pool
+ */
+memory_t* ram_init(arena_t* arena) {
+  memory_t* memory = memory_new(arena, 0, RAM_SIZE, true);
 
   return memory;
 }
@@ -18,24 +74,29 @@ memory_t* ram_init() {
 /**
  * GPIO initialiser
  */
-memory_t* gpio_init() {
-  memory_t* device = malloc(sizeof(memory_t));
-  if(device == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
-  }
-  memory_init(device, 0x20200000, 64);
-  device->callback = &gpio_access_callback;
+memory_t* gpio_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, 0x20200000, 64, false);
+  device->ops = &gpio_ops;
   memory_write_unsafe(device, 0,   0x20200000);
   memory_write_unsafe(device, 0x4, 0x20200004);
   memory_write_unsafe(device, 0x8, 0x20200008);
   return device;
 }
 
+static uint32_t gpio_read(memory_t* gpio, uint32_t rel_addr) {
+  gpio_access(rel_addr);
+  return memory_read_unsafe(gpio, rel_addr);
+}
+
+static void gpio_write(memory_t* gpio, uint32_t rel_addr, uint32_t value) {
+  gpio_access(rel_addr);
+  memory_write_unsafe(gpio, rel_addr, value);
+}
+
 /**
  * GPIO memory access handler
  */
-void gpio_access_callback(memory_t* device, uint32_t rel_addr, bool write) {
+static void gpio_access(uint32_t rel_addr) {
 
   switch(rel_addr) {
     case 0x0 :
@@ -64,53 +125,535 @@ void gpio_access_callback(memory_t* device, uint32_t rel_addr, bool write) {
 /**
  * Timer initialiser
  */
-memory_t* timer_init() {
-  memory_t* device = malloc(sizeof(memory_t));
-  if(device == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
-  }
-  memory_init(device, 0x20003000, 22);
-  device->callback = &timer_access_callback;
+memory_t* timer_init(arena_t* arena) {
+  // CS, CLO, CHI and the compare registers C0-C3
+  memory_t* device = memory_new(arena, 0x20003000, TIMER_SIZE, false);
+  device->ops = &timer_ops;
 
+  qword_t base;
+  base.value = timer_host_clock();
+  memory_write_unsafe(device, TIMER_BASE,     base.dwords.lower.value);
+  memory_write_unsafe(device, TIMER_BASE + 4, base.dwords.higher.value);
   return device;
 }
 
-void timer_access_callback(memory_t* timer, uint32_t rel_addr, bool write) {
+static uint32_t timer_read(memory_t* timer, uint32_t rel_addr) {
   switch(rel_addr) {
-    //TODO: other cases
-    case 0x4: ;
-        if (!write) {
-          qword_t qword;
-          qword.dwords.lower.value  = memory_read_unsafe(timer, 0x4);
-          qword.dwords.higher.value = memory_read_unsafe(timer, 0x8);
-          qword.value = clock() - timer->custom_buffer;
-
-          memory_write_unsafe(timer, 0x4, qword.dwords.lower.value);
-          memory_write_unsafe(timer, 0x8, qword.dwords.higher.value);
-          printf ("Time requested\n");
-        }
+    case TIMER_CS:
+      timer_update(timer, (uint32_t) timer_now(timer));
+      break;
+    case TIMER_CLO:
+      timer_now(timer);
+      printf ("Time requested\n");
       break;
     default:break;
   }
+  return memory_read_unsafe(timer, rel_addr);
+}
+
+static void timer_write(memory_t* timer, uint32_t rel_addr, uint32_t value) {
+  timer_track(timer, rel_addr, value);
+  if (rel_addr != TIMER_CS) {
+    memory_write_unsafe(timer, rel_addr, value);
+  }
 }
 
 /**
- * Mailbox initialiser
+ * Host monotonic clock in microseconds, which unlike clock() goes on
+ * while the emulator sleeps
+ */
+static uint64_t timer_host_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+/**
+ * Follows a guest write to CS, which acknowledges the matches of the
+ * bits set, or to a compare register, which arms it. CS then shows the
+ * matches left.
+ */
+void timer_track(memory_t* timer, uint32_t rel_addr, uint32_t value) {
+  uint32_t state = memory_read_unsafe(timer, TIMER_STATE);
+
+  if (rel_addr == TIMER_CS) {
+    state &= ~(value & 0xF);
+  } else if (rel_addr >= TIMER_C0 && rel_addr <= TIMER_C3) {
+    state |= 1u << (TIMER_ARMED + (rel_addr - TIMER_C0) / 4);
+  }
+  memory_write_unsafe(timer, TIMER_STATE, state);
+  memory_write_unsafe(timer, TIMER_CS, state & 0xF);
+}
+
+/**
+ * Microseconds since the timer started, also stored in CLO and CHI. The
+ * host clock is only read if the default handlers are in place, any
+ * other (the scheduler's) keeps CLO and CHI up to date itself.
+ */
+uint64_t timer_now(memory_t* timer) {
+  qword_t qword;
+
+  if (timer->ops != &timer_ops) {
+    qword.dwords.lower.value  = memory_read_unsafe(timer, TIMER_CLO);
+    qword.dwords.higher.value = memory_read_unsafe(timer, TIMER_CHI);
+    return qword.value;
+  }
+
+  qword.dwords.lower.value  = memory_read_unsafe(timer, TIMER_BASE);
+  qword.dwords.higher.value = memory_read_unsafe(timer, TIMER_BASE + 4);
+  qword.value = timer_host_clock() - qword.value;
+  qword.value = device_input(qword.value);
+  memory_write_unsafe(timer, TIMER_CLO, qword.dwords.lower.value);
+  memory_write_unsafe(timer, TIMER_CHI, qword.dwords.higher.value);
+  return qword.value;
+}
+
+/**
+ * Matches the armed compare registers CLO has reached by now, each one
+ * matching once per write. Returns the matched ones, which stay so until
+ * acknowledged.
+ */
+uint32_t timer_update(memory_t* timer, uint32_t now) {
+  uint32_t state = memory_read_unsafe(timer, TIMER_STATE);
+
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t armed   = 1u << (TIMER_ARMED + i);
+    uint32_t compare = memory_read_unsafe(timer, TIMER_C0 + 4 * i);
+    if ((state & armed) && (int32_t) (now - compare) >= 0) {
+      state = (state & ~armed) | 1u << i;
+    }
+  }
+
+  memory_write_unsafe(timer, TIMER_STATE, state);
+  memory_write_unsafe(timer, TIMER_CS, state & 0xF);
+  return state & 0xF;
+}
+
+/**
+ * Microseconds from now until the first of the armed compare registers
+ * in lines matches, or UINT32_MAX if none is armed
+ */
+uint32_t timer_next(memory_t* timer, uint32_t now, uint32_t lines) {
+  uint32_t state = memory_read_unsafe(timer, TIMER_STATE);
+  uint32_t next  = UINT32_MAX;
+
+  for (uint32_t i = 0; i < 4; i++) {
+    if (!(lines & (1u << i)) || !(state & (1u << (TIMER_ARMED + i)))) {
+      continue;
+    }
+    int32_t delay = (int32_t) (memory_read_unsafe(timer, TIMER_C0 + 4 * i)
+        - now);
+    delay = delay > 0 ? delay : 0;
+    next  = (uint32_t) delay < next ? (uint32_t) delay : next;
+  }
+  return next;
+}
+
+/**
+ * Interrupt controller initialiser
+ */
+memory_t* intc_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, 0x2000B200, INTC_SIZE, false);
+  device->ops = &intc_ops;
+  return device;
+}
+
+static uint32_t intc_read(memory_t* intc, uint32_t rel_addr) {
+  return memory_read_unsafe(intc, rel_addr);
+}
+
+/**
+ * Writes to the enable registers set lines, to the disable ones clear
+ * them. The basic ones and the disable registers read back zero.
+ */
+static void intc_write(memory_t* intc, uint32_t rel_addr, uint32_t value) {
+  switch (rel_addr) {
+    case INTC_ENABLE1:
+    case INTC_ENABLE2:
+      value |= memory_read_unsafe(intc, rel_addr);
+      break;
+    case INTC_DISABLE1:
+    case INTC_DISABLE2:
+      rel_addr -= INTC_DISABLE1 - INTC_ENABLE1;
+      value = memory_read_unsafe(intc, rel_addr) & ~value;
+      break;
+    case INTC_ENABLE_BASIC:
+    case INTC_DISABLE_BASIC:
+      return;
+    default:break;
+  }
+  memory_write_unsafe(intc, rel_addr, value);
+}
+
+/**
+ * Lines that can interrupt the core, the FIQ source included
  */
-memory_t* mailbox_init() {
-  memory_t* device = malloc(sizeof(memory_t));
-  if(device == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
+uint64_t intc_enabled(memory_t* intc) {
+  uint64_t enabled = memory_read_unsafe(intc, INTC_ENABLE1)
+      | (uint64_t) memory_read_unsafe(intc, INTC_ENABLE2) << 32;
+  uint32_t fiq     = memory_read_unsafe(intc, INTC_FIQ_CONTROL);
+  if ((fiq & INTC_FIQ_ENABLE) && (fiq & 0x7F) < 64) {
+    enabled |= 1ull << (fiq & 0x7F);
   }
-  memory_init(device, 0x2000B880, 36);
-  device->callback = &mailbox_access_callback;
+  return enabled;
+}
+
+/**
+ * Sets the pending registers from the lines raised by the devices.
+ * Returns the requests to the core: a FIQ if the FIQ source is raised,
+ * an IRQ if any other enabled line is.
+ */
+uint8_t intc_update(memory_t* intc, uint64_t lines) {
+  uint32_t fiq     = memory_read_unsafe(intc, INTC_FIQ_CONTROL);
+  uint64_t pending = lines & (memory_read_unsafe(intc, INTC_ENABLE1)
+      | (uint64_t) memory_read_unsafe(intc, INTC_ENABLE2) << 32);
+  uint8_t  raised  = 0;
 
+  if ((fiq & INTC_FIQ_ENABLE) && (fiq & 0x7F) < 64) {
+    raised  |= (lines >> (fiq & 0x7F)) & 1 ? INTC_FIQ : 0;
+    pending &= ~(1ull << (fiq & 0x7F));
+  }
+  raised |= pending ? INTC_IRQ : 0;
+
+  memory_write_unsafe(intc, INTC_PENDING1, (uint32_t) pending);
+  memory_write_unsafe(intc, INTC_PENDING2, (uint32_t) (pending >> 32));
+  memory_write_unsafe(intc, INTC_BASIC_PENDING,
+      (uint32_t) ((uint32_t) pending != 0) << 8
+      | (uint32_t) ((pending >> 32) != 0) << 9);
+  return raised;
+}
+
+/**
+ * DMA controller initialiser, all channels enabled
+ */
+memory_t* dma_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, 0x20007000, DMA_SIZE, false);
+  device->ops = &dma_ops;
+  memory_write_unsafe(device, DMA_ENABLE, (1u << DMA_CHANNELS) - 1);
   return device;
 }
 
-void mailbox_access_callback(memory_t* device, uint32_t rel_addr, bool write) {
+static uint32_t dma_read_register(memory_t* dma, uint32_t rel_addr) {
+  dma_sync(dma);
+  return memory_read_unsafe(dma, rel_addr);
+}
+
+/**
+ * A write to CS only takes effect on the next dma_sync, so that one made
+ * by a control block does not change the channels under dma_update
+ */
+static void dma_write_register(memory_t* dma, uint32_t rel_addr,
+    uint32_t value) {
+  dma_sync(dma);
+  memory_write_unsafe(dma, rel_addr, value);
+
+  if (rel_addr < DMA_CHANNELS * DMA_CHANNEL
+      && rel_addr % DMA_CHANNEL == DMA_CS) {
+    memory_write_unsafe(dma, DMA_WRITTEN, memory_read_unsafe(dma, DMA_WRITTEN)
+        | 1u << (rel_addr / DMA_CHANNEL));
+  }
+}
+
+/**
+ * Applies the writes to CS since the last call: RESET aborts the
+ * channel, END and INT are cleared by writing 1 and ACTIVE starts or
+ * pauses it. CS and INT_STATUS then read back the state.
+ */
+static void dma_sync(memory_t* dma) {
+  uint32_t written = memory_read_unsafe(dma, DMA_WRITTEN);
+  uint32_t status  = 0;
+  uint32_t running = 0;
+
+  memory_write_unsafe(dma, DMA_WRITTEN, 0);
+  for (uint32_t n = 0; n < DMA_CHANNELS; n++) {
+    uint32_t base  = n * DMA_CHANNEL;
+    uint32_t state = memory_read_unsafe(dma, base + DMA_STATE);
+
+    if (written & (1u << n)) {
+      uint32_t cs = memory_read_unsafe(dma, base + DMA_CS);
+      if (cs & DMA_RESET) {
+        state = 0;
+      } else {
+        state &= ~(cs & (DMA_END | DMA_INT));
+        state  = (state & ~DMA_ACTIVE) | (cs & DMA_ACTIVE);
+      }
+      memory_write_unsafe(dma, base + DMA_STATE, state);
+    }
+
+    memory_write_unsafe(dma, base + DMA_CS,
+        state & (DMA_ACTIVE | DMA_END | DMA_INT));
+    status  |= state & DMA_INT ? 1u << n : 0;
+    running |= state & (DMA_ACTIVE | DMA_INT) ? 1u << n : 0;
+  }
+  memory_write_unsafe(dma, DMA_INT_STATUS, status);
+  memory_write_unsafe(dma, DMA_RUNNING, running);
+}
+
+/**
+ * Runs the control blocks of the active channels due by now, an
+ * instruction count. Returns the interrupt lines of the channels with
+ * INT set, which stay raised until it is cleared.
+ */
+uint64_t dma_update(memory_t* dma, memory_t** devices, uint8_t devicesc,
+    uint64_t now) {
+  uint64_t lines = 0;
+
+  if (memory_read_unsafe(dma, DMA_WRITTEN) == 0
+      && memory_read_unsafe(dma, DMA_RUNNING) == 0) {
+    return 0;
+  }
+
+  dma_sync(dma);
+  uint32_t enable = memory_read_unsafe(dma, DMA_ENABLE);
+
+  for (uint32_t n = 0; n < DMA_CHANNELS; n++) {
+    uint32_t base  = n * DMA_CHANNEL;
+    uint32_t state = memory_read_unsafe(dma, base + DMA_STATE);
+
+    if ((state & DMA_ACTIVE) && (enable & (1u << n))) {
+      if (!(state & DMA_LOADED)) {
+        state |= DMA_LOADED;
+        if (!dma_load(dma, base, devices, devicesc, now)) {
+          state &= ~(DMA_ACTIVE | DMA_LOADED);
+        }
+      }
+
+      qword_t done_at;
+      done_at.dwords.lower.value  = memory_read_unsafe(dma, base + DMA_DONE_AT);
+      done_at.dwords.higher.value = memory_read_unsafe(dma,
+          base + DMA_DONE_AT + 4);
+
+      // Chained blocks follow on from the previous one
+      while ((state & DMA_ACTIVE) && done_at.value <= now) {
+        dma_transfer(dma, base, devices, devicesc);
+        memory_write_unsafe(dma, DMA_COMPLETED,
+            memory_read_unsafe(dma, DMA_COMPLETED) + 1);
+
+        uint32_t ti   = memory_read_unsafe(dma, base + DMA_TI);
+        uint32_t next = memory_read_unsafe(dma, base + DMA_NEXTCONBK);
+        state |= ti & DMA_TI_INTEN ? DMA_INT : 0;
+        memory_write_unsafe(dma, base + DMA_CONBLK_AD, next);
+
+        if (next == 0 || !dma_load(dma, base, devices, devicesc,
+            done_at.value)) {
+          state = (state & ~(DMA_ACTIVE | DMA_LOADED)) | DMA_END;
+          break;
+        }
+        done_at.dwords.lower.value  = memory_read_unsafe(dma,
+            base + DMA_DONE_AT);
+        done_at.dwords.higher.value = memory_read_unsafe(dma,
+            base + DMA_DONE_AT + 4);
+      }
+      memory_write_unsafe(dma, base + DMA_STATE, state);
+    }
+
+    if (state & DMA_INT) {
+      lines |= 1ull << (DMA_LINES_SHIFT + n);
+    }
+  }
+
+  dma_sync(dma);
+  return lines;
+}
+
+/**
+ * Whether a channel still has a transfer to complete
+ */
+bool dma_busy(memory_t* dma) {
+  dma_sync(dma);
+
+  uint32_t running = memory_read_unsafe(dma, DMA_RUNNING);
+  for (uint32_t n = 0; n < DMA_CHANNELS; n++) {
+    if ((running & (1u << n)) && (memory_read_unsafe(dma,
+        n * DMA_CHANNEL + DMA_STATE) & DMA_ACTIVE)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Loads the control block at CONBLK_AD into the registers, due to
+ * complete a time proportional to its length after start.
+ * Returns false if there is none.
+ */
+static bool dma_load(memory_t* dma, uint32_t base, memory_t** devices,
+    uint8_t devicesc, uint64_t start) {
+  uint32_t block = memory_read_unsafe(dma, base + DMA_CONBLK_AD);
+  if (block == 0) {
+    return false;
+  }
+
+  // TI, SOURCE_AD, DEST_AD, TXFR_LEN, STRIDE and NEXTCONBK
+  for (uint32_t i = 0; i < 6; i++) {
+    memory_write_unsafe(dma, base + DMA_TI + 4 * i,
+        dma_read(devices, devicesc, dma_bus(block) + 4 * i));
+  }
+
+  uint32_t ti     = memory_read_unsafe(dma, base + DMA_TI);
+  uint32_t length = memory_read_unsafe(dma, base + DMA_TXFR_LEN);
+  uint64_t bytes  = ti & DMA_TI_TDMODE
+      ? (uint64_t) (length & 0xFFFF) * (((length >> 16) & 0x3FFF) + 1)
+      : length & 0x3FFFFFFF;
+
+  qword_t done_at;
+  done_at.value = start + DMA_SETUP + bytes / DMA_BYTES_PER_TICK;
+  memory_write_unsafe(dma, base + DMA_DONE_AT, done_at.dwords.lower.value);
+  memory_write_unsafe(dma, base + DMA_DONE_AT + 4,
+      done_at.dwords.higher.value);
+  return true;
+}
+
+/**
+ * Carries out the loaded control block. In 2D mode TXFR_LEN holds
+ * YLENGTH + 1 rows of XLENGTH bytes and STRIDE the signed source and
+ * destination strides added after each row.
+ */
+static void dma_transfer(memory_t* dma, uint32_t base, memory_t** devices,
+    uint8_t devicesc) {
+  uint32_t ti     = memory_read_unsafe(dma, base + DMA_TI);
+  uint32_t src    = dma_bus(memory_read_unsafe(dma, base + DMA_SOURCE_AD));
+  uint32_t dst    = dma_bus(memory_read_unsafe(dma, base + DMA_DEST_AD));
+  uint32_t length = memory_read_unsafe(dma, base + DMA_TXFR_LEN);
+  uint32_t stride = memory_read_unsafe(dma, base + DMA_STRIDE);
+  uint32_t width  = length & 0x3FFFFFFF;
+  uint32_t rows   = 1;
+
+  if (ti & DMA_TI_TDMODE) {
+    width = length & 0xFFFF;
+    rows  = ((length >> 16) & 0x3FFF) + 1;
+  } else {
+    stride = 0;
+  }
+
+  for (uint32_t y = 0; y < rows; y++) {
+    dma_row(devices, devicesc, ti, src, dst, width);
+    src += (ti & DMA_TI_SRC_INC ? width : 0)
+        + (uint32_t) (int32_t) (int16_t) (stride & 0xFFFF);
+    dst += (ti & DMA_TI_DEST_INC ? width : 0)
+        + (uint32_t) (int32_t) (int16_t) (stride >> 16);
+  }
+
+  memory_write_unsafe(dma, base + DMA_SOURCE_AD, src);
+  memory_write_unsafe(dma, base + DMA_DEST_AD,   dst);
+  memory_write_unsafe(dma, base + DMA_TXFR_LEN,  0);
+}
+
+/**
+ * Moves length bytes. Between devices without handlers this is a host
+ * memmove, or memset for a fixed source; otherwise a word at a time.
+ */
+static void dma_row(memory_t** devices, uint8_t devicesc, uint32_t ti,
+    uint32_t src, uint32_t dst, uint32_t length) {
+  bool      src_inc = ti & DMA_TI_SRC_INC;
+  bool      ignore  = ti & DMA_TI_SRC_IGNORE;
+  memory_t* to_device;
+  memory_t* from_device;
+
+  if (ti & DMA_TI_DEST_IGNORE) {
+    return;
+  }
+
+  uint8_t* to   = ti & DMA_TI_DEST_INC
+      ? dma_plain(devices, devicesc, dst, length, &to_device) : NULL;
+  uint8_t* from = ignore ? NULL
+      : dma_plain(devices, devicesc, src, src_inc ? length : 4, &from_device);
+
+  if (to != NULL && (ignore || from != NULL)) {
+    if (ignore) {
+      memset(to, 0, length);
+    } else if (src_inc) {
+      memmove(to, from, length);
+    } else {
+      // The source word over and over, doubling what has been filled
+      uint8_t word[4];
+      memcpy(word, from, 4);
+      if (word[0] == word[1] && word[0] == word[2] && word[0] == word[3]) {
+        memset(to, word[0], length);
+      } else {
+        uint32_t done = length < 4 ? length : 4;
+        memcpy(to, word, done);
+        while (done < length) {
+          uint32_t n = done < length - done ? done : length - done;
+          memcpy(to + done, to, n);
+          done += n;
+        }
+      }
+    }
+    memory_mark_dirty(to_device, dst - to_device->start, length);
+    return;
+  }
+
+  for (uint32_t i = 0; i < length; i += 4) {
+    uint32_t value = ignore ? 0
+        : dma_read(devices, devicesc, src + (src_inc ? i : 0));
+    dma_write(devices, devicesc, dst + (ti & DMA_TI_DEST_INC ? i : 0), value);
+  }
+}
+
+/**
+ * Backing memory of [address, address + length) if a single device
+ * without handlers holds all of it, NULL otherwise
+ */
+static uint8_t* dma_plain(memory_t** devices, uint8_t devicesc,
+    uint32_t address, uint32_t length, memory_t** device) {
+  memory_t* found = address_decoder(devices, devicesc, address);
+
+  if (found == NULL || found->ops != NULL || length > found->size
+      || address - found->start > found->size - length) {
+    return NULL;
+  }
+  *device = found;
+  return found->mem + (address - found->start);
+}
+
+static uint32_t dma_read(memory_t** devices, uint8_t devicesc,
+    uint32_t address) {
+  memory_t* device = address_decoder(devices, devicesc, address);
+  return device == NULL ? 0 : memory_read(device, address);
+}
+
+static void dma_write(memory_t** devices, uint8_t devicesc, uint32_t address,
+    uint32_t value) {
+  memory_t* device = address_decoder(devices, devicesc, address);
+  if (device != NULL) {
+    memory_write(device, address, value);
+  }
+}
+
+/**
+ * Bus address to ARM physical address: peripherals are at 0x7E000000 on
+ * the bus, RAM is aliased by the cache bits 30-31
+ */
+static uint32_t dma_bus(uint32_t address) {
+  if ((address >> 24) == 0x7E) {
+    return 0x20000000 | (address & 0x00FFFFFF);
+  }
+  return address & 0x3FFFFFFF;
+}
+
+/**
+ * Mailbox initialiser
+ */
+memory_t* mailbox_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, 0x2000B880, 36, false);
+  device->ops = &mailbox_ops;
+
+  return device;
+}
+
+static uint32_t mailbox_read(memory_t* mailbox, uint32_t rel_addr) {
+  mailbox_access(rel_addr);
+  return memory_read_unsafe(mailbox, rel_addr);
+}
+
+static void mailbox_write(memory_t* mailbox, uint32_t rel_addr,
+    uint32_t value) {
+  mailbox_access(rel_addr);
+  memory_write_unsafe(mailbox, rel_addr, value);
+}
+
+static void mailbox_access(uint32_t rel_addr) {
   switch(rel_addr) {
     case 0x0: // Read Receiving mail.
     break;
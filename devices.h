@@ -4,6 +4,16 @@
 #include "common.h"
 #include "memory.h"
 
+/**
+ * Filter on the values the devices read off the host, the timers' clock
+ * and what the UART receives, given the value read and returning the one
+ * to use. Record and replay install one for all the devices.
+ */
+typedef uint64_t (*device_input_t)(void*, uint64_t);
+
+void      device_set_input(device_input_t, void*);
+uint64_t  device_input(uint64_t);
+
 /**
  * GPIO 
  */
@@ -21,28 +31,168 @@ typedef struct {
   uint32_t      : 2;
 } gpio_t;
 
-memory_t* gpio_init();
+memory_t* gpio_init(arena_t*);
 
-void gpio_access_callback(memory_t*, uint32_t, bool);
+extern const device_ops_t gpio_ops;
 
 /**
  * RAM stuff
  */
-memory_t* ram_init();
+memory_t* ram_init(arena_t*);
 
 /**
  * Timer
  */
-memory_t* timer_init();
+#define TIMER_SIZE  0x2C
+#define TIMER_CS    0x0
+#define TIMER_CLO   0x4
+#define TIMER_CHI   0x8
+#define TIMER_C0    0xC
+#define TIMER_C3    0x18
+
+/**
+ * Words past the registers. TIMER_STATE holds the matched compare
+ * registers (bits 0-3) and the ones written since they last matched
+ * (bits 4-7). On the scheduler's virtual clock TIMER_WAKE is the compare
+ * value a waiting guest sleeps until, 0 if none; otherwise TIMER_BASE
+ * and TIMER_BASE + 4 hold the host clock the timer started at.
+ */
+#define TIMER_STATE 0x1C
+#define TIMER_ARMED 4
+#define TIMER_WAKE  0x20
+#define TIMER_BASE  0x24
+
+extern const device_ops_t timer_ops;
+
+memory_t* timer_init(arena_t*);
+void      timer_track(memory_t*, uint32_t, uint32_t);
+uint64_t  timer_now(memory_t*);
+uint32_t  timer_update(memory_t*, uint32_t);
+uint32_t  timer_next(memory_t*, uint32_t, uint32_t);
+
+/**
+ * Interrupt controller, with the BCM2835 layout. Lines 0-31 are in
+ * pending 1, 32-63 in pending 2; the basic (ARM side) sources are not
+ * emulated. Writes to the enable and disable registers set and clear the
+ * enabled lines, which the enable registers read back.
+ */
+#define INTC_SIZE          44
+#define INTC_BASIC_PENDING 0x0
+#define INTC_PENDING1      0x4
+#define INTC_PENDING2      0x8
+#define INTC_FIQ_CONTROL   0xC
+#define INTC_ENABLE1       0x10
+#define INTC_ENABLE2       0x14
+#define INTC_ENABLE_BASIC  0x18
+#define INTC_DISABLE1      0x1C
+#define INTC_DISABLE2      0x20
+#define INTC_DISABLE_BASIC 0x24
+
+#define INTC_FIQ_ENABLE    0x80
+#define INTC_TIMER_LINES   0xF   // System timer compare registers C0-C3
+
+/**
+ * Requests the controller raises to the core
+ */
+#define INTC_IRQ 1
+#define INTC_FIQ 2
+
+extern const device_ops_t intc_ops;
+
+memory_t* intc_init(arena_t*);
+uint64_t  intc_enabled(memory_t*);
+uint8_t   intc_update(memory_t*, uint64_t);
+
+/**
+ * DMA controller, channels 0-14 with the BCM2835 layout. A channel set
+ * ACTIVE runs the chain of control blocks from CONBLK_AD, each one
+ * completing DMA_SETUP + length / DMA_BYTES_PER_TICK instructions after
+ * the previous. Transfers between devices without handlers are done with
+ * host copies, any others a word at a time through the handlers.
+ * DREQ pacing is not emulated.
+ */
+#define DMA_SIZE        0xFF4
+#define DMA_CHANNELS    15
+#define DMA_CHANNEL     0x100  // Registers of channel n start at n * 0x100
+#define DMA_CS          0x0
+#define DMA_CONBLK_AD   0x4
+#define DMA_TI          0x8
+#define DMA_SOURCE_AD   0xC
+#define DMA_DEST_AD     0x10
+#define DMA_TXFR_LEN    0x14
+#define DMA_STRIDE      0x18
+#define DMA_NEXTCONBK   0x1C
+#define DMA_DEBUG       0x20
+#define DMA_INT_STATUS  0xFE0
+#define DMA_ENABLE      0xFF0
+
+/**
+ * Words in the reserved space after the registers: the state of each
+ * channel, when its block completes (DMA_DONE_AT and DMA_DONE_AT + 4),
+ * the channels whose CS has been written since their state was last
+ * updated, the blocks completed by all channels and the channels either
+ * active or interrupting
+ */
+#define DMA_STATE       0x24
+#define DMA_DONE_AT     0x28
+#define DMA_WRITTEN     0xFE4
+#define DMA_COMPLETED   0xFE8
+#define DMA_RUNNING     0xFEC
+
+/**
+ * CS bits, also kept in DMA_STATE. DMA_LOADED is internal: the channel
+ * holds a control block, and was paused if not ACTIVE.
+ */
+#define DMA_ACTIVE      (1u << 0)
+#define DMA_END         (1u << 1)
+#define DMA_INT         (1u << 2)
+#define DMA_LOADED      (1u << 8)
+#define DMA_RESET       (1u << 31)
 
-void timer_access_callback(memory_t*, uint32_t, bool);
+/**
+ * Transfer information bits
+ */
+#define DMA_TI_INTEN       (1u << 0)
+#define DMA_TI_TDMODE      (1u << 1)
+#define DMA_TI_DEST_INC    (1u << 4)
+#define DMA_TI_DEST_IGNORE (1u << 7)
+#define DMA_TI_SRC_INC     (1u << 8)
+#define DMA_TI_SRC_IGNORE  (1u << 11)
+
+#define DMA_SETUP          16
+#define DMA_BYTES_PER_TICK 4
+#define DMA_LINES_SHIFT    16    // Channel n raises interrupt line 16 + n
+
+extern const device_ops_t dma_ops;
+
+memory_t* dma_init(arena_t*);
+uint64_t  dma_update(memory_t*, memory_t**, uint8_t, uint64_t);
+bool      dma_busy(memory_t*);
 
 /**
  * Mailbox
  */
-memory_t* mailbox_init();
+memory_t* mailbox_init(arena_t*);
+
+extern const device_ops_t mailbox_ops;
+
+/**
+ * The devices every machine is built with, in the order the address
+ * decoder tries them, RAM first as it takes most accesses
+ */
+enum {
+  DEVICE_RAM,
+  DEVICE_TIMER,
+  DEVICE_MAILBOX,
+  DEVICE_GPIO,
+  DEVICE_INTC,
+  DEVICE_DMA,
+  DEVICE_UART,
+  DEVICE_PMU,
+  DEVICE_DEFAULTS
+};
 
-void mailbox_access_callback(memory_t*, uint32_t, bool);
+extern memory_t* (* const device_table[DEVICE_DEFAULTS])(arena_t*);
 
 #endif
 
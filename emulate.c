@@ -1,6 +1,168 @@
 #include "emulate.h"
 
 int main(int argc, char **argv) {
+  bool  translate = false;
+  bool  verbose   = false;
+  bool  timed     = false;
+  bool  cached    = false;
+  bool  located   = false;
+  bool  fuzzing   = false;
+  bool  sampled   = false;
+  fuzz_config_t fuzz_config;
+  sample_config_t sample_config;
+  cache_config_t icache = { CACHE_SIZE, CACHE_WAYS, CACHE_LINE };
+  cache_config_t dcache = { CACHE_SIZE, CACHE_WAYS, CACHE_LINE };
+  char* gdb_endpoint = NULL;
+  uint64_t interval = 0;
+  size_t   budget   = CHECKPOINT_BUDGET;
+  uint32_t guests   = 0;
+  uint64_t quantum  = SCHED_QUANTUM;
+  uint32_t instances = 0;
+  uint32_t rate     = 1;
+  uint32_t dedup    = 0;
+  char* stats_name = NULL;
+  char* folded_path = NULL;
+  char* elf_path    = NULL;
+  char* root_path   = NULL;
+  char* record_path = NULL;
+  char* replay_path = NULL;
+  int   opt;
+
+  while ((opt = getopt(argc, argv, "Ovtg:c:C:I:D:S:q:m:V:s:P:E:H:F:R:r:p:k:")) != -1) {
+    switch (opt) {
+      case 'c': // Checkpoint every so many instructions
+        interval = strtoull(optarg, NULL, 10);
+        break;
+      case 'C': // Memory limit of the checkpoints in MiB
+        budget = (size_t) strtoul(optarg, NULL, 10) << 20;
+        break;
+      case 'g': // Wait for GDB on a port or unix socket
+        gdb_endpoint = optarg;
+        break;
+      case 'O': // Translate hot regions into optimised IR
+        translate = true;
+        break;
+      case 'I': // Simulate the L1 caches, with this instruction cache
+      case 'D': // or data cache geometry
+        cached = true;
+        if (!cache_parse(optarg, opt == 'I' ? &icache : &dcache)) {
+          fprintf(stderr, "Error: invalid cache geometry %s, expected "
+              "size,ways,line with power of two sets and lines.\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'F': // Fuzz test cases copied into a guest buffer
+        fuzzing = true;
+        if (!fuzz_parse(optarg, &fuzz_config)) {
+          fprintf(stderr, "Error: invalid fuzzing setup %s, expected "
+              "buffer,size[,budget[,entry]].\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'k': // Run the -t or -I/-D model over representative intervals
+        sampled = true;
+        if (!sample_parse(optarg, &sample_config)) {
+          fprintf(stderr, "Error: invalid sampling setup %s, expected "
+              "interval[,clusters] with at most %d clusters.\n", optarg,
+              SAMPLE_MAX_CLUSTERS);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'H': // Map data locality, sampling one in so many accesses
+        located = true;
+        rate    = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'S': // Run that many copies of the guest on one thread
+        guests = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'q': // Instructions each of them runs before yielding
+        quantum = strtoull(optarg, NULL, 10);
+        break;
+      case 'm': // Merge their identical RAM pages, scanning so many a round
+        dedup = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'V': // Run instances in lockstep, r0 set to each one's index
+        instances = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'P': // Profile calls, writing folded stacks to this file
+        folded_path = optarg;
+        break;
+      case 'E': // ELF file of the binary, to name the profiled functions
+        elf_path = optarg;
+        break;
+      case 'R': // Give the guest semihosting access to files in this directory
+        root_path = optarg;
+        break;
+      case 'r': // Log the inputs read off the host to this file
+        record_path = optarg;
+        break;
+      case 'p': // Play the inputs logged to this file back
+        replay_path = optarg;
+        break;
+      case 's': // Publish counters in a stats page with this name
+        stats_name = optarg;
+        break;
+      case 't': // Estimate the cycles taken on the real core
+        timed = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-O] [-v] [-t] [-g port|path] [-c interval] "
+            "[-C MiB] [-I size,ways,line] [-D size,ways,line] [-S guests] "
+            "[-q quantum] [-m pages] [-V instances] [-s name] [-P folded] [-E elf] "
+            "[-H rate] [-F buffer,size[,budget[,entry]]] [-R dir] "
+            "[-k interval[,clusters]] "
+            "[-r log | -p log] <binary> "
+            "[test cases]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 1 && !(fuzzing && argc - optind > 1)) {
+    fprintf(stderr, "Error: the number of arguments is %d.\n", argc - optind);
+    return EXIT_FAILURE;
+  }
+
+  // -k runs the -t or -I/-D model itself
+  int engines = translate + (interval > 0) + (timed && !sampled)
+      + (cached && !sampled) + (guests > 0) + (instances > 0)
+      + (folded_path != NULL) + located + fuzzing + sampled;
+  if (engines > 1 || (gdb_endpoint != NULL && engines > (interval > 0))) {
+    fprintf(stderr, "Error: -O, -c, -t, -I/-D, -S, -V, -P, -H, -F and -k "
+        "cannot be combined, and only -c can be used with -g.\n");
+    return EXIT_FAILURE;
+  }
+  if (sampled && ((timed && cached) || stats_name != NULL
+      || root_path != NULL)) {
+    fprintf(stderr, "Error: -k runs either -t or -I/-D, and cannot be used "
+        "with -s or -R.\n");
+    return EXIT_FAILURE;
+  }
+  if (dedup > 0 && guests == 0) {
+    fprintf(stderr, "Error: -m merges the RAM of the -S guests.\n");
+    return EXIT_FAILURE;
+  }
+  if (elf_path != NULL && folded_path == NULL) {
+    fprintf(stderr, "Error: -E names the functions profiled by -P.\n");
+    return EXIT_FAILURE;
+  }
+  if (stats_name != NULL && (translate || instances > 0)) {
+    fprintf(stderr, "Error: -s needs the interpreter, not -O or -V.\n");
+    return EXIT_FAILURE;
+  }
+  if (root_path != NULL && (guests > 0 || instances > 0 || fuzzing)) {
+    fprintf(stderr, "Error: -R serves a single guest, not -S, -V or -F.\n");
+    return EXIT_FAILURE;
+  }
+  bool logged = record_path != NULL || replay_path != NULL;
+  if ((record_path != NULL && replay_path != NULL) || (logged && (guests > 0
+      || instances > 0 || fuzzing || gdb_endpoint != NULL))) {
+    fprintf(stderr, "Error: -r or -p follow a single guest running forward, "
+        "not -S, -V, -F or -g.\n");
+    return EXIT_FAILURE;
+  }
 
   //if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
   //  printf("something wrong\n");
@@ -9,22 +171,133 @@ int main(int argc, char **argv) {
 
   //SDL_WM_SetCaption("Video test", NULL);
 
-  cpu_t* cpu = malloc(sizeof(cpu_t));
-  if(cpu == NULL) {
-    fprintf(stderr,"malloc failure");
-    exit(EXIT_FAILURE);
+  cpu_t* cpu = cpu_new();
+
+  if (load_binary(cpu, argv[optind])) {
+    return EXIT_FAILURE;
+  }
+
+  if (root_path != NULL) {
+    cpu->semihost = semihost_init(root_path);
+    if (cpu->semihost == NULL) {
+      return EXIT_FAILURE;
+    }
   }
-  cpu_init(cpu);
 
-  if (load_binary(cpu->devices[0], argc, argv)) {
+  if (record_path != NULL) {
+    cpu->replay = replay_record(record_path, &cpu->instructions,
+        cpu->image->hash);
+  } else if (replay_path != NULL) {
+    cpu->replay = replay_open(replay_path, &cpu->instructions,
+        cpu->image->hash);
+  }
+  if (logged && cpu->replay == NULL) {
     return EXIT_FAILURE;
-  };
+  }
+
+  if (stats_name != NULL) {
+    // The -S guests are numbered, this one first
+    char name[256];
+    snprintf(name, sizeof(name), "%s%s", stats_name, guests > 0 ? ".0" : "");
+    cpu->stats = stats_create(name, cpu->devices, cpu->devicesc);
+    if (cpu->stats == NULL) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  checkpoints_t* checkpoints = NULL;
+  if (interval) {
+    checkpoints = checkpoint_init(cpu, interval, budget);
+  }
+
+  if (gdb_endpoint != NULL) {
+    gdb_t* gdb = gdb_init(cpu, gdb_endpoint);
+    if (gdb == NULL) {
+      return EXIT_FAILURE;
+    }
+    gdb->checkpoints = checkpoints;
+    bool keep_running = gdb_serve(gdb);
+    gdb_free(gdb);
+    if (keep_running && checkpoints != NULL) {
+      checkpoint_loop(checkpoints);
+    } else if (keep_running) {
+      cpu_loop(cpu);
+    }
+  } else if (translate) {
+    ir_engine_t* ir = ir_init(cpu);
+    ir_loop(ir);
+    if (verbose) {
+      ir_dump_stats(ir);
+    }
+    ir_free(ir);
+  } else if (checkpoints != NULL) {
+    checkpoint_loop(checkpoints);
+  } else if (sampled) {
+    sample_t* sample = sample_init(cpu, &sample_config,
+        cached ? &icache : NULL, cached ? &dcache : NULL);
+    if (sample == NULL) {
+      return EXIT_FAILURE;
+    }
+    sample_loop(sample);
+    sample_report(sample, stderr);
+    sample_free(sample);
+  } else if (timed) {
+    timing_t* timing = timing_init(cpu);
+    timing_loop(timing);
+    timing_report(timing, stderr);
+    timing_free(timing);
+  } else if (cached) {
+    caches_t* caches = cache_init(cpu, &icache, &dcache);
+    cache_loop(caches);
+    cache_report(caches, stderr);
+    cache_free(caches);
+  } else if (guests > 0) {
+    if (run_guests(cpu, argv[optind], guests, quantum, dedup, stats_name,
+        verbose)) {
+      return EXIT_FAILURE;
+    }
+  } else if (fuzzing) {
+    if (run_fuzzer(cpu, &fuzz_config, argv + optind + 1, argc - optind - 1,
+        verbose)) {
+      return EXIT_FAILURE;
+    }
+  } else if (located) {
+    locality_t* locality = locality_init(cpu, rate);
+    locality_loop(locality);
+    locality_report(locality, stderr);
+    locality_free(locality);
+  } else if (folded_path != NULL) {
+    if (run_profile(cpu, folded_path, elf_path)) {
+      return EXIT_FAILURE;
+    }
+  } else if (instances > 0) {
+    if (run_lockstep(cpu, argv[optind], instances, verbose)) {
+      return EXIT_FAILURE;
+    }
+  } else {
+    // The execute-decode-fetch "pipeline"
+    cpu_loop(cpu);
+    if (verbose) {
+      cpu_dump_fusions(cpu, stderr);
+    }
+  }
 
-  // The execute-decode-fetch "pipeline"
-  cpu_loop(cpu);
+  if (checkpoints != NULL) {
+    if (verbose) {
+      checkpoint_dump(checkpoints, stderr);
+    }
+    checkpoint_free(checkpoints);
+  }
+  if (verbose && cpu->semihost != NULL) {
+    semihost_dump_stats(cpu->semihost, stderr);
+  }
+  if (verbose && cpu->replay != NULL) {
+    replay_dump_stats(cpu->replay, stderr);
+  }
 
   dump_state(cpu, cpu->ram);
 
+  image_free(cpu->image);
   cpu_free(cpu);
 
   return EXIT_SUCCESS;
@@ -40,35 +313,193 @@ void dump_state(cpu_t* cpu, memory_t* memory) {
 }
 
 /**
- * Load the binary executable into memory
+ * Runs cpu and guests - 1 more copies of the binary on the scheduler.
+ * Only the first one, guest 0, is left for dump_state. With stats_name,
+ * guest i publishes its counters as stats_name.i, cpu's having been
+ * created so already. With dedup, that many pages of their RAM are
+ * scanned for merging after every round.
  */
-int load_binary(memory_t* memory, int numargs, char **argv) {
-  if (numargs != 2) {
-    fprintf(stderr, "Error: the number of arguments is %d.\n", numargs-1);
-    return 1;
+int run_guests(cpu_t* cpu, const char* path, uint32_t guests,
+    uint64_t quantum, uint32_t dedup, const char* stats_name, bool verbose) {
+  sched_t* sched  = sched_init(quantum, SCHED_ROUND_ROBIN);
+  cpu_t**  others = calloc(guests, sizeof(cpu_t *));
+  int      status = 0;
+  if (others == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  sched->dedup = dedup;
+  sched_add(sched, cpu, 0);
+  for (uint32_t i = 1; i < guests; i++) {
+    others[i] = cpu_new();
+    if (load_binary(others[i], path)) {
+      status = 1;
+      break;
+    }
+    if (stats_name != NULL) {
+      char name[256];
+      snprintf(name, sizeof(name), "%s.%u", stats_name, i);
+      others[i]->stats = stats_create(name, others[i]->devices,
+          others[i]->devicesc);
+      if (others[i]->stats == NULL) {
+        status = 1;
+        break;
+      }
+    }
+    sched_add(sched, others[i], 0);
   }
 
-  FILE *fileptr = fopen(argv[1], "rb");
-  
-  if (fileptr == NULL) {
-    fprintf(stderr, "Error: Something went wrong while reading the file.\n");
+  if (status == 0) {
+    sched_run(sched);
+    if (verbose) {
+      sched_dump_stats(sched, stderr);
+    }
+  }
+
+  for (uint32_t i = 1; i < guests && others[i] != NULL; i++) {
+    image_free(others[i]->image);
+    cpu_free(others[i]);
+  }
+  free(others);
+  sched_free(sched);
+
+  return status;
+}
+
+/**
+ * Runs the test cases against a snapshot of cpu, serving afl-fuzz if
+ * started by it. With no test cases they are read from stdin.
+ */
+int run_fuzzer(cpu_t* cpu, fuzz_config_t* config, char** inputs, int count,
+    bool verbose) {
+  fuzz_t* fuzz = fuzz_init(cpu, config);
+  if (fuzz == NULL) {
     return 1;
   }
 
-  fseek(fileptr, 0, SEEK_END);
-  size_t filelength = (size_t) ftell(fileptr);
+  if (!fuzz_serve(fuzz, count > 0 ? inputs[0] : NULL)) {
+    for (int i = 0; i < count || (count == 0 && i == 0); i++) {
+      FILE*  file = count > 0 ? fopen(inputs[i], "rb") : stdin;
+      if (file == NULL) {
+        fprintf(stderr, "Error: cannot read %s.\n", inputs[i]);
+        fuzz_free(fuzz);
+        return 1;
+      }
+      size_t length = fread(fuzz->input, 1, config->size, file);
+      if (file != stdin) {
+        fclose(file);
+      }
+      fuzz_run(fuzz, fuzz->input, length);
+    }
+  }
+
+  if (verbose) {
+    fuzz_report(fuzz, stderr);
+  }
+  fuzz_free(fuzz);
+  return 0;
+}
+
+/**
+ * Runs cpu under the call profiler, writing the folded stacks to
+ * folded_path and the report to stderr
+ */
+int run_profile(cpu_t* cpu, const char* folded_path, const char* elf_path) {
+  FILE* folded = fopen(folded_path, "w");
+  if (folded == NULL) {
+    fprintf(stderr, "Error: cannot write %s.\n", folded_path);
+    return 1;
+  }
 
-  if (filelength % 4 != 0) {
-    fprintf(stderr,
-     "Error: The number of bytes in the binary is not divisible by 4.\n");
+  profile_t* profile = profile_init(cpu);
+  if (elf_path != NULL && !profile_load_symbols(profile, elf_path)) {
+    fprintf(stderr, "Error: cannot read symbols from %s.\n", elf_path);
+    fclose(folded);
+    profile_free(profile);
     return 1;
   }
 
-  rewind(fileptr);                    
-  
-  fread(memory->mem, filelength, 4, fileptr);
-  fclose(fileptr);
+  profile_loop(profile);
+  profile_write_folded(profile, folded);
+  profile_report(profile, stderr);
 
+  fclose(folded);
+  profile_free(profile);
   return 0;
 }
 
+/**
+ * Runs cpu and instances - 1 more copies of the binary, LOCKSTEP_LANES at
+ * a time. Each starts with its index in r0. Only the first one is left
+ * for dump_state.
+ */
+int run_lockstep(cpu_t* cpu, const char* path, uint32_t instances,
+    bool verbose) {
+  lockstep_stats_t total  = { 0 };
+  cpu_t*           lanes[LOCKSTEP_LANES];
+  int              status = 0;
+
+  for (uint32_t base = 0; base < instances && status == 0;
+      base += LOCKSTEP_LANES) {
+    uint32_t count = instances - base < LOCKSTEP_LANES
+        ? instances - base : LOCKSTEP_LANES;
+    uint32_t made  = 0;   // Lanes up to here may need freeing
+
+    for (uint32_t l = 0; l < count; l++) {
+      if (base + l == 0) {
+        lanes[l] = cpu;
+        continue;
+      }
+      lanes[l] = cpu_new();
+      made     = l + 1;
+      if (load_binary(lanes[l], path)) {
+        status = 1;
+        break;
+      }
+      lanes[l]->registers[0] = base + l;
+    }
+
+    if (status == 0) {
+      lockstep_t* ls = lockstep_init(lanes, count);
+      lockstep_loop(ls);
+      total.instructions += ls->stats.instructions;
+      total.vector_ops   += ls->stats.vector_ops;
+      total.scalar_ops   += ls->stats.scalar_ops;
+      total.divergences  += ls->stats.divergences;
+      lockstep_free(ls);
+    }
+
+    for (uint32_t l = 0; l < made; l++) {
+      if (lanes[l] != cpu) {
+        image_free(lanes[l]->image);
+        cpu_free(lanes[l]);
+      }
+    }
+  }
+
+  if (status == 0 && verbose) {
+    lockstep_dump_stats(&total, stderr);
+  }
+  return status;
+}
+
+/**
+ * Load the binary executable into memory, sharing its pages and decoded
+ * instructions with the other instances running it
+ */
+int load_binary(cpu_t* cpu, const char* path) {
+  image_t* image = image_load(path);
+  if (image == NULL) {
+    return 1;
+  }
+
+  if (!image_map(image, cpu->ram)) {
+    fprintf(stderr, "Error: The binary does not fit in memory.\n");
+    image_free(image);
+    return 1;
+  }
+  cpu->image = image;
+
+  return 0;
+}
@@ -2,14 +2,35 @@
 #define HEADER_EMULATE
 
 #include "common.h"
+#include <unistd.h>
 
 #include "instruction.h"
 #include "cpu.h"
 #include "memory.h"
 #include "devices.h"
 #include "utils.h"
+#include "ir.h"
+#include "gdbstub.h"
+#include "checkpoint.h"
+#include "timing.h"
+#include "cache.h"
+#include "sched.h"
+#include "lockstep.h"
+#include "stats.h"
+#include "profile.h"
+#include "locality.h"
+#include "fuzz.h"
+#include "image.h"
+#include "replay.h"
+#include "sample.h"
+#include "semihost.h"
 
-int load_binary(memory_t*, int, char**);
+int load_binary(cpu_t*, const char*);
+int run_guests(cpu_t*, const char*, uint32_t, uint64_t, uint32_t,
+    const char*, bool);
+int run_lockstep(cpu_t*, const char*, uint32_t, bool);
+int run_profile(cpu_t*, const char*, const char*);
+int run_fuzzer(cpu_t*, fuzz_config_t*, char**, int, bool);
 void dump_state(); 
 
 #endif
@@ -0,0 +1,264 @@
+#include "fuzz.h"
+
+static void   fuzz_edge(fuzz_t*, uint32_t);
+static size_t fuzz_read(fuzz_t*, const char*);
+static void   fuzz_persist(fuzz_t*, const char*);
+
+/**
+ * Parses "buffer,size[,budget[,entry]]", numbers in C notation.
+ * Returns false if the configuration is invalid.
+ */
+bool fuzz_parse(const char* text, fuzz_config_t* config) {
+  unsigned long long values[4] = { 0, 0, FUZZ_BUDGET, 0 };
+  uint32_t           fields    = 0;
+  char*              end;
+
+  while (fields < 4) {
+    values[fields++] = strtoull(text, &end, 0);
+    if (end == text || (*end != ',' && *end != '\0')) {
+      return false;
+    }
+    if (*end == '\0') {
+      break;
+    }
+    text = end + 1;
+  }
+
+  if (fields < 2 || *end != '\0' || values[1] == 0 || values[2] == 0
+      || values[0] > UINT32_MAX || values[1] > UINT32_MAX
+      || values[3] > UINT32_MAX) {
+    return false;
+  }
+
+  config->buffer    = (uint32_t) values[0];
+  config->size      = (uint32_t) values[1];
+  config->budget    = values[2];
+  config->entry     = (uint32_t) values[3];
+  config->has_entry = fields == 4;
+  return true;
+}
+
+/**
+ * Boots the guest up to the entry pc, if any, and snapshots it there.
+ * The bitmap is afl-fuzz's when __AFL_SHM_ID is set.
+ */
+fuzz_t* fuzz_init(cpu_t* cpu, fuzz_config_t* config) {
+  if (config->buffer > cpu->ram->size
+      || config->size > cpu->ram->size - config->buffer) {
+    fprintf(stderr, "Error: the fuzzing buffer is not in RAM.\n");
+    return NULL;
+  }
+
+  fuzz_t* fuzz = calloc(1, sizeof(fuzz_t));
+  if (fuzz == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  fuzz->cpu    = cpu;
+  fuzz->config = *config;
+  fuzz->input  = malloc(config->size);
+  if (fuzz->input == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  char* shm_id = getenv("__AFL_SHM_ID");
+  if (shm_id != NULL) {
+    fuzz->map = shmat(atoi(shm_id), NULL, 0);
+    if (fuzz->map == (void *) -1) {
+      perror("shmat");
+      exit(EXIT_FAILURE);
+    }
+    fuzz->shared = true;
+  } else {
+    fuzz->map = calloc(FUZZ_MAP_SIZE, sizeof(uint8_t));
+    if (fuzz->map == NULL) {
+      fprintf(stderr,"calloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (config->has_entry) {
+    while (cpu->decoded_inst.type != HALT
+        && (cpu->decoded_inst.type == EMPTY
+          || cpu->decoded_pc != config->entry)) {
+      cpu_step(cpu);
+    }
+  }
+
+  // A single checkpoint that is never merged away
+  fuzz->snapshot = checkpoint_init(cpu, CHECKPOINT_INTERVAL, SIZE_MAX);
+
+  return fuzz;
+}
+
+/**
+ * Runs one test case from the snapshot
+ */
+void fuzz_run(fuzz_t* fuzz, const uint8_t* data, size_t length) {
+  cpu_t*    cpu = fuzz->cpu;
+  memory_t* ram = cpu->ram;
+
+  checkpoint_rewind(fuzz->snapshot, fuzz->snapshot->checkpoints[0].id);
+
+  if (length > fuzz->config.size) {
+    length = fuzz->config.size;
+  }
+  memcpy(ram->mem + fuzz->config.buffer, data, length);
+  memset(ram->mem + fuzz->config.buffer + length, 0,
+      fuzz->config.size - length);
+  memory_mark_dirty(ram, fuzz->config.buffer, fuzz->config.size);
+
+  uint64_t end = cpu->instructions + fuzz->config.budget;
+  fuzz->previous = 0;
+  fuzz->runs++;
+
+  while (cpu->decoded_inst.type != HALT) {
+    if (cpu->instructions >= end) {
+      fuzz->budget_hits++;
+      break;
+    }
+    if (cpu->decoded_inst.type == EMPTY) {
+      cpu_step(cpu);
+      continue;
+    }
+
+    uint32_t pc     = cpu->decoded_pc;
+    bool     branch = cpu->decoded_inst.type == BRANCH;
+
+    cpu_step(cpu);
+
+    // A flush is a taken branch, BX or pc write; the target has been
+    // fetched. A skipped branch falls through into a block of its own.
+    if (cpu->decoded_inst.type == EMPTY) {
+      fuzz_edge(fuzz, cpu->fetched_pc);
+    } else if (branch) {
+      fuzz_edge(fuzz, pc + 4);
+    }
+  }
+}
+
+/**
+ * Counts the edge from the previous block into the one at target, the
+ * way afl-gcc instrumentation does
+ */
+static void fuzz_edge(fuzz_t* fuzz, uint32_t target) {
+  uint32_t location = ((target >> 2) * 2654435761u) >> 16;
+  fuzz->map[(location ^ fuzz->previous) & (FUZZ_MAP_SIZE - 1)]++;
+  fuzz->previous = location >> 1;
+}
+
+/**
+ * Acts as the AFL fork server, in persistent mode: the forked process
+ * runs test case after test case, stopping itself in between, until
+ * FUZZ_PERSIST of them. The test case is read from path, or stdin if
+ * NULL, before each run.
+ * Returns false if not started by afl-fuzz, and does not return otherwise.
+ */
+bool fuzz_serve(fuzz_t* fuzz, const char* path) {
+  uint32_t hello = 0;
+  if (write(FUZZ_FORKSRV_FD + 1, &hello, 4) != 4) {
+    return false;
+  }
+
+  pid_t child   = -1;
+  bool  stopped = false;
+  int   status;
+
+  while (true) {
+    uint32_t killed;
+    if (read(FUZZ_FORKSRV_FD, &killed, 4) != 4) {
+      exit(EXIT_SUCCESS);
+    }
+
+    // afl-fuzz killed the stopped child on a timeout
+    if (stopped && killed) {
+      stopped = false;
+      waitpid(child, &status, 0);
+    }
+
+    if (stopped) {
+      kill(child, SIGCONT);
+      stopped = false;
+    } else {
+      child = fork();
+      if (child < 0) {
+        exit(EXIT_FAILURE);
+      }
+      if (child == 0) {
+        close(FUZZ_FORKSRV_FD);
+        close(FUZZ_FORKSRV_FD + 1);
+        fuzz_persist(fuzz, path);
+        exit(EXIT_SUCCESS);
+      }
+    }
+
+    if (write(FUZZ_FORKSRV_FD + 1, &child, 4) != 4
+        || waitpid(child, &status, WUNTRACED) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    stopped = WIFSTOPPED(status);
+    if (write(FUZZ_FORKSRV_FD + 1, &status, 4) != 4) {
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void fuzz_persist(fuzz_t* fuzz, const char* path) {
+  for (uint32_t i = 0; i < FUZZ_PERSIST; i++) {
+    size_t length = fuzz_read(fuzz, path);
+    fuzz_run(fuzz, fuzz->input, length);
+    raise(SIGSTOP);
+  }
+}
+
+/**
+ * Reads at most the buffer size of the test case into fuzz->input
+ */
+static size_t fuzz_read(fuzz_t* fuzz, const char* path) {
+  int fd = path != NULL ? open(path, O_RDONLY) : 0;
+  if (fd < 0) {
+    return 0;
+  }
+  if (path == NULL) {
+    lseek(fd, 0, SEEK_SET);
+  }
+
+  size_t  length = 0;
+  ssize_t got;
+  while (length < fuzz->config.size && (got = read(fd,
+      fuzz->input + length, fuzz->config.size - length)) > 0) {
+    length += (size_t) got;
+  }
+
+  if (path != NULL) {
+    close(fd);
+  }
+  return length;
+}
+
+/**
+ * Prints the runs so far and the coverage they reached
+ */
+void fuzz_report(fuzz_t* fuzz, FILE* out) {
+  uint32_t edges = 0;
+  for (uint32_t i = 0; i < FUZZ_MAP_SIZE; i++) {
+    edges += fuzz->map[i] != 0;
+  }
+
+  fprintf(out, "test cases        : %llu\n", (unsigned long long) fuzz->runs);
+  fprintf(out, "out of budget     : %llu\n",
+      (unsigned long long) fuzz->budget_hits);
+  fprintf(out, "edges covered     : %u\n", edges);
+}
+
+void fuzz_free(fuzz_t* fuzz) {
+  if (fuzz->shared) {
+    shmdt(fuzz->map);
+  } else {
+    free(fuzz->map);
+  }
+  checkpoint_free(fuzz->snapshot);
+  free(fuzz->input);
+  free(fuzz);
+}
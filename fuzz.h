@@ -0,0 +1,72 @@
+#ifndef HEADER_FUZZ
+#define HEADER_FUZZ
+
+#include "common.h"
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "cpu.h"
+#include "memory.h"
+
+/**
+ * Size of the AFL coverage bitmap
+ */
+#define FUZZ_MAP_SIZE (1 << 16)
+
+/**
+ * File descriptors of the AFL fork server: control in, status out
+ */
+#define FUZZ_FORKSRV_FD 198
+
+/**
+ * Default number of instructions a test case may run
+ */
+#define FUZZ_BUDGET 1000000
+
+/**
+ * Test cases run by one process before the fork server starts a fresh
+ * one, in case the emulator itself leaks between runs
+ */
+#define FUZZ_PERSIST 100000
+
+typedef struct {
+  uint32_t buffer;      // Guest address the test case is copied to
+  uint32_t size;        // Longest test case, the rest is zero filled
+  uint64_t budget;
+  uint32_t entry;       // Run up to this pc before the snapshot
+  bool     has_entry;
+} fuzz_config_t;
+
+/**
+ * Runs test cases against a snapshot of the guest. Each run rewinds the
+ * RAM pages and the devices the previous one changed, copies the test
+ * case into the buffer and runs to HALT or the budget, recording every
+ * taken or skipped branch as an AFL edge.
+ */
+typedef struct {
+  cpu_t*         cpu;
+  fuzz_config_t  config;
+  checkpoints_t* snapshot;
+
+  uint8_t*       map;
+  bool           shared;    // map is afl-fuzz's
+  uint32_t       previous;  // Location of the previous edge, shifted
+
+  uint8_t*       input;
+  uint64_t       runs;
+  uint64_t       budget_hits;
+} fuzz_t;
+
+bool    fuzz_parse(const char*, fuzz_config_t*);
+fuzz_t* fuzz_init(cpu_t*, fuzz_config_t*);
+void    fuzz_run(fuzz_t*, const uint8_t*, size_t);
+bool    fuzz_serve(fuzz_t*, const char*);
+void    fuzz_report(fuzz_t*, FILE*);
+void    fuzz_free(fuzz_t*);
+
+#endif
@@ -0,0 +1,744 @@
+#include "gdbstub.h"
+
+static gdb_t*           gdb_active = NULL;
+static struct sigaction gdb_old_action;
+static size_t           gdb_page_size;
+
+static int       gdb_read_packet(gdb_t*);
+static void      gdb_send_packet(gdb_t*, const char*);
+static bool      gdb_handle(gdb_t*, bool*);
+static void      gdb_resume(gdb_t*, bool);
+static void      gdb_monitor(gdb_t*, const char*);
+static void      gdb_settle(cpu_t*);
+static bool      gdb_watch_hit(gdb_t*, uint32_t*, uint8_t*);
+static void      gdb_protect(gdb_t*, bool);
+static bool      gdb_interrupted(gdb_t*);
+static uint8_t*  gdb_byte(gdb_t*, uint32_t);
+static memory_t* gdb_device(gdb_t*, uint32_t);
+static void      gdb_fault_handler(int, siginfo_t*, void*);
+
+/**
+ * Opens the endpoint and waits for GDB to connect. The endpoint is either
+ * a TCP port on localhost or the path of a unix socket.
+ * Returns NULL on failure.
+ */
+gdb_t* gdb_init(cpu_t* cpu, const char* endpoint) {
+  gdb_t* gdb = calloc(1, sizeof(gdb_t));
+  if (gdb == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  gdb->cpu = cpu;
+  gdb->fd  = -1;
+
+  char* end;
+  long port = strtol(endpoint, &end, 10);
+
+  if (*end == '\0' && port > 0 && port < 65536) {
+    struct sockaddr_in addr;
+    int yes = 1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    gdb->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(gdb->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (gdb->listen_fd < 0
+        || bind(gdb->listen_fd, (struct sockaddr *) &addr, sizeof(addr))) {
+      fprintf(stderr, "Error: cannot listen on port %ld.\n", port);
+      gdb_free(gdb);
+      return NULL;
+    }
+  } else {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, endpoint, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+
+    gdb->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (gdb->listen_fd < 0
+        || bind(gdb->listen_fd, (struct sockaddr *) &addr, sizeof(addr))) {
+      fprintf(stderr, "Error: cannot listen on %s.\n", endpoint);
+      gdb_free(gdb);
+      return NULL;
+    }
+  }
+
+  listen(gdb->listen_fd, 1);
+  fprintf(stderr, "Waiting for GDB on %s\n", endpoint);
+
+  gdb->fd = accept(gdb->listen_fd, NULL, NULL);
+  if (gdb->fd < 0) {
+    fprintf(stderr, "Error: accepting the GDB connection failed.\n");
+    gdb_free(gdb);
+    return NULL;
+  }
+
+  // Watchpoints are implemented by protecting the pages backing the devices
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &gdb_fault_handler;
+  action.sa_flags     = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &gdb_old_action);
+  gdb_page_size = (size_t) sysconf(_SC_PAGESIZE);
+  gdb_active = gdb;
+
+  gdb_settle(cpu);
+
+  return gdb;
+}
+
+/**
+ * Serves GDB requests until it detaches, kills the guest or disconnects.
+ * Returns true if the guest should keep running without the debugger.
+ */
+bool gdb_serve(gdb_t* gdb) {
+  bool keep_running = true;
+
+  while (gdb_read_packet(gdb) >= 0) {
+    if (!gdb_handle(gdb, &keep_running)) {
+      break;
+    }
+  }
+
+  return keep_running;
+}
+
+void gdb_free(gdb_t* gdb) {
+  if (gdb == NULL) {
+    return;
+  }
+
+  if (gdb_active == gdb) {
+    sigaction(SIGSEGV, &gdb_old_action, NULL);
+    gdb_active = NULL;
+  }
+  if (gdb->fd >= 0) {
+    close(gdb->fd);
+  }
+  if (gdb->listen_fd >= 0) {
+    close(gdb->listen_fd);
+  }
+  free(gdb);
+}
+
+/**
+ * Runs the pipeline until an instruction is ready to be executed,
+ * so that the address of the next instruction is known.
+ */
+static void gdb_settle(cpu_t* cpu) {
+  while (cpu->decoded_inst.type == EMPTY && !cpu_step(cpu)) {
+  }
+}
+
+/**
+ * Address of the instruction GDB sees as the pc
+ */
+static uint32_t gdb_pc(cpu_t* cpu) {
+  return cpu->decoded_pc;
+}
+
+static void gdb_set_pc(cpu_t* cpu, uint32_t pc) {
+  cpu->registers[15] = pc;
+  cpu_flush_pipeline(cpu);
+  gdb_settle(cpu);
+}
+
+static int gdb_hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Parses a big endian hex number, advancing the pointer past it
+ */
+static uint32_t gdb_parse_hex(const char** text) {
+  uint32_t value = 0;
+  int digit;
+
+  while ((digit = gdb_hex_value(**text)) >= 0) {
+    value = (value << 4) | (uint32_t) digit;
+    (*text)++;
+  }
+  return value;
+}
+
+/**
+ * Register values are sent in target (little endian) byte order
+ */
+static void gdb_put_word(char* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    sprintf(out + 2 * i, "%02x", (value >> (8 * i)) & 0xFF);
+  }
+}
+
+static uint32_t gdb_get_word(const char* in) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    int high = gdb_hex_value(in[2 * i]);
+    int low  = gdb_hex_value(in[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      break;
+    }
+    value |= (uint32_t) (high << 4 | low) << (8 * i);
+  }
+  return value;
+}
+
+/**
+ * Reads a character from GDB, -1 when the connection is closed
+ */
+static int gdb_getc(gdb_t* gdb) {
+  if (gdb->input_pos == gdb->input_len) {
+    ssize_t n = read(gdb->fd, gdb->input, sizeof(gdb->input));
+    if (n <= 0) {
+      return -1;
+    }
+    gdb->input_pos = 0;
+    gdb->input_len = (size_t) n;
+  }
+  return (unsigned char) gdb->input[gdb->input_pos++];
+}
+
+/**
+ * Reads the next packet into gdb->packet and acknowledges it.
+ * Returns the length of the packet, -1 when the connection is closed.
+ */
+static int gdb_read_packet(gdb_t* gdb) {
+  int c;
+
+  while (true) {
+    // Skip acknowledgements and interrupts while stopped
+    while ((c = gdb_getc(gdb)) != '$') {
+      if (c < 0) {
+        return -1;
+      }
+    }
+
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = gdb_getc(gdb)) != '#') {
+      if (c < 0) {
+        return -1;
+      }
+      if (len < GDB_PACKET_SIZE - 1) {
+        gdb->packet[len++] = (char) c;
+      }
+      sum += (uint8_t) c;
+    }
+    gdb->packet[len] = '\0';
+
+    int high = gdb_hex_value((char) gdb_getc(gdb));
+    int low  = gdb_hex_value((char) gdb_getc(gdb));
+
+    if (high >= 0 && low >= 0 && (high << 4 | low) == sum) {
+      write(gdb->fd, "+", 1);
+      return len;
+    }
+    write(gdb->fd, "-", 1);
+  }
+}
+
+static void gdb_send_packet(gdb_t* gdb, const char* data) {
+  char    frame[GDB_PACKET_SIZE + 4];
+  uint8_t sum = 0;
+  size_t  len = 0;
+
+  frame[len++] = '$';
+  for (const char* p = data; *p && len < GDB_PACKET_SIZE; p++) {
+    frame[len++] = *p;
+    sum += (uint8_t) *p;
+  }
+  len += (size_t) sprintf(frame + len, "#%02x", sum);
+
+  for (size_t sent = 0; sent < len; ) {
+    ssize_t n = write(gdb->fd, frame + sent, len - sent);
+    if (n <= 0) {
+      return;
+    }
+    sent += (size_t) n;
+  }
+}
+
+/**
+ * Handles the packet in gdb->packet.
+ * Returns false once the session is over.
+ */
+static bool gdb_handle(gdb_t* gdb, bool* keep_running) {
+  cpu_t*      cpu   = gdb->cpu;
+  char*       reply = gdb->reply;
+  const char* p     = gdb->packet + 1;
+  uint32_t    address, length, value;
+
+  reply[0] = '\0';
+
+  switch (gdb->packet[0]) {
+    case '?':
+      strcpy(reply, cpu->decoded_inst.type == HALT ? "W00" : "S05");
+      break;
+    case 'g':
+      // r0-r15, the eight FPA registers, fps and cpsr
+      for (int i = 0; i < 16; i++) {
+        gdb_put_word(reply + 8 * i, i == 15 ? gdb_pc(cpu) : cpu->registers[i]);
+      }
+      memset(reply + 128, '0', 8 * 24 + 8);
+      gdb_put_word(reply + 128 + 8 * 24 + 8, cpu->registers[16]);
+      reply[128 + 8 * 24 + 16] = '\0';
+      break;
+    case 'G':
+      if (strlen(p) >= 128) {
+        for (int i = 0; i < 15; i++) {
+          cpu->registers[i] = gdb_get_word(p + 8 * i);
+        }
+        if (strlen(p) >= 128 + 8 * 24 + 16) {
+          cpu_write_cpsr(cpu, gdb_get_word(p + 128 + 8 * 24 + 8));
+        }
+        value = gdb_get_word(p + 8 * 15);
+        if (value != gdb_pc(cpu)) {
+          gdb_set_pc(cpu, value);
+        }
+      }
+      strcpy(reply, "OK");
+      break;
+    case 'p':
+      address = gdb_parse_hex(&p);
+      if (address < 15) {
+        gdb_put_word(reply, cpu->registers[address]);
+      } else if (address == 15) {
+        gdb_put_word(reply, gdb_pc(cpu));
+      } else if (address == 25) {
+        gdb_put_word(reply, cpu->registers[16]);
+      } else if (address < 25) {
+        memset(reply, '0', address == 24 ? 8 : 24);
+        reply[address == 24 ? 8 : 24] = '\0';
+      } else {
+        strcpy(reply, "E01");
+      }
+      break;
+    case 'P':
+      address = gdb_parse_hex(&p);
+      value = gdb_get_word(*p == '=' ? p + 1 : p);
+      if (address < 15) {
+        cpu->registers[address] = value;
+      } else if (address == 15) {
+        gdb_set_pc(cpu, value);
+      } else if (address == 25) {
+        cpu_write_cpsr(cpu, value);
+      }
+      strcpy(reply, "OK");
+      break;
+    case 'm':
+      address = gdb_parse_hex(&p);
+      p++;
+      length = gdb_parse_hex(&p);
+      if (length > (GDB_PACKET_SIZE - 1) / 2) {
+        length = (GDB_PACKET_SIZE - 1) / 2;
+      }
+      for (uint32_t i = 0; i < length; i++) {
+        uint8_t* byte = gdb_byte(gdb, address + i);
+        if (byte == NULL) {
+          break;
+        }
+        sprintf(reply + 2 * i, "%02x", *byte);
+      }
+      if (reply[0] == '\0') {
+        strcpy(reply, "E01");
+      }
+      break;
+    case 'M':
+      address = gdb_parse_hex(&p);
+      p++;
+      length = gdb_parse_hex(&p);
+      p++;
+      strcpy(reply, "OK");
+      for (uint32_t i = 0; i < length && p[0] && p[1]; i++, p += 2) {
+        uint8_t* byte = gdb_byte(gdb, address + i);
+        if (byte == NULL) {
+          strcpy(reply, "E01");
+          break;
+        }
+        *byte = (uint8_t) (gdb_hex_value(p[0]) << 4 | gdb_hex_value(p[1]));
+        memory_t* device = gdb_device(gdb, address + i);
+        memory_mark_dirty(device, address + i - device->start, 1);
+      }
+      break;
+    case 'c':
+    case 's':
+      if (*p) {
+        gdb_set_pc(cpu, gdb_parse_hex(&p));
+      }
+      gdb_resume(gdb, gdb->packet[0] == 's');
+      break;
+    case 'Z':
+    case 'z': ;
+      bool insert = gdb->packet[0] == 'Z';
+      uint8_t type = (uint8_t) gdb_parse_hex(&p);
+      p++;
+      address = gdb_parse_hex(&p);
+      p++;
+      length = gdb_parse_hex(&p);
+
+      if (type <= 1) {
+        // Software and hardware breakpoints are the same thing here
+        if (insert && gdb->breakpointc < GDB_MAX_BREAKPOINTS) {
+          gdb->breakpoints[gdb->breakpointc++] = address;
+          strcpy(reply, "OK");
+        } else if (insert) {
+          strcpy(reply, "E01");
+        } else {
+          for (uint8_t i = 0; i < gdb->breakpointc; i++) {
+            if (gdb->breakpoints[i] == address) {
+              gdb->breakpoints[i] = gdb->breakpoints[--gdb->breakpointc];
+              break;
+            }
+          }
+          strcpy(reply, "OK");
+        }
+      } else if (type <= WATCH_ACCESS) {
+        if (gdb_device(gdb, address) == NULL) {
+          strcpy(reply, "E01");
+        } else if (insert && gdb->watchpointc < GDB_MAX_WATCHPOINTS) {
+          watchpoint_t* w = &gdb->watchpoints[gdb->watchpointc++];
+          w->address = address;
+          w->length  = length ? length : 1;
+          w->type    = type;
+          strcpy(reply, "OK");
+        } else if (insert) {
+          strcpy(reply, "E01");
+        } else {
+          for (uint8_t i = 0; i < gdb->watchpointc; i++) {
+            watchpoint_t* w = &gdb->watchpoints[i];
+            if (w->address == address && w->type == type) {
+              *w = gdb->watchpoints[--gdb->watchpointc];
+              break;
+            }
+          }
+          strcpy(reply, "OK");
+        }
+      }
+      break;
+    case 'q':
+      if (!strncmp(p, "Supported", 9)) {
+        sprintf(reply, "PacketSize=%x", GDB_PACKET_SIZE);
+      } else if (!strcmp(p, "Attached")) {
+        strcpy(reply, "1");
+      } else if (!strcmp(p, "fThreadInfo")) {
+        strcpy(reply, "m1");
+      } else if (!strcmp(p, "sThreadInfo")) {
+        strcpy(reply, "l");
+      } else if (!strcmp(p, "C")) {
+        strcpy(reply, "QC1");
+      } else if (!strncmp(p, "Rcmd,", 5)) {
+        gdb_monitor(gdb, p + 5);
+      }
+      break;
+    case 'H':
+      strcpy(reply, "OK");
+      break;
+    case 'D':
+      gdb_send_packet(gdb, "OK");
+      *keep_running = true;
+      return false;
+    case 'k':
+      *keep_running = false;
+      return false;
+    default:
+      break;
+  }
+
+  gdb_send_packet(gdb, reply);
+  return true;
+}
+
+/**
+ * Continues or single steps the guest and puts the stop reply in
+ * gdb->reply.
+ */
+static void gdb_resume(gdb_t* gdb, bool step) {
+  cpu_t*   cpu      = gdb->cpu;
+  bool     watching = gdb->watchpointc > 0;
+  uint32_t polled   = 0;
+
+  if (cpu->decoded_inst.type == HALT) {
+    strcpy(gdb->reply, "W00");
+    return;
+  }
+
+  gdb_protect(gdb, true);
+
+  while (true) {
+    if (watching) {
+      memcpy(gdb->saved_registers, cpu->registers, sizeof(uint32_t) * REG_NUM);
+      gdb->saved_inst = cpu->decoded_inst;
+      gdb->faulted = 0;
+    }
+
+    bool halted = cpu_step(cpu);
+    while (!halted && cpu->decoded_inst.type == EMPTY) {
+      halted = cpu_step(cpu);
+    }
+
+    if (watching && gdb->faulted) {
+      uint32_t address;
+      uint8_t  type;
+      bool     hit = gdb_watch_hit(gdb, &address, &type);
+
+      gdb_protect(gdb, true);
+      if (hit) {
+        sprintf(gdb->reply, "T05%swatch:%x;", type == WATCH_READ ? "r"
+            : type == WATCH_ACCESS ? "a" : "", address);
+        break;
+      }
+    }
+
+    if (halted) {
+      strcpy(gdb->reply, "W00");
+      break;
+    }
+
+    if (gdb->checkpoints != NULL
+        && cpu->instructions >= gdb->checkpoints->next) {
+      gdb_protect(gdb, false);
+      checkpoint_take(gdb->checkpoints);
+      gdb_protect(gdb, true);
+    }
+
+    if (step) {
+      strcpy(gdb->reply, "S05");
+      break;
+    }
+
+    bool breakpoint = false;
+    for (uint8_t i = 0; i < gdb->breakpointc; i++) {
+      breakpoint = breakpoint || gdb->breakpoints[i] == gdb_pc(cpu);
+    }
+    if (breakpoint) {
+      strcpy(gdb->reply, "S05");
+      break;
+    }
+
+    if (++polled == GDB_POLL_INTERVAL) {
+      polled = 0;
+      if (gdb_interrupted(gdb)) {
+        strcpy(gdb->reply, "S02");
+        break;
+      }
+    }
+  }
+
+  gdb_protect(gdb, false);
+}
+
+/**
+ * Runs a "monitor" command, given hex encoded. The output is sent as a
+ * console packet and the reply is left in gdb->reply.
+ */
+static void gdb_monitor(gdb_t* gdb, const char* hex) {
+  checkpoints_t* store = gdb->checkpoints;
+  char     command[GDB_PACKET_SIZE / 2];
+  char     text[GDB_PACKET_SIZE / 2 - 1];
+  size_t   len = 0;
+  uint32_t id;
+
+  while (hex[0] && hex[1] && len < sizeof(command) - 1) {
+    command[len++] = (char) (gdb_hex_value(hex[0]) << 4 | gdb_hex_value(hex[1]));
+    hex += 2;
+  }
+  command[len] = '\0';
+  text[0] = '\0';
+
+  if (store == NULL && !strncmp(command, "checkpoint", 10)) {
+    strcpy(text, "Checkpoints are off, run with -c <interval>.\n");
+  } else if (!strcmp(command, "checkpoint")) {
+    checkpoint_take(store);
+    checkpoint_t* c = &store->checkpoints[store->count - 1];
+    sprintf(text, "Checkpoint #%u at %llu instructions.\n", c->id,
+        (unsigned long long) c->instructions);
+  } else if (!strcmp(command, "checkpoints")) {
+    len = 0;
+    for (uint32_t i = 0; i < store->count; i++) {
+      checkpoint_t* c = &store->checkpoints[i];
+      int n = snprintf(text + len, sizeof(text) - len,
+          "#%u at %llu instructions, %u pages\n", c->id,
+          (unsigned long long) c->instructions, c->pagec);
+      if (n < 0 || (size_t) n >= sizeof(text) - len) {
+        text[len] = '\0';
+        break;
+      }
+      len += (size_t) n;
+    }
+  } else if (sscanf(command, "rewind-to %u", &id) == 1) {
+    if (store == NULL) {
+      strcpy(text, "Checkpoints are off, run with -c <interval>.\n");
+    } else if (checkpoint_rewind(store, id)) {
+      gdb_settle(gdb->cpu);
+      sprintf(text, "Rewound to #%u at %llu instructions.\n", id,
+          (unsigned long long) store->checkpoints[store->count - 1]
+          .instructions);
+    } else {
+      sprintf(text, "No checkpoint #%u.\n", id);
+    }
+  } else {
+    strcpy(text, "Commands: checkpoint, checkpoints, rewind-to <id>\n");
+  }
+
+  char* out = gdb->reply;
+  *out++ = 'O';
+  for (const char* c = text; *c; c++) {
+    out += sprintf(out, "%02x", (uint8_t) *c);
+  }
+  gdb_send_packet(gdb, gdb->reply);
+  strcpy(gdb->reply, "OK");
+}
+
+/**
+ * Checks whether GDB sent an interrupt (^C) while the guest was running
+ */
+static bool gdb_interrupted(gdb_t* gdb) {
+  struct pollfd pfd;
+  pfd.fd     = gdb->fd;
+  pfd.events = POLLIN;
+
+  if (gdb->input_pos == gdb->input_len && poll(&pfd, 1, 0) > 0) {
+    int c = gdb_getc(gdb);
+    if (c == 0x03) {
+      return true;
+    }
+    if (c >= 0) {
+      gdb->input_pos--;
+    }
+  }
+  return false;
+}
+
+/**
+ * Called after a protected page has been touched. Works out from the state
+ * before the last instruction whether it accessed a watched location.
+ */
+static bool gdb_watch_hit(gdb_t* gdb, uint32_t* address, uint8_t* type) {
+  cpu_t*     cpu  = gdb->cpu;
+  decoded_t* inst = &gdb->saved_inst;
+  uint32_t*  registers = cpu->registers;
+  flags_t*   flags     = cpu->flags;
+  uint32_t   low, high;
+  bool       write;
+
+  if (inst->type == SDT) {
+    write = !inst->fields.sdt.l;
+  } else if (inst->type == BDT) {
+    write = !inst->fields.bdt.l;
+  } else {
+    // The fault came from an instruction fetch
+    return false;
+  }
+
+  cpu->registers = gdb->saved_registers;
+  cpu->flags     = (flags_t *) &(gdb->saved_registers[16]);
+  bool transfer  = cpu_eval(cpu, inst->fields.generic.cond)
+      && cpu_transfer_range(cpu, inst, &low, &high);
+  cpu->registers = registers;
+  cpu->flags     = flags;
+
+  if (!transfer) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < gdb->watchpointc; i++) {
+    watchpoint_t* w = &gdb->watchpoints[i];
+    bool matches = w->type == WATCH_ACCESS || (w->type == WATCH_WRITE) == write;
+
+    if (matches && w->address < high && low < w->address + w->length) {
+      *address = w->address > low ? w->address : low;
+      *type    = w->type;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Protects (or releases) the host pages holding watched locations.
+ * Pages with write watchpoints stay readable, all others become
+ * inaccessible.
+ */
+static void gdb_protect(gdb_t* gdb, bool on) {
+  for (uint8_t i = 0; i < gdb->watchpointc; i++) {
+    watchpoint_t* w = &gdb->watchpoints[i];
+    memory_t* device = gdb_device(gdb, w->address);
+    uint32_t first = (w->address - device->start) / gdb_page_size;
+    uint32_t last  = (w->address + w->length - 1 - device->start)
+        / gdb_page_size;
+
+    for (uint32_t page = first; page <= last; page++) {
+      int prot = PROT_READ | PROT_WRITE;
+
+      for (uint8_t j = 0; on && j < gdb->watchpointc; j++) {
+        watchpoint_t* o = &gdb->watchpoints[j];
+        if (gdb_device(gdb, o->address) == device
+            && (o->address - device->start) / gdb_page_size <= page
+            && (o->address + o->length - 1 - device->start) / gdb_page_size
+                >= page) {
+          prot &= o->type == WATCH_WRITE ? PROT_READ : PROT_NONE;
+        }
+      }
+
+      mprotect(device->mem + page * gdb_page_size, gdb_page_size, prot);
+    }
+  }
+}
+
+/**
+ * Finds the device backing a single byte of the address space
+ */
+static memory_t* gdb_device(gdb_t* gdb, uint32_t address) {
+  cpu_t* cpu = gdb->cpu;
+
+  for (uint8_t i = 0; i < cpu->devicesc; i++) {
+    memory_t* device = cpu->devices[i];
+    if (address >= device->start && address - device->start < device->size) {
+      return device;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Debugger accesses bypass the device handlers
+ */
+static uint8_t* gdb_byte(gdb_t* gdb, uint32_t address) {
+  memory_t* device = gdb_device(gdb, address);
+  return device == NULL ? NULL : device->mem + (address - device->start);
+}
+
+static void gdb_fault_handler(int sig, siginfo_t* info, void* context) {
+  gdb_t*   gdb     = gdb_active;
+  uint8_t* address = info->si_addr;
+
+  for (uint8_t i = 0; gdb != NULL && i < gdb->cpu->devicesc; i++) {
+    memory_t* device = gdb->cpu->devices[i];
+    size_t mapped = (device->size + gdb_page_size - 1) / gdb_page_size
+        * gdb_page_size;
+
+    if (address >= device->mem && address < device->mem + mapped) {
+      // Let the access through, the watchpoints are checked and the
+      // protection restored once the instruction has finished
+      mprotect(device->mem, mapped, PROT_READ | PROT_WRITE);
+      gdb->faulted = 1;
+      return;
+    }
+  }
+
+  // A genuine crash: retry with the previous handler
+  sigaction(SIGSEGV, &gdb_old_action, NULL);
+}
@@ -0,0 +1,70 @@
+#ifndef HEADER_GDBSTUB
+#define HEADER_GDBSTUB
+
+#include "common.h"
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "checkpoint.h"
+
+#define GDB_PACKET_SIZE     4096
+#define GDB_MAX_BREAKPOINTS 64
+#define GDB_MAX_WATCHPOINTS 16
+
+/**
+ * Number of instructions run between checks for an interrupt from GDB
+ */
+#define GDB_POLL_INTERVAL   4096
+
+/**
+ * Watchpoint types, numbered as in the Z packets
+ */
+#define WATCH_WRITE  2
+#define WATCH_READ   3
+#define WATCH_ACCESS 4
+
+typedef struct {
+  uint32_t address;
+  uint32_t length;
+  uint8_t  type;
+} watchpoint_t;
+
+typedef struct {
+  cpu_t*       cpu;
+  int          listen_fd;
+  int          fd;
+
+  uint32_t     breakpoints[GDB_MAX_BREAKPOINTS];
+  uint8_t      breakpointc;
+  watchpoint_t watchpoints[GDB_MAX_WATCHPOINTS];
+  uint8_t      watchpointc;
+
+  // Taken while the guest runs and used by "monitor rewind-to", or NULL
+  checkpoints_t* checkpoints;
+
+  // Set by the fault handler when a protected page was touched
+  volatile sig_atomic_t faulted;
+
+  // State before the last instruction, to find out what it accessed
+  uint32_t     saved_registers[REG_NUM];
+  decoded_t    saved_inst;
+
+  char         packet[GDB_PACKET_SIZE];
+  char         reply[GDB_PACKET_SIZE];
+  char         input[GDB_PACKET_SIZE];
+  size_t       input_len;
+  size_t       input_pos;
+} gdb_t;
+
+gdb_t* gdb_init(cpu_t*, const char*);
+bool   gdb_serve(gdb_t*);
+void   gdb_free(gdb_t*);
+
+#endif
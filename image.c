@@ -0,0 +1,312 @@
+#include "image.h"
+
+static uint64_t image_hash(const uint8_t*, size_t);
+static image_t* image_find(uint64_t, const uint8_t*, size_t);
+static uint8_t  image_fusion(image_t*, uint32_t);
+static bool     image_alu(decoded_t*);
+static bool     image_compare(decoded_t*);
+static bool     image_transfer(decoded_t*);
+static bool     image_conditional_branch(decoded_t*);
+static int      image_backing(const uint8_t*, size_t);
+
+const char* const fuse_names[FUSE_KINDS] = {
+  [FUSE_NONE]             = "none",
+  [FUSE_ALU_CMP_BRANCH]   = "<op> cmp b<c>",
+  [FUSE_LOAD_CMP_BRANCH]  = "ldr cmp b<c>",
+  [FUSE_ALU_FLAGS_BRANCH] = "<op> <op>s b<c>",
+  [FUSE_CMP_BRANCH]       = "cmp b<c>",
+  [FUSE_FLAGS_BRANCH]     = "<op>s b<c>",
+  [FUSE_ALU_TRANSFER]     = "<op> ldr/str"
+};
+
+/**
+ * Images loaded so far. Machines load and free them on any thread, so the
+ * list and the users of its images are only touched under the lock.
+ */
+static image_t*        image_list = NULL;
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Reads the binary at path, or finds the image already loaded with the
+ * same contents. Returns NULL if it cannot be read.
+ */
+image_t* image_load(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Something went wrong while reading the file.\n");
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size_t size = (size_t) ftell(file);
+  rewind(file);
+
+  if (size % 4 != 0) {
+    fprintf(stderr,
+     "Error: The number of bytes in the binary is not divisible by 4.\n");
+    fclose(file);
+    return NULL;
+  }
+  if (size > RAM_SIZE) {
+    fprintf(stderr, "Error: The binary does not fit in memory.\n");
+    fclose(file);
+    return NULL;
+  }
+
+  uint8_t* contents = malloc(size + 1);
+  if (contents == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+  size_t got = fread(contents, 1, size, file);
+  fclose(file);
+  if (got != size) {
+    fprintf(stderr, "Error: Something went wrong while reading the file.\n");
+    free(contents);
+    return NULL;
+  }
+
+  uint64_t hash = image_hash(contents, size);
+  pthread_mutex_lock(&image_lock);
+  image_t* found = image_find(hash, contents, size);
+  pthread_mutex_unlock(&image_lock);
+  if (found != NULL) {
+    free(contents);
+    return found;
+  }
+
+  image_t* image = calloc(1, sizeof(image_t));
+  if (image == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  image->hash  = hash;
+  image->size  = (uint32_t) size;
+  image->users = 1;
+  image->fd    = -1;
+
+  if (size > 0) {
+    image->fd = image_backing(contents, size);
+    if (image->fd >= 0) {
+      image->words = mmap(NULL, size, PROT_READ, MAP_SHARED, image->fd, 0);
+    }
+    if (image->fd < 0 || image->words == MAP_FAILED) {
+      perror(IMAGE_DIR);
+      if (image->fd >= 0) {
+        close(image->fd);
+      }
+      free(image);
+      free(contents);
+      return NULL;
+    }
+
+    image->decoded = malloc((size / 4) * sizeof(decoded_t));
+    if (image->decoded == NULL) {
+      fprintf(stderr,"malloc failure");
+      exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < size / 4; i++) {
+      image->decoded[i] = instruction_decode(image->words[i]);
+    }
+
+    image->fusions = malloc(size / 4);
+    if (image->fusions == NULL) {
+      fprintf(stderr,"malloc failure");
+      exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < size / 4; i++) {
+      image->fusions[i] = image_fusion(image, i);
+    }
+  }
+
+  // Another thread may have loaded the same binary meanwhile
+  pthread_mutex_lock(&image_lock);
+  found = image_find(hash, contents, size);
+  if (found == NULL) {
+    image->next = image_list;
+    image_list  = image;
+  }
+  pthread_mutex_unlock(&image_lock);
+  free(contents);
+
+  if (found != NULL) {
+    image_free(image);
+    return found;
+  }
+  return image;
+}
+
+/**
+ * The image in the list with these contents, with one more user.
+ * Called under image_lock.
+ */
+static image_t* image_find(uint64_t hash, const uint8_t* contents,
+    size_t size) {
+  for (image_t* image = image_list; image != NULL; image = image->next) {
+    if (image->hash == hash && image->size == size
+        && (size == 0 || memcmp(image->words, contents, size) == 0)) {
+      image->users++;
+      return image;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Puts the image at the start of ram. Its pages are shared with every
+ * other instance until written to, or copied if they cannot be mapped.
+ * Over a slot of the RAM pool the mapping splits the huge page of the
+ * region into small ones: the footprint of many instances of one image
+ * is worth more than their TLB reach.
+ * Returns false if it does not fit.
+ */
+bool image_map(image_t* image, memory_t* ram) {
+  if (image->size > ram->size) {
+    return false;
+  }
+  if (image->size == 0) {
+    return true;
+  }
+
+  // The end of the last page, past the file, reads as zero
+  if (mmap(ram->mem, memory_mapped_size(image->size),
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image->fd, 0)
+      == MAP_FAILED) {
+    memcpy(ram->mem, image->words, image->size);
+  } else {
+    ram->mapped = true;
+  }
+  memory_mark_dirty(ram, 0, image->size);
+  return true;
+}
+
+/**
+ * Drops a user of the image, releasing it after the last one. The RAM it
+ * is mapped into keeps its pages.
+ */
+void image_free(image_t* image) {
+  if (image == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&image_lock);
+  bool last = --image->users == 0;
+  for (image_t** link = &image_list; last && *link != NULL;
+      link = &(*link)->next) {
+    if (*link == image) {
+      *link = image->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&image_lock);
+  if (!last) {
+    return;
+  }
+
+  if (image->size > 0) {
+    munmap(image->words, image->size);
+    close(image->fd);
+  }
+  free(image->decoded);
+  free(image->fusions);
+  free(image);
+}
+
+/**
+ * The superinstruction starting at word i, if any
+ */
+static uint8_t image_fusion(image_t* image, uint32_t i) {
+  uint32_t   words = image->size / 4;
+  decoded_t* run   = &image->decoded[i];
+
+  if (i + 2 < words && image_conditional_branch(&run[2])) {
+    if (image_alu(&run[0]) && image_compare(&run[1])) {
+      return FUSE_ALU_CMP_BRANCH;
+    }
+    if (image_transfer(&run[0]) && run[0].fields.sdt.l
+        && image_compare(&run[1])) {
+      return FUSE_LOAD_CMP_BRANCH;
+    }
+    if (image_alu(&run[0]) && image_alu(&run[1])
+        && run[1].fields.data_proc.s) {
+      return FUSE_ALU_FLAGS_BRANCH;
+    }
+  }
+
+  if (i + 1 < words && image_conditional_branch(&run[1])) {
+    if (image_compare(&run[0])) {
+      return FUSE_CMP_BRANCH;
+    }
+    if (image_alu(&run[0]) && run[0].fields.data_proc.s) {
+      return FUSE_FLAGS_BRANCH;
+    }
+  }
+
+  if (i + 1 < words && image_alu(&run[0]) && image_transfer(&run[1])) {
+    return FUSE_ALU_TRANSFER;
+  }
+  return FUSE_NONE;
+}
+
+/**
+ * Data processing that leaves the PC alone
+ */
+static bool image_alu(decoded_t* decoded) {
+  return decoded->type == PROC && decoded->fields.data_proc.r_d != 15;
+}
+
+static bool image_compare(decoded_t* decoded) {
+  return image_alu(decoded) && decoded->fields.data_proc.opcode >= OP_TST
+      && decoded->fields.data_proc.opcode <= OP_CMP;
+}
+
+/**
+ * A load or store that neither transfers nor writes back the PC
+ */
+static bool image_transfer(decoded_t* decoded) {
+  inst_sdt_t* sdt = &decoded->fields.sdt;
+  return decoded->type == SDT && sdt->r_d != 15
+      && (sdt->r_n != 15 || sdt->p);
+}
+
+static bool image_conditional_branch(decoded_t* decoded) {
+  return decoded->type == BRANCH
+      && decoded->fields.branch.cond != 0xE; // Not always
+}
+
+/**
+ * FNV-1a
+ */
+static uint64_t image_hash(const uint8_t* bytes, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * Writes the contents to an unlinked file in IMAGE_DIR.
+ * Returns its descriptor, or -1.
+ */
+static int image_backing(const uint8_t* contents, size_t size) {
+  char path[] = IMAGE_DIR "/" IMAGE_TEMPLATE;
+
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path);
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t put = write(fd, contents + done, size - done);
+    if (put <= 0) {
+      close(fd);
+      return -1;
+    }
+    done += (size_t) put;
+  }
+  return fd;
+}
@@ -0,0 +1,91 @@
+#ifndef HEADER_IMAGE
+#define HEADER_IMAGE
+
+#include "common.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "instruction.h"
+#include "memory.h"
+
+/**
+ * The shared copies of the images live in IMAGE_DIR, unlinked as soon as
+ * they are created
+ */
+#define IMAGE_DIR      "/dev/shm"
+#define IMAGE_TEMPLATE "armemu.image.XXXXXX"
+
+/**
+ * Superinstructions: runs of instructions cpu_loop executes as a single
+ * step. They are the pairs and triples that retired the most instructions
+ * over the benchmark guests (the loop benchmark, the profiling, DMA and
+ * timer interrupt guests), each guest weighted the same; the share is in
+ * brackets. ALU is data processing not writing the PC, FLAGS one setting
+ * the flags other than a compare, CMP a compare or test, LDR and STR
+ * transfers not involving the PC, B<c> a conditional branch.
+ *  - ALU_CMP_BRANCH:   ALU CMP B<c>       (16.7%)
+ *  - LOAD_CMP_BRANCH:  LDR CMP B<c>       (12.3%)
+ *  - ALU_FLAGS_BRANCH: ALU FLAGS B<c>     (8.5%)
+ *  - CMP_BRANCH:       CMP B<c>           (31.9%)
+ *  - FLAGS_BRANCH:     FLAGS B<c>         (16.1%)
+ *  - ALU_TRANSFER:     ALU LDR or ALU STR (16.8%)
+ * The first kind matching at a word is taken, triples before pairs.
+ */
+typedef enum {
+  FUSE_NONE,
+  FUSE_ALU_CMP_BRANCH,
+  FUSE_LOAD_CMP_BRANCH,
+  FUSE_ALU_FLAGS_BRANCH,
+  FUSE_CMP_BRANCH,
+  FUSE_FLAGS_BRANCH,
+  FUSE_ALU_TRANSFER,
+  FUSE_KINDS
+} fuse_t;
+
+#define FUSE_MAX_LENGTH 3
+
+static inline uint8_t fuse_length(uint8_t fusion) {
+  return fusion <= FUSE_ALU_FLAGS_BRANCH ? 3 : 2;
+}
+
+/**
+ * A binary loaded at address 0, shared by all the instances running it.
+ * Their RAM maps its pages copy-on-write, and they decode through its
+ * words predecoded once. Images are kept by the hash of their contents,
+ * so loading the same binary again, from any path, gives the same one.
+ */
+typedef struct image_struct {
+  uint64_t             hash;
+  uint32_t             size;
+  int                  fd;       // Copy of the binary backing the mappings
+  uint32_t*            words;    // Read only mapping of the copy
+  decoded_t*           decoded;  // One per word
+  uint8_t*             fusions;  // fuse_t of the run starting at a word
+  uint32_t             users;
+  struct image_struct* next;
+} image_t;
+
+extern const char* const fuse_names[FUSE_KINDS];
+
+image_t* image_load(const char*);
+bool     image_map(image_t*, memory_t*);
+void     image_free(image_t*);
+
+/**
+ * The decoded instruction at address, from the image if the word there
+ * is still the one loaded
+ */
+static inline decoded_t image_decode(image_t* image, uint32_t address,
+    uint32_t word) {
+  uint32_t i = address >> 2;
+
+  if (image != NULL && i < image->size >> 2 && (address & 3) == 0
+      && image->words[i] == word) {
+    return image->decoded[i];
+  }
+  return instruction_decode(word);
+}
+
+#endif
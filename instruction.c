@@ -23,7 +23,11 @@ decoded_t instruction_decode(uint32_t instruction) {
 
   switch (result.fields.generic.type_bits) { 
     case 0: // 00
-       if (result.fields.mult.magic == MULT_MAGIC) {
+       if ((instruction & MRS_MASK) == MRS_MAGIC
+           || (instruction & MSR_REG_MASK) == MSR_REG_MAGIC
+           || (instruction & MSR_IMM_MASK) == MSR_IMM_MAGIC) {
+         result.type = PSR;
+       } else if (result.fields.mult.magic == MULT_MAGIC) {
          result.type = MULT;
        } else {
          result.type = PROC;
@@ -39,6 +43,11 @@ decoded_t instruction_decode(uint32_t instruction) {
         result.type = BDT;
       }
       break;
+    case 3: // 11
+      if (result.fields.swi.magic == SWI_MAGIC) {
+        result.type = SWI;
+      }
+      break;
    default:break;
   }
 
@@ -18,6 +18,23 @@
 
 #define MULT_MAGIC 0x9
 #define BX_MAGIC   0x12FFF1
+#define SWI_MAGIC  0xF
+
+/**
+ * Status register transfers: the bits of MRS, MSR from a register and
+ * MSR from an immediate outside the register, mask and operand fields
+ */
+#define MRS_MASK      0x0FBF0FFF
+#define MRS_MAGIC     0x010F0000
+#define MSR_REG_MASK  0x0FB0FFF0
+#define MSR_REG_MAGIC 0x0120F000
+#define MSR_IMM_MASK  0x0FB0F000
+#define MSR_IMM_MAGIC 0x0320F000
+
+/**
+ * Hints, MSR immediates with an empty field mask
+ */
+#define HINT_WFI 0x3
 
 /**
  * Enum type describing the instruction types
@@ -29,6 +46,8 @@ typedef enum {
   BRANCH,      // Branch
   BX,          // Branch and exchange
   BDT,         // Block data transfer
+  PSR,         // Status register transfer and hints
+  SWI,         // Software interrupt
   HALT,        // Special state, halting the system
   EMPTY        // No instruction on the next iteration
 } inst_t;
@@ -105,6 +124,25 @@ typedef struct {
   uint32_t cond  :      4;
 } inst_bdt_t;
 
+typedef struct {
+  uint32_t op2    : 12;
+  uint32_t r_d    : 4;
+  uint32_t mask   : 4;    // MSR: control, extension, status, flags
+  uint32_t        : 1;
+  uint32_t msr    : 1;
+  uint32_t r      : 1;    // SPSR rather than CPSR
+  uint32_t        : 2;
+  uint32_t i      : 1;
+  uint32_t        : 2;
+  uint32_t cond   : 4;
+} inst_psr_t;
+
+typedef struct {
+  uint32_t comment : 24;
+  uint32_t magic   : 4;
+  uint32_t cond    : 4;
+} inst_swi_t;
+
 typedef struct {
   uint32_t i : 32;
 } inst_halt_t;
@@ -122,6 +160,8 @@ typedef struct {
     inst_sdt_t        sdt;
     inst_bdt_t        bdt;
     inst_mult_t       mult;
+    inst_psr_t        psr;
+    inst_swi_t        swi;
     inst_halt_t       halt;
     inst_generic_t    generic;
   } fields;
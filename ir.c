@@ -0,0 +1,737 @@
+#include "ir.h"
+
+static ir_block_t* ir_translate(ir_engine_t*, uint32_t);
+static void        ir_lift(ir_engine_t*, ir_op_t*, decoded_t, uint32_t);
+static bool        ir_ends_block(decoded_t*);
+static void        ir_eliminate_flags(ir_engine_t*, ir_block_t*);
+static void        ir_propagate(ir_engine_t*, ir_block_t*);
+static bool        ir_fold(uint8_t, uint32_t, uint32_t, uint32_t*);
+static void        ir_run_block(ir_engine_t*, ir_block_t*);
+static bool        ir_step(ir_engine_t*);
+static bool        ir_store_hits_code(ir_engine_t*, decoded_t*);
+static void        ir_count(cpu_t*, uint32_t);
+static uint32_t    ir_fetch(ir_engine_t*, uint32_t);
+static void        ir_fetched(ir_engine_t*, uint32_t);
+
+ir_engine_t* ir_init(cpu_t* cpu) {
+  ir_engine_t* ir = calloc(1, sizeof(ir_engine_t));
+  if (ir == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  ir->cpu        = cpu;
+  ir->slots      = cpu->ram->size >> 2;
+  ir->blocks     = calloc(ir->slots, sizeof(ir_block_t *));
+  ir->heat       = calloc(ir->slots, sizeof(uint16_t));
+  ir->code_pages = calloc((cpu->ram->size >> IR_PAGE_SHIFT) + 1,
+      sizeof(uint8_t));
+  if (ir->blocks == NULL || ir->heat == NULL || ir->code_pages == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  // Start where the pipeline would: nothing fetched yet
+  ir->pc       = cpu->registers[15];
+  ir->fetch_pc = ir->pc + 4;
+
+  return ir;
+}
+
+/**
+ * Runs the guest until HALT, using translated blocks for the hot regions
+ * and the cpu_execute_* handlers for the rest.
+ * Leaves the cpu in the same state as cpu_loop would.
+ */
+void ir_loop(ir_engine_t* ir) {
+  cpu_t* cpu = ir->cpu;
+
+  while (true) {
+    // Interrupts are taken between blocks, which stop at the next poll
+    ir_count(cpu, ir->flushed ? 2 : 1);
+    ir->flushed = false;
+    if (cpu->interrupts) {
+      cpu->decoded_pc = ir->pc;
+      if (cpu_interrupt(cpu)) {
+        ir->pc       = cpu->registers[15];
+        ir->fetch_pc = ir->pc + 4;
+        ir->has_word = false;
+        ir->flushed  = true;
+        continue;
+      }
+    }
+
+    // A DMA transfer, run by a poll here or a WFI, may have overwritten
+    // translated code
+    uint32_t dma_blocks = memory_read_unsafe(cpu->dma, DMA_COMPLETED);
+    if (dma_blocks != ir->dma_blocks) {
+      ir->dma_blocks = dma_blocks;
+      if (ir->has_code) {
+        ir_invalidate(ir);
+      }
+    }
+
+    uint32_t slot = ir->pc >> 2;
+    bool steady = ir->fetch_pc == ir->pc + 4 && (ir->pc & 3) == 0
+        && slot < ir->slots && !ir->has_word;
+
+    if (steady) {
+      ir_block_t* block = ir->blocks[slot];
+
+      if (block == NULL && ++ir->heat[slot] >= IR_HOT_THRESHOLD) {
+        block = ir_translate(ir, ir->pc);
+        ir->heat[slot] = 0;
+      }
+
+      if (block != NULL) {
+        ir_run_block(ir, block);
+        continue;
+      }
+    }
+
+    if (!ir_step(ir)) {
+      break;
+    }
+  }
+
+  // The HALT has been decoded and the word behind it fetched
+  cpu->registers[15] = ir->fetch_pc + 4;
+  cpu->decoded_inst.type = HALT;
+  cpu->decoded_inst.fields.instruction = 0;
+  cpu->has_instruction = true;
+}
+
+/**
+ * Executes a single instruction through the interpreter handlers.
+ * Returns false once the instruction to execute is a HALT.
+ */
+static bool ir_step(ir_engine_t* ir) {
+  cpu_t* cpu = ir->cpu;
+  decoded_t decoded = instruction_decode(ir->has_word ? ir->word
+      : memory_read(cpu->ram, ir->pc));
+
+  if (decoded.type == HALT) {
+    return false;
+  }
+
+  cpu->registers[15] = ir->fetch_pc + 4;
+  bool hits_code = ir_store_hits_code(ir, &decoded);
+  uint32_t fetched = ir_fetch(ir, ir->fetch_pc);
+
+  cpu->decoded_inst = decoded;
+  cpu->has_instruction = true;
+  cpu_execute(cpu);
+  cpu->instructions++;
+  ir->stats.stepped++;
+  bool halted = cpu->decoded_inst.type == HALT;
+
+  if (!cpu->has_instruction) {
+    ir->pc       = cpu->registers[15];
+    ir->fetch_pc = ir->pc + 4;
+    ir->has_word = false;
+    ir->flushed  = true;
+  } else {
+    ir->pc       = ir->fetch_pc;
+    ir->fetch_pc = cpu->registers[15];
+    ir_fetched(ir, fetched);
+  }
+
+  if (hits_code) {
+    ir_invalidate(ir);
+  }
+
+  return !halted;
+}
+
+/**
+ * Runs a translated block, up to the instruction the next poll is due
+ * before. A store into translated code leaves it at once: the instruction
+ * behind the store runs as it was fetched, and the ones after it as they
+ * are now, as in the pipeline.
+ */
+static void ir_run_block(ir_engine_t* ir, ir_block_t* block) {
+  cpu_t*    cpu = ir->cpu;
+  uint32_t* reg = cpu->registers;
+  bool      stale = false;
+  bool      left  = false;
+  bool      code;
+  uint32_t  fetched = 0;
+  uint16_t  k;
+
+  // Value of the last store, valid if it went to plain memory
+  uint32_t fwd_val   = 0;
+  bool     fwd_valid = false;
+
+  ir->stats.block_runs++;
+
+  for (k = 0; k < block->count && k < cpu->poll && !left; k++) {
+    ir_op_t*  op = &block->ops[k];
+    memory_t* device;
+    uint32_t  address;
+
+    reg[15] = op->pc + 8;
+    cpu->instructions++;
+
+    if (op->cond != COND_AL && !cpu_eval(cpu, op->cond)) {
+      if (op->op == IR_STORE) {
+        fwd_valid = false;
+      }
+      continue;
+    }
+
+    switch (op->op) {
+      case IR_NOP:
+        break;
+      case IR_MOVI:
+        reg[op->rd] = op->imm;
+        break;
+      case IR_ALU_IMM:
+        cpu->c_temp = op->c_in;
+        cpu_alu(cpu, op->alu, op->rd, op->rn, op->imm, op->s);
+        break;
+      case IR_ALU_REG:
+        cpu->c_temp = 0;
+        cpu_alu(cpu, op->alu, op->rd, op->rn,
+            get_not_immediate(cpu, op->op2, true), op->s);
+        break;
+      case IR_LOAD_FWD:
+        if (fwd_valid) {
+          reg[op->rd] = fwd_val;
+          cpu->events[PMU_LOADS]++;
+          break;
+        }
+        // Fall through to a normal load
+      case IR_LOAD:
+        address = op->addr_known ? op->imm : reg[op->rn] + op->imm;
+        device  = op->device;
+        if (device == NULL) {
+          device = address_decoder(cpu->devices, cpu->devicesc, address);
+        }
+        if (device == NULL) {
+          // Let the handler report the error
+          cpu->decoded_inst = op->decoded;
+          cpu_execute_sdt(cpu);
+          break;
+        }
+        reg[op->rd] = memory_read(device, address);
+        cpu->events[PMU_LOADS]++;
+        cpu->events[PMU_DEVICE] += device != cpu->ram;
+        break;
+      case IR_STORE:
+        address = op->addr_known ? op->imm : reg[op->rn] + op->imm;
+        device  = op->device;
+        if (device == NULL) {
+          device = address_decoder(cpu->devices, cpu->devicesc, address);
+        }
+        if (device == NULL) {
+          fwd_valid = false;
+          cpu->decoded_inst = op->decoded;
+          cpu_execute_sdt(cpu);
+          break;
+        }
+        code = device == cpu->ram
+            && ir->code_pages[address >> IR_PAGE_SHIFT];
+        if (code) {
+          fetched = ir_fetch(ir, op->pc + 4);
+        }
+        fwd_val   = reg[op->rd];
+        fwd_valid = memory_write(device, address, fwd_val)
+            && device->ops == NULL;
+        cpu->events[PMU_STORES]++;
+        cpu->events[PMU_DEVICE] += device != cpu->ram;
+
+        if (code) {
+          ir->pc       = op->pc + 4;
+          ir->fetch_pc = op->pc + 8;
+          ir_fetched(ir, fetched);
+          stale = true;
+          left  = true;
+        }
+        break;
+      case IR_BRANCH:
+        if (op->link) {
+          reg[14] = op->pc + 4;
+        }
+        ir->pc       = op->imm;
+        ir->fetch_pc = op->imm + 4;
+        ir->flushed  = true;
+        left = true;
+        cpu->events[PMU_BRANCHES]++;
+        cpu->events[PMU_FLUSHES]++;
+        break;
+      case IR_INTERP:
+        code = ir_store_hits_code(ir, &op->decoded);
+        if (code) {
+          fetched = ir_fetch(ir, op->pc + 4);
+          stale   = true;
+        }
+        fwd_valid = false;
+
+        cpu->decoded_inst = op->decoded;
+        cpu->has_instruction = true;
+        cpu_execute(cpu);
+
+        if (!cpu->has_instruction) {
+          ir->pc       = reg[15];
+          ir->fetch_pc = reg[15] + 4;
+          ir->flushed  = true;
+          left = true;
+        } else if (reg[15] != op->pc + 8 || code) {
+          // Written without a flush: the next instruction still runs
+          ir->pc       = op->pc + 4;
+          ir->fetch_pc = reg[15];
+          left = true;
+          if (code) {
+            ir_fetched(ir, fetched);
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // The first instruction was counted before the block was entered
+  cpu->poll -= k - 1;
+  if (!left) {
+    ir->pc       = k < block->count ? block->ops[k].pc : block->end;
+    ir->fetch_pc = ir->pc + 4;
+  }
+
+  if (stale) {
+    ir_invalidate(ir);
+  }
+}
+
+/**
+ * Lifts the region starting at start into a block and optimises it.
+ * Returns NULL if there is nothing to translate.
+ */
+static ir_block_t* ir_translate(ir_engine_t* ir, uint32_t start) {
+  memory_t* ram = ir->cpu->ram;
+  ir_block_t* block = malloc(sizeof(ir_block_t)
+      + IR_MAX_BLOCK * sizeof(ir_op_t));
+  if (block == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t pc = start;
+  uint16_t count = 0;
+
+  while (count < IR_MAX_BLOCK && pc <= ram->size - 4) {
+    uint32_t word = memory_read_unsafe(ram, pc);
+    if (word == 0) {
+      break;
+    }
+
+    decoded_t decoded = instruction_decode(word);
+    // Software interrupts are left to ir_step, they may be semihosting
+    // calls writing to RAM or stopping the guest
+    if (decoded.type == SWI) {
+      break;
+    }
+    ir_lift(ir, &block->ops[count], decoded, pc);
+    count++;
+    pc += 4;
+
+    if (ir_ends_block(&decoded)) {
+      break;
+    }
+  }
+
+  if (count == 0) {
+    free(block);
+    return NULL;
+  }
+
+  block = realloc(block, sizeof(ir_block_t) + count * sizeof(ir_op_t));
+  block->start = start;
+  block->end   = pc;
+  block->count = count;
+
+  ir_eliminate_flags(ir, block);
+  ir_propagate(ir, block);
+
+  for (uint32_t p = start >> IR_PAGE_SHIFT; p <= (pc - 4) >> IR_PAGE_SHIFT;
+      p++) {
+    ir->code_pages[p] = 1;
+  }
+  ir->has_code = true;
+  ir->blocks[start >> 2] = block;
+  ir->stats.translated++;
+
+  return block;
+}
+
+/**
+ * Whether the instruction may change the control flow
+ */
+static bool ir_ends_block(decoded_t* decoded) {
+  switch (decoded->type) {
+    case BRANCH:
+    case BX:
+      return true;
+    case PROC:
+      return decoded->fields.data_proc.r_d == 15;
+    case MULT:
+      return decoded->fields.mult.r_d == 15;
+    case SDT:
+      return (decoded->fields.sdt.l && decoded->fields.sdt.r_d == 15)
+          || (!decoded->fields.sdt.p && decoded->fields.sdt.r_n == 15);
+    case BDT:
+      return (decoded->fields.bdt.l
+          && get_bit(decoded->fields.bdt.reg_bits, 15))
+          || (decoded->fields.bdt.w && decoded->fields.bdt.r_n == 15);
+    default:
+      return true;
+  }
+}
+
+static void ir_lift(ir_engine_t* ir, ir_op_t* op, decoded_t decoded,
+    uint32_t pc) {
+  cpu_t* cpu = ir->cpu;
+
+  op->op         = IR_INTERP;
+  op->cond       = decoded.fields.generic.cond;
+  op->s          = false;
+  op->addr_known = false;
+  op->link       = false;
+  op->pc         = pc;
+  op->device     = NULL;
+  op->decoded    = decoded;
+
+  if (decoded.type == PROC) {
+    inst_data_proc_t* i = &decoded.fields.data_proc;
+    if (i->r_d == 15) {
+      return;
+    }
+
+    op->alu = i->opcode;
+    op->s   = i->s;
+    op->rd  = i->r_d;
+    op->rn  = i->r_n;
+
+    if (i->i) {
+      // Rotate once here instead of on every execution
+      uint32_t c_temp = cpu->c_temp;
+      cpu->c_temp = 0;
+      op->op   = IR_ALU_IMM;
+      op->imm  = rotate_right(cpu, get_bits(i->op2, 0, 7),
+          (uint8_t) (get_bits(i->op2, 8, 11) * 2));
+      op->c_in = cpu->c_temp;
+      cpu->c_temp = c_temp;
+    } else {
+      op->op  = IR_ALU_REG;
+      op->op2 = i->op2;
+    }
+  } else if (decoded.type == SDT) {
+    inst_sdt_t* i = &decoded.fields.sdt;
+    if (i->i || !i->p || i->r_d == 15) {
+      return;
+    }
+
+    op->op  = i->l ? IR_LOAD : IR_STORE;
+    op->rd  = i->r_d;
+    op->rn  = i->r_n;
+    op->imm = i->u ? i->offset : (uint32_t) -(int32_t) i->offset;
+  } else if (decoded.type == BRANCH) {
+    op->op   = IR_BRANCH;
+    op->link = decoded.fields.branch.l;
+    op->imm  = pc + 8 + cpu_branch_offset(&decoded.fields.branch);
+  }
+}
+
+/**
+ * Flags written by the operation, and the ones it is certain to overwrite
+ */
+static uint8_t ir_flags_written(ir_op_t* op, uint8_t* killed) {
+  uint8_t written = 0;
+  *killed = 0;
+
+  if (op->op == IR_ALU_IMM || op->op == IR_ALU_REG) {
+    written = op->s ? IR_FLAGS : 0;
+    *killed = written;
+  } else if (op->op == IR_INTERP && op->decoded.type == PROC) {
+    written = op->decoded.fields.data_proc.s ? IR_FLAGS : 0;
+    *killed = written;
+  } else if (op->op == IR_INTERP && op->decoded.type == MULT
+      && op->decoded.fields.mult.s) {
+    // Z is only ever set, never cleared
+    written = IR_FLAG_N | IR_FLAG_Z;
+    *killed = IR_FLAG_N;
+  }
+
+  if (op->cond != COND_AL) {
+    *killed = 0;
+  }
+  return written;
+}
+
+/**
+ * Backwards liveness pass over the flags. Flag updates overwritten before
+ * any condition reads them are dropped. All flags are live at the exit.
+ */
+static void ir_eliminate_flags(ir_engine_t* ir, ir_block_t* block) {
+  uint8_t live = IR_FLAGS;
+
+  for (int k = block->count - 1; k >= 0; k--) {
+    ir_op_t* op = &block->ops[k];
+    uint8_t killed;
+    uint8_t written = ir_flags_written(op, &killed);
+
+    if (written && !(written & live)) {
+      op->s = false;
+      if (op->decoded.type == PROC) {
+        op->decoded.fields.data_proc.s = 0;
+      } else if (op->decoded.type == MULT) {
+        op->decoded.fields.mult.s = 0;
+      }
+      ir->stats.flags_removed++;
+    } else {
+      live &= ~killed;
+    }
+
+    if (op->cond != COND_AL) {
+      live = IR_FLAGS;
+    }
+  }
+}
+
+/**
+ * Forward pass propagating register constants: immediate operations on
+ * known values are folded, transfer addresses resolved to their device
+ * and loads from the address just stored to forwarded.
+ */
+static void ir_propagate(ir_engine_t* ir, ir_block_t* block) {
+  cpu_t*   cpu = ir->cpu;
+  bool     known[16] = { false };
+  uint32_t value[16] = { 0 };
+
+  // Last store the following loads may be forwarded from
+  ir_op_t* store = NULL;
+
+  for (uint16_t k = 0; k < block->count; k++) {
+    ir_op_t* op = &block->ops[k];
+    int      written = -1;
+
+    known[15] = true;
+    value[15] = op->pc + 8;
+
+    switch (op->op) {
+      case IR_ALU_IMM:
+      case IR_ALU_REG: ;
+        uint8_t alu = op->alu;
+        bool has_result = ir_fold(alu, 0, 0, NULL);
+
+        if (!has_result && !op->s) {
+          op->op = IR_NOP;
+          ir->stats.ops_removed++;
+          break;
+        }
+        if (!has_result) {
+          break;
+        }
+
+        written = op->rd;
+        if (op->op == IR_ALU_IMM && op->cond == COND_AL && !op->s
+            && (alu == OP_MOV || known[op->rn])) {
+          uint32_t result;
+          ir_fold(alu, value[op->rn], op->imm, &result);
+          op->op  = IR_MOVI;
+          op->imm = result;
+          ir->stats.constants_folded++;
+        }
+        break;
+      case IR_LOAD:
+      case IR_STORE:
+        if (known[op->rn]) {
+          op->addr_known = true;
+          op->imm       += value[op->rn];
+          op->device     = address_decoder(cpu->devices, cpu->devicesc,
+              op->imm);
+          ir->stats.addresses_resolved++;
+        }
+
+        if (op->op == IR_STORE) {
+          store = op;
+          break;
+        }
+
+        if (store != NULL && store->cond == COND_AL
+            && store->addr_known == op->addr_known && store->imm == op->imm
+            && (op->addr_known || store->rn == op->rn)) {
+          op->op = IR_LOAD_FWD;
+          ir->stats.loads_forwarded++;
+        }
+        written = op->rd;
+        break;
+      case IR_INTERP:
+        for (int r = 0; r < 15; r++) {
+          known[r] = false;
+        }
+        store = NULL;
+        break;
+      default:
+        break;
+    }
+
+    if (written >= 0) {
+      known[written] = op->op == IR_MOVI;
+      value[written] = op->imm;
+      if (store != NULL && !store->addr_known && store->rn == written) {
+        store = NULL;
+      }
+    }
+  }
+}
+
+/**
+ * Computes the result of a data processing operation, as cpu_alu would.
+ * Returns false for the operations which are not folded.
+ */
+static bool ir_fold(uint8_t alu, uint32_t a, uint32_t b, uint32_t* result) {
+  uint32_t r;
+
+  switch (alu) {
+    case OP_AND: r = a & b; break;
+    case OP_EOR: r = a ^ b; break;
+    case OP_SUB: r = a - b; break;
+    case OP_RSB: r = b - a; break;
+    case OP_ADD: r = a + b; break;
+    case OP_ORR: r = a | b; break;
+    case OP_MOV: r = b;     break;
+    default:     return false;
+  }
+
+  if (result != NULL) {
+    *result = r;
+  }
+  return true;
+}
+
+/**
+ * Whether executing the instruction may store into translated code.
+ * Registers have to hold the values the instruction will see.
+ */
+static bool ir_store_hits_code(ir_engine_t* ir, decoded_t* decoded) {
+  cpu_t*    cpu = ir->cpu;
+  uint32_t  low, high;
+
+  if (!ir->has_code) {
+    return false;
+  }
+
+  // A semihosting read may go anywhere in RAM
+  if (decoded->type == SWI) {
+    return cpu->semihost != NULL
+        && decoded->fields.swi.comment == SEMIHOST_SWI;
+  }
+
+  bool load = decoded->type == SDT ? decoded->fields.sdt.l
+      : decoded->fields.bdt.l;
+  if (load || !cpu_transfer_range(cpu, decoded, &low, &high)) {
+    return false;
+  }
+
+  if (low >= cpu->ram->size) {
+    return false;
+  }
+  if (high > cpu->ram->size) {
+    high = cpu->ram->size;
+  }
+
+  for (uint32_t p = low >> IR_PAGE_SHIFT; p <= (high - 1) >> IR_PAGE_SHIFT;
+      p++) {
+    if (ir->code_pages[p]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Counts steps of the pipeline towards the next poll, running it once it
+ * is due, as cpu_step does: a step for each instruction, and one for
+ * refilling the pipeline after a flush
+ */
+static void ir_count(cpu_t* cpu, uint32_t steps) {
+  while (steps-- > 0) {
+    if (--cpu->poll == 0) {
+      cpu->poll = CPU_POLL_INTERVAL;
+      cpu_poll(cpu);
+    }
+  }
+}
+
+/**
+ * Word the pipeline fetches at the address, 0 outside of RAM
+ */
+static uint32_t ir_fetch(ir_engine_t* ir, uint32_t address) {
+  memory_t* ram = ir->cpu->ram;
+
+  if ((address & 3) != 0 || address > ram->size - 4) {
+    return 0;
+  }
+  return memory_read_unsafe(ram, address);
+}
+
+/**
+ * The instruction to run next was fetched as the given word: if it has
+ * been written since, that word is run rather than the one in RAM
+ */
+static void ir_fetched(ir_engine_t* ir, uint32_t word) {
+  ir->word     = word;
+  ir->has_word = word != ir_fetch(ir, ir->pc);
+}
+
+/**
+ * Drops every translated block
+ */
+void ir_invalidate(ir_engine_t* ir) {
+  for (uint32_t i = 0; i < ir->slots; i++) {
+    free(ir->blocks[i]);
+    ir->blocks[i] = NULL;
+  }
+  memset(ir->heat, 0, ir->slots * sizeof(uint16_t));
+  memset(ir->code_pages, 0, (ir->cpu->ram->size >> IR_PAGE_SHIFT) + 1);
+  ir->has_code = false;
+  ir->stats.invalidations++;
+}
+
+void ir_dump_stats(ir_engine_t* ir) {
+  ir_stats_t* s = &ir->stats;
+  fprintf(stderr, "Translation:\n");
+  fprintf(stderr, "blocks translated : %llu\n",
+      (unsigned long long) s->translated);
+  fprintf(stderr, "block runs        : %llu\n",
+      (unsigned long long) s->block_runs);
+  fprintf(stderr, "stepped           : %llu\n",
+      (unsigned long long) s->stepped);
+  fprintf(stderr, "invalidations     : %llu\n",
+      (unsigned long long) s->invalidations);
+  fprintf(stderr, "dead flag updates : %llu\n",
+      (unsigned long long) s->flags_removed);
+  fprintf(stderr, "removed ops       : %llu\n",
+      (unsigned long long) s->ops_removed);
+  fprintf(stderr, "folded constants  : %llu\n",
+      (unsigned long long) s->constants_folded);
+  fprintf(stderr, "resolved addresses: %llu\n",
+      (unsigned long long) s->addresses_resolved);
+  fprintf(stderr, "forwarded loads   : %llu\n",
+      (unsigned long long) s->loads_forwarded);
+}
+
+void ir_free(ir_engine_t* ir) {
+  if (ir == NULL) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < ir->slots; i++) {
+    free(ir->blocks[i]);
+  }
+  free(ir->blocks);
+  free(ir->heat);
+  free(ir->code_pages);
+  free(ir);
+}
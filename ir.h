@@ -0,0 +1,115 @@
+#ifndef HEADER_IR
+#define HEADER_IR
+
+#include "common.h"
+#include "cpu.h"
+#include "instruction.h"
+#include "memory.h"
+
+/**
+ * Number of times an address has to be reached before the region
+ * starting there is translated.
+ */
+#define IR_HOT_THRESHOLD 16
+
+/**
+ * Maximum number of guest instructions in a translated block
+ */
+#define IR_MAX_BLOCK 64
+
+/**
+ * Granularity of the translated code map (256 bytes), used to find
+ * blocks made stale by stores into code.
+ */
+#define IR_PAGE_SHIFT 8
+
+/**
+ * Flags written by an operation
+ */
+#define IR_FLAG_N 0x1
+#define IR_FLAG_Z 0x2
+#define IR_FLAG_C 0x4
+#define IR_FLAGS  (IR_FLAG_N | IR_FLAG_Z | IR_FLAG_C)
+
+typedef enum {
+  IR_NOP,       // Removed, e.g. a compare whose flags are never read
+  IR_MOVI,      // Register set to a constant known at translation time
+  IR_ALU_IMM,   // Data processing with a pre-rotated immediate
+  IR_ALU_REG,   // Data processing with a shifted register operand
+  IR_LOAD,      // ldr rd, [rn, #imm] without writeback
+  IR_LOAD_FWD,  // As IR_LOAD, value forwarded from the previous store
+  IR_STORE,     // str rd, [rn, #imm] without writeback
+  IR_BRANCH,    // b/bl to an address known at translation time
+  IR_INTERP     // Anything else, run by the cpu_execute_* handlers
+} ir_opcode_t;
+
+/**
+ * A single operation of the register based IR.
+ * The register numbers are the guest's, r15 always reads as pc + 8.
+ */
+typedef struct {
+  uint8_t    op;
+  uint8_t    cond;
+  uint8_t    alu;       // OP_* of the data processing operations
+  bool       s;         // Flags are live and have to be set
+  uint8_t    rd;
+  uint8_t    rn;
+  bool       addr_known; // imm holds the absolute address of a transfer
+  bool       link;
+  uint16_t   op2;       // Shifter operand of IR_ALU_REG
+  uint32_t   imm;       // Immediate, constant, offset, address or target
+  uint32_t   c_in;      // Carry produced by rotating the immediate
+  uint32_t   pc;        // Guest address of the instruction
+  memory_t*  device;    // Device resolved at translation time, or NULL
+  decoded_t  decoded;   // Original instruction, used as the slow path
+} ir_op_t;
+
+typedef struct {
+  uint32_t start;
+  uint32_t end;         // Address after the last instruction
+  uint16_t count;
+  ir_op_t  ops[];
+} ir_block_t;
+
+typedef struct {
+  uint64_t translated;
+  uint64_t invalidations;
+  uint64_t block_runs;
+  uint64_t stepped;
+  uint64_t flags_removed;
+  uint64_t ops_removed;
+  uint64_t constants_folded;
+  uint64_t addresses_resolved;
+  uint64_t loads_forwarded;
+} ir_stats_t;
+
+typedef struct {
+  cpu_t*       cpu;
+  ir_block_t** blocks;     // Indexed by the word address of the entry
+  uint16_t*    heat;
+  uint8_t*     code_pages;
+  uint32_t     slots;
+  bool         has_code;
+  uint32_t     dma_blocks; // DMA_COMPLETED as of the last poll
+
+  // Address of the next instruction to execute and of the one behind it.
+  // They only differ from pc, pc + 4 after a pc write without a flush.
+  uint32_t     pc;
+  uint32_t     fetch_pc;
+
+  // Instruction at pc as it was fetched, if a store has changed it since
+  uint32_t     word;
+  bool         has_word;
+
+  bool         flushed;    // The pipeline is to be refilled first
+
+  ir_stats_t   stats;
+} ir_engine_t;
+
+ir_engine_t* ir_init(cpu_t*);
+void         ir_loop(ir_engine_t*);
+void         ir_invalidate(ir_engine_t*);
+void         ir_dump_stats(ir_engine_t*);
+void         ir_free(ir_engine_t*);
+
+#endif
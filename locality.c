@@ -0,0 +1,342 @@
+#include "locality.h"
+
+static void     locality_access(locality_t*, uint32_t, bool);
+static void     locality_reuse(locality_t*, uint32_t);
+static void     locality_stride(locality_t*, uint32_t, uint32_t);
+static uint32_t locality_interval(locality_t*);
+static uint32_t locality_next(uint64_t*, uint32_t, uint64_t*, uint32_t*);
+
+static const char* stride_names[STRIDE_KINDS] = {
+  "zero", "unit", "constant", "irregular"
+};
+
+/**
+ * Counts one in rate data accesses, rate 0 being taken as 1
+ */
+locality_t* locality_init(cpu_t* cpu, uint32_t rate) {
+  locality_t* locality = calloc(1, sizeof(locality_t));
+  if (locality == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  locality->cpu       = cpu;
+  locality->rate      = rate ? rate : 1;
+  locality->seed      = 0x9E3779B9;
+  locality->countdown = locality_interval(locality);
+  locality->pagec     = memory_pages(cpu->ram);
+  locality->linec     = cpu->ram->size >> LOCALITY_LINE_SHIFT;
+  locality->slots     = cpu->ram->size >> 2;
+
+  locality->page_reads  = calloc(locality->pagec, sizeof(uint64_t));
+  locality->page_writes = calloc(locality->pagec, sizeof(uint64_t));
+  locality->lines       = calloc(locality->linec, sizeof(uint64_t));
+  locality->lru         = calloc(locality->linec, sizeof(uint32_t));
+  locality->seen        = calloc(locality->linec, sizeof(bool));
+  locality->pcs         = calloc(locality->slots, sizeof(locality_pc_t));
+  if (locality->page_reads == NULL || locality->page_writes == NULL
+      || locality->lines == NULL || locality->lru == NULL
+      || locality->seen == NULL || locality->pcs == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  return locality;
+}
+
+/**
+ * cpu_loop, recording the words every load and store is about to
+ * transfer
+ */
+void locality_loop(locality_t* locality) {
+  cpu_t* cpu = locality->cpu;
+
+  while (cpu->decoded_inst.type != HALT) {
+    decoded_t* inst = &cpu->decoded_inst;
+    uint32_t   low, high;
+
+    if ((inst->type == SDT || inst->type == BDT)
+        && cpu_eval(cpu, inst->fields.generic.cond)
+        && cpu_transfer_range(cpu, inst, &low, &high) && low < high) {
+      bool write = inst->type == SDT ? !inst->fields.sdt.l
+          : !inst->fields.bdt.l;
+
+      locality_stride(locality, cpu->decoded_pc, low);
+      for (uint32_t a = low; a < high; a += 4) {
+        locality_access(locality, a, write);
+      }
+    }
+
+    cpu_step(cpu);
+  }
+}
+
+static void locality_access(locality_t* locality, uint32_t address,
+    bool write) {
+  bool in_ram = address < locality->cpu->ram->size;
+
+  locality->accesses++;
+
+  if (--locality->countdown == 0) {
+    locality->countdown = locality_interval(locality);
+    locality->sampled++;
+    if (!in_ram) {
+      locality->device_accesses++;
+    } else {
+      uint64_t* pages = write ? locality->page_writes : locality->page_reads;
+      pages[address >> MEMORY_PAGE_SHIFT]++;
+      locality->lines[address >> LOCALITY_LINE_SHIFT]++;
+    }
+  }
+
+  if (in_ram) {
+    uint32_t line = address >> LOCALITY_LINE_SHIFT;
+    if ((line * 2654435761u) % locality->rate == 0) {
+      locality_reuse(locality, line);
+    }
+  }
+}
+
+/**
+ * Accesses until the next sample: 1 to 2 * rate - 1, rate on average
+ */
+static uint32_t locality_interval(locality_t* locality) {
+  if (locality->rate == 1) {
+    return 1;
+  }
+
+  // xorshift32
+  uint32_t x = locality->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  locality->seed = x;
+
+  return 1 + x % (2 * locality->rate - 1);
+}
+
+/**
+ * Moves line to the front of the LRU stack of sampled lines. Its depth
+ * there, scaled by the sampling rate, is the reuse distance.
+ */
+static void locality_reuse(locality_t* locality, uint32_t line) {
+  uint32_t* lru = locality->lru;
+  uint32_t  depth;
+
+  if (!locality->seen[line]) {
+    locality->seen[line] = true;
+    locality->cold++;
+    depth = locality->lru_count++;
+  } else {
+    for (depth = 0; lru[depth] != line; depth++) {
+    }
+
+    uint64_t distance = (uint64_t) depth * locality->rate;
+    uint32_t bucket = 0;
+    while (distance > 0 && bucket < LOCALITY_REUSE_BUCKETS - 1) {
+      distance >>= 1;
+      bucket++;
+    }
+    locality->reuse[bucket]++;
+  }
+
+  memmove(lru + 1, lru, depth * sizeof(uint32_t));
+  lru[0] = line;
+}
+
+static void locality_stride(locality_t* locality, uint32_t pc,
+    uint32_t address) {
+  if ((pc >> 2) >= locality->slots) {
+    return;
+  }
+
+  locality_pc_t* entry  = &locality->pcs[pc >> 2];
+  uint32_t       stride = address - entry->last;
+
+  if (entry->executions > 0) {
+    locality_stride_t kind;
+    if (stride == 0) {
+      kind = STRIDE_ZERO;
+    } else if (stride == 4 || stride == (uint32_t) -4) {
+      kind = STRIDE_UNIT;
+    } else if (entry->executions > 1 && stride == entry->stride) {
+      kind = STRIDE_CONSTANT;
+    } else {
+      kind = STRIDE_IRREGULAR;
+    }
+    entry->kinds[kind]++;
+    entry->stride = stride;
+  }
+
+  entry->last = address;
+  entry->executions++;
+}
+
+/**
+ * Index of the largest count after (*last, *index) in descending order,
+ * or count if there is none. Updates *last and *index to it.
+ */
+static uint32_t locality_next(uint64_t* counts, uint32_t count,
+    uint64_t* last, uint32_t* index) {
+  uint32_t best = count;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (counts[i] == 0 || counts[i] > *last
+        || (counts[i] == *last && i <= *index && *index != count)) {
+      continue;
+    }
+    if (best == count || counts[i] > counts[best]) {
+      best = i;
+    }
+  }
+
+  if (best != count) {
+    *last  = counts[best];
+    *index = best;
+  }
+  return best;
+}
+
+/**
+ * Prints the page and line histograms, the reuse distance distribution
+ * and the stride patterns of the busiest instructions
+ */
+void locality_report(locality_t* locality, FILE* out) {
+  static const char* glyphs = " .:-=+*#%@";
+  uint32_t per_glyph = (MEMORY_PAGE_SIZE >> LOCALITY_LINE_SHIFT) / 32;
+  uint64_t max_line  = 0;
+  uint64_t ram_total = locality->sampled - locality->device_accesses;
+
+  for (uint32_t i = 0; i < locality->linec; i++) {
+    max_line = locality->lines[i] > max_line ? locality->lines[i] : max_line;
+  }
+
+  fprintf(out, "data accesses     : %llu words\n",
+      (unsigned long long) locality->accesses);
+  fprintf(out, "sampled           : %llu, 1 in %u\n",
+      (unsigned long long) locality->sampled, locality->rate);
+  fprintf(out, "to devices        : %llu\n",
+      (unsigned long long) locality->device_accesses);
+
+  // One row per page used, each glyph a run of lines
+  fprintf(out, "%-10s %12s %12s %7s  lines (%u bytes per glyph)\n",
+      "page", "reads", "writes", "share", per_glyph * LOCALITY_LINE);
+  for (uint32_t page = 0; page < locality->pagec; page++) {
+    uint64_t used = locality->page_reads[page] + locality->page_writes[page];
+    if (used == 0) {
+      continue;
+    }
+
+    char     heat[33];
+    uint32_t first = page << (MEMORY_PAGE_SHIFT - LOCALITY_LINE_SHIFT);
+    for (uint32_t g = 0; g < 32; g++) {
+      uint64_t hottest = 0;
+      for (uint32_t l = 0; l < per_glyph; l++) {
+        uint32_t line = first + g * per_glyph + l;
+        if (line < locality->linec && locality->lines[line] > hottest) {
+          hottest = locality->lines[line];
+        }
+      }
+      heat[g] = glyphs[(hottest * 9 + max_line - 1) / max_line];
+    }
+    heat[32] = '\0';
+
+    fprintf(out, "0x%08x %12llu %12llu %6.2f%%  |%s|\n",
+        page << MEMORY_PAGE_SHIFT,
+        (unsigned long long) locality->page_reads[page],
+        (unsigned long long) locality->page_writes[page],
+        100.0 * (double) used / (double) ram_total, heat);
+  }
+
+  fprintf(out, "hottest lines:\n");
+  uint64_t last  = UINT64_MAX;
+  uint32_t index = locality->linec;
+  for (uint32_t shown = 0; shown < LOCALITY_REPORT_LINES; shown++) {
+    uint32_t line = locality_next(locality->lines, locality->linec, &last,
+        &index);
+    if (line == locality->linec) {
+      break;
+    }
+    fprintf(out, "  0x%08x %12llu\n", line << LOCALITY_LINE_SHIFT,
+        (unsigned long long) locality->lines[line]);
+  }
+
+  uint64_t reused = 0;
+  for (uint32_t b = 0; b < LOCALITY_REUSE_BUCKETS; b++) {
+    reused += locality->reuse[b];
+  }
+  fprintf(out, "reuse distance in lines, over 1 in %u lines (%llu cold "
+      "misses):\n", locality->rate, (unsigned long long) locality->cold);
+  uint64_t cumulative = 0;
+  for (uint32_t b = 0; b < LOCALITY_REUSE_BUCKETS; b++) {
+    if (locality->reuse[b] == 0) {
+      continue;
+    }
+    cumulative += locality->reuse[b];
+    uint64_t low = b == 0 ? 0 : 1ull << (b - 1);
+    if (b == LOCALITY_REUSE_BUCKETS - 1) {
+      fprintf(out, "  >= %-12llu", (unsigned long long) low);
+    } else {
+      fprintf(out, "  %5llu - %-5llu ", (unsigned long long) low,
+          (unsigned long long) (b == 0 ? 0 : (1ull << b) - 1));
+    }
+    fprintf(out, "%12llu %6.2f%% %6.2f%%\n",
+        (unsigned long long) locality->reuse[b],
+        100.0 * (double) locality->reuse[b] / (double) reused,
+        100.0 * (double) cumulative / (double) reused);
+  }
+
+  uint64_t  kinds[STRIDE_KINDS] = { 0 };
+  uint64_t  strided = 0;
+  uint64_t* executions = malloc(locality->slots * sizeof(uint64_t) + 1);
+  if (executions == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t slot = 0; slot < locality->slots; slot++) {
+    executions[slot] = locality->pcs[slot].executions;
+    for (uint32_t k = 0; k < STRIDE_KINDS; k++) {
+      kinds[k] += locality->pcs[slot].kinds[k];
+      strided  += locality->pcs[slot].kinds[k];
+    }
+  }
+
+  fprintf(out, "strides:");
+  for (uint32_t k = 0; k < STRIDE_KINDS; k++) {
+    fprintf(out, " %s %.2f%%", stride_names[k], strided
+        ? 100.0 * (double) kinds[k] / (double) strided : 0.0);
+  }
+  fprintf(out, "\n");
+
+  last  = UINT64_MAX;
+  index = locality->slots;
+  for (uint32_t shown = 0; shown < LOCALITY_REPORT_PCS; shown++) {
+    uint32_t slot = locality_next(executions, locality->slots, &last,
+        &index);
+    if (slot == locality->slots) {
+      break;
+    }
+
+    locality_pc_t* entry = &locality->pcs[slot];
+    uint32_t       most  = 0;
+    for (uint32_t k = 1; k < STRIDE_KINDS; k++) {
+      most = entry->kinds[k] > entry->kinds[most] ? k : most;
+    }
+    fprintf(out, "  0x%08x %12llu executions, mostly %s", slot << 2,
+        (unsigned long long) entry->executions, stride_names[most]);
+    if (most == STRIDE_CONSTANT) {
+      fprintf(out, " (%d bytes)", (int32_t) entry->stride);
+    }
+    fprintf(out, "\n");
+  }
+
+  free(executions);
+}
+
+void locality_free(locality_t* locality) {
+  free(locality->page_reads);
+  free(locality->page_writes);
+  free(locality->lines);
+  free(locality->lru);
+  free(locality->seen);
+  free(locality->pcs);
+  free(locality);
+}
@@ -0,0 +1,89 @@
+#ifndef HEADER_LOCALITY
+#define HEADER_LOCALITY
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "instruction.h"
+#include "memory.h"
+
+/**
+ * Granularity of the line histogram and of the reuse distances,
+ * the L1 line size
+ */
+#define LOCALITY_LINE_SHIFT 5
+#define LOCALITY_LINE       (1 << LOCALITY_LINE_SHIFT)
+
+/**
+ * Buckets of the reuse distance histogram: 0, 1, 2-3, 4-7, ... and the
+ * last one for everything further
+ */
+#define LOCALITY_REUSE_BUCKETS 16
+
+/**
+ * Number of lines and instructions listed in the report
+ */
+#define LOCALITY_REPORT_LINES 10
+#define LOCALITY_REPORT_PCS   5
+
+typedef enum {
+  STRIDE_ZERO,      // Same address as last time
+  STRIDE_UNIT,      // The next or previous word
+  STRIDE_CONSTANT,  // Same stride as last time
+  STRIDE_IRREGULAR,
+  STRIDE_KINDS
+} locality_stride_t;
+
+/**
+ * Last access of a data transfer instruction, by word address of the pc
+ */
+typedef struct {
+  uint32_t last;
+  uint32_t stride;
+  uint64_t executions;
+  uint64_t kinds[STRIDE_KINDS];
+} locality_pc_t;
+
+/**
+ * Where the guest's loads and stores go. One in rate words transferred,
+ * at jittered intervals so that regular access patterns do not alias
+ * with the sampling, is counted in the page and line histograms.
+ * Reuse distances, the number of distinct lines touched between two
+ * accesses to a line, are measured on the lines whose hash is a multiple
+ * of rate, as in SHARDS, and scaled back up. Strides are followed on
+ * every execution as they cost next to nothing.
+ */
+typedef struct {
+  cpu_t*         cpu;
+  uint32_t       rate;
+  uint32_t       countdown;
+  uint32_t       seed;
+
+  uint32_t       pagec;
+  uint64_t*      page_reads;
+  uint64_t*      page_writes;
+  uint32_t       linec;
+  uint64_t*      lines;
+  uint64_t       device_accesses;
+
+  // Sampled lines, most recently used first, for the reuse distances
+  uint32_t*      lru;
+  uint32_t       lru_count;
+  bool*          seen;
+  uint64_t       reuse[LOCALITY_REUSE_BUCKETS];
+  uint64_t       cold;
+
+  locality_pc_t* pcs;
+  uint32_t       slots;
+
+  uint64_t       accesses;
+  uint64_t       sampled;
+} locality_t;
+
+locality_t* locality_init(cpu_t*, uint32_t);
+void        locality_loop(locality_t*);
+void        locality_report(locality_t*, FILE*);
+void        locality_free(locality_t*);
+
+#endif
@@ -0,0 +1,582 @@
+#include "lockstep.h"
+
+static uint32_t lockstep_eval(lockstep_t*, uint8_t);
+static bool     lockstep_vector(lockstep_t*, decoded_t*, uint32_t);
+static bool     lockstep_shiftable(uint32_t);
+static void     lockstep_shift(lockstep_t*, uint32_t, lockstep_vec_t*,
+    lockstep_vec_t*);
+static void     lockstep_alu(lockstep_t*, inst_data_proc_t*, uint32_t);
+static bool     lockstep_transfer(lockstep_t*, inst_sdt_t*, uint32_t);
+static void     lockstep_branch(lockstep_t*, inst_branch_t*, uint32_t);
+static void     lockstep_scalar(lockstep_t*, decoded_t*);
+static void     lockstep_retire(lockstep_t*, uint32_t, uint32_t, uint32_t);
+static bool     lockstep_hint(decoded_t*);
+static void     lockstep_poll(lockstep_t*);
+static void     lockstep_tick(cpu_t*);
+
+/**
+ * Groups up to LOCKSTEP_LANES freshly loaded cpus
+ */
+lockstep_t* lockstep_init(cpu_t** cpus, uint32_t count) {
+  lockstep_t* ls = calloc(1, sizeof(lockstep_t));
+  if (ls == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  ls->lanes = count < LOCKSTEP_LANES ? count : LOCKSTEP_LANES;
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    ls->cpus[l] = cpus[l];
+    for (uint32_t r = 0; r < REG_NUM; r++) {
+      ls->registers[r][l] = cpus[l]->registers[r];
+    }
+    ls->active |= 1u << l;
+  }
+  for (uint32_t l = 0; l < LOCKSTEP_LANES; l++) {
+    ls->lane_bits[l] = 1u << l;
+  }
+
+  // Start where the pipeline would: nothing fetched yet
+  ls->pc       = cpus[0]->registers[15];
+  ls->fetch_pc = ls->pc + 4;
+
+  return ls;
+}
+
+/**
+ * Runs the group until HALT, then lets the lanes that left it finish on
+ * their own. Leaves every cpu as cpu_loop would.
+ */
+void lockstep_loop(lockstep_t* ls) {
+  while (ls->active) {
+    cpu_t*   lead = ls->cpus[__builtin_ctz(ls->active)];
+    uint32_t pc   = ls->pc;
+
+    if ((pc & 3) || pc > lead->ram->size - 4) {
+      // Let the interpreter report it
+      for (uint32_t l = 0; l < ls->lanes; l++) {
+        if (ls->active & (1u << l)) {
+          lockstep_retire(ls, l, pc, ls->fetch_pc);
+        }
+      }
+      break;
+    }
+
+    // Lanes whose code differs cannot follow the same stream
+    uint32_t word = memory_read_unsafe(lead->ram, pc);
+    for (uint32_t l = 0; l < ls->lanes; l++) {
+      if ((ls->active & (1u << l))
+          && memory_read_unsafe(ls->cpus[l]->ram, pc) != word) {
+        lockstep_retire(ls, l, pc, ls->fetch_pc);
+        ls->stats.divergences++;
+      }
+    }
+
+    // Exceptions are left to the interpreter. Hints, WFI among them, run
+    // on each lane.
+    decoded_t decoded = instruction_decode(word);
+    if (decoded.type == HALT || decoded.type == SWI
+        || (decoded.type == PSR && !lockstep_hint(&decoded))) {
+      for (uint32_t l = 0; l < ls->lanes; l++) {
+        if (ls->active & (1u << l)) {
+          lockstep_retire(ls, l, pc, ls->fetch_pc);
+        }
+      }
+      break;
+    }
+
+    lockstep_poll(ls);
+    if (!ls->active) {
+      break;
+    }
+
+    uint32_t run = lockstep_eval(ls, decoded.fields.generic.cond);
+    ls->stats.instructions++;
+
+    if (lockstep_vector(ls, &decoded, run)) {
+      ls->pc        = ls->fetch_pc;
+      ls->fetch_pc += 4;
+      ls->stats.vector_ops++;
+    } else if (decoded.type == BRANCH) {
+      lockstep_branch(ls, &decoded.fields.branch, run);
+    } else {
+      lockstep_scalar(ls, &decoded);
+      ls->stats.scalar_ops++;
+    }
+  }
+
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    cpu_loop(ls->cpus[l]);
+  }
+}
+
+/**
+ * MSR with no fields: WFI, or a hint that does nothing
+ */
+static bool lockstep_hint(decoded_t* decoded) {
+  return decoded->type == PSR && decoded->fields.psr.msr
+      && decoded->fields.psr.mask == 0;
+}
+
+/**
+ * What cpu_step does on each lane before executing: polls the devices on
+ * the lane's countdown, and counts the instruction. A lane with an
+ * interrupt its CPSR lets through leaves the group to take it instead.
+ */
+static void lockstep_poll(lockstep_t* ls) {
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    if (!(ls->active & (1u << l))) {
+      continue;
+    }
+
+    cpu_t*   cpu   = ls->cpus[l];
+    flags_t* flags = (flags_t *) &ls->registers[16][l];
+
+    lockstep_tick(cpu);
+    if (((cpu->interrupts & INTC_FIQ) && !flags->f)
+        || ((cpu->interrupts & INTC_IRQ) && !flags->i)) {
+      // cpu_step counts this cycle down again
+      cpu->poll++;
+      lockstep_retire(ls, l, ls->pc, ls->fetch_pc);
+      continue;
+    }
+    cpu->instructions++;
+  }
+}
+
+/**
+ * One cycle of cpu_step's countdown to the next poll
+ */
+static void lockstep_tick(cpu_t* cpu) {
+  if (--cpu->poll == 0) {
+    cpu->poll = CPU_POLL_INTERVAL;
+    cpu_poll(cpu);
+  }
+}
+
+/**
+ * cpu_eval for every lane. Returns the active lanes passing the condition.
+ */
+static uint32_t lockstep_eval(lockstep_t* ls, uint8_t condition) {
+  lockstep_vec_t cpsr, pass, bits;
+
+  if (condition == COND_AL) {
+    return ls->active;
+  }
+
+  memcpy(&cpsr, ls->registers[16], sizeof(cpsr));
+  memcpy(&bits, ls->lane_bits, sizeof(bits));
+
+  lockstep_vec_t n = (cpsr >> 31) & 1;
+  lockstep_vec_t z = (cpsr >> 30) & 1;
+  lockstep_vec_t c = (cpsr >> 29) & 1;
+  lockstep_vec_t v = (cpsr >> 28) & 1;
+
+  switch (condition) {
+    case COND_EQ: pass = z;                        break;
+    case COND_NE: pass = z ^ 1;                    break;
+    case COND_CS: pass = c;                        break;
+    case COND_CC: pass = c ^ 1;                    break;
+    case COND_MI: pass = n;                        break;
+    case COND_PL: pass = n ^ 1;                    break;
+    case COND_VS: pass = v;                        break;
+    case COND_VC: pass = v ^ 1;                    break;
+    case COND_HI: pass = c & (z ^ 1);              break;
+    case COND_LS: pass = (c ^ 1) | z;              break;
+    case COND_GE: pass = (n ^ v) ^ 1;              break;
+    case COND_LT: pass = n ^ v;                    break;
+    case COND_GT: pass = (z ^ 1) & ((n ^ v) ^ 1);  break;
+    case COND_LE: pass = z | (n ^ v);              break;
+    default:      pass = z & 0;                    break;
+  }
+
+  // Each lane contributes its own bit, or nothing
+  lockstep_vec_t set = bits & -pass;
+  uint32_t mask = 0;
+  for (uint32_t l = 0; l < LOCKSTEP_LANES; l++) {
+    mask |= set[l];
+  }
+  return mask & ls->active;
+}
+
+/**
+ * Runs the instruction on the lanes in run as vector operations, if it is
+ * data processing not writing the pc, or a load or store of RAM, either
+ * with an immediate operand or a register shifted by a constant.
+ * Returns false, having done nothing, for the other instructions.
+ */
+static bool lockstep_vector(lockstep_t* ls, decoded_t* decoded,
+    uint32_t run) {
+  if (decoded->type == PROC) {
+    inst_data_proc_t* inst = &decoded->fields.data_proc;
+    if (inst->r_d == 15 || !(inst->i || lockstep_shiftable(inst->op2))) {
+      return false;
+    }
+    if (run) {
+      lockstep_alu(ls, inst, run);
+    }
+    return true;
+  }
+
+  if (decoded->type == SDT) {
+    inst_sdt_t* inst = &decoded->fields.sdt;
+    uint32_t    r_m  = inst->offset & 0xF;
+
+    // cpu_execute_sdt reports these, the checks on r_m applying to the
+    // low bits of an immediate offset too
+    if (inst->r_d == 15 || (inst->r_n == 15 && !inst->p)
+        || (inst->i ? !lockstep_shiftable(inst->offset)
+            : r_m == 15 || (!inst->p && r_m == inst->r_n))) {
+      return false;
+    }
+    return lockstep_transfer(ls, inst, run);
+  }
+  return false;
+}
+
+/**
+ * A register operand shifted by a constant, apart from ROR #0
+ */
+static bool lockstep_shiftable(uint32_t operand) {
+  return !(operand & 0x10) && (get_bits(operand, 5, 6) != SHFT_ROR
+      || get_bits(operand, 7, 11) != 0);
+}
+
+/**
+ * get_not_immediate on every lane into value, adding the carry out of the
+ * shift to c as it adds it to c_temp
+ */
+static void lockstep_shift(lockstep_t* ls, uint32_t operand,
+    lockstep_vec_t* value, lockstep_vec_t* c) {
+  lockstep_vec_t v, m;
+  lockstep_vec_t zero = { 0 };
+  uint32_t       r_m  = operand & 0xF;
+  uint32_t       n    = get_bits(operand, 7, 11);
+
+  if (r_m == 15) {
+    v = zero + (ls->fetch_pc + 4);
+  } else {
+    memcpy(&v, ls->registers[r_m], sizeof(v));
+  }
+
+  switch (get_bits(operand, 5, 6)) {
+    case SHFT_LSL:
+      if (n > 0) {
+        *c += (v >> (32 - n)) & 0xFF;
+        v <<= n;
+      }
+      break;
+    case SHFT_LSR:
+      if (n > 0) {
+        *c += v & (0xFFFFFFFFu >> (32 - n)) & 0xFF;
+        v >>= n;
+      }
+      break;
+    case SHFT_ASR:
+      // Negative values come out negated unless they shift to zero
+      m = -(v >> 31);
+      if (n > 0) {
+        *c += (v >> (32 - n)) & 0xFF;
+        v >>= n;
+      }
+      m &= (lockstep_vec_t) (v != 0);
+      v  = (v & ~m) | (-v & m);
+      break;
+    default:
+      *c += v & (0xFFFFFFFFu >> (31 - n)) & 0xFF;
+      v   = (v >> n) | (v << (32 - n));
+      break;
+  }
+  *value = v;
+}
+
+/**
+ * cpu_execute_proc on the lanes in run, carry quirks included
+ */
+static void lockstep_alu(lockstep_t* ls, inst_data_proc_t* inst,
+    uint32_t run) {
+  lockstep_vec_t a, b, r, old, bits;
+  lockstep_vec_t zero = { 0 };
+  lockstep_vec_t c    = zero;
+  uint32_t       r15  = ls->fetch_pc + 4;
+  bool           writes = true;
+
+  if (inst->i) {
+    cpu_t* lead = ls->cpus[__builtin_ctz(ls->active)];
+    lead->c_temp = 0;
+    b = zero + rotate_right(lead, get_bits(inst->op2, 0, 7),
+        (uint8_t) (get_bits(inst->op2, 8, 11) * 2));
+    c = zero + lead->c_temp;
+  } else {
+    lockstep_shift(ls, inst->op2, &b, &c);
+  }
+
+  if (inst->r_n == 15) {
+    a = zero + r15;
+  } else {
+    memcpy(&a, ls->registers[inst->r_n], sizeof(a));
+  }
+
+  switch (inst->opcode) {
+    case OP_AND:
+      r = a & b;
+      break;
+    case OP_EOR:
+      r = a ^ b;
+      break;
+    case OP_SUB:
+      r = a - b;
+      c = (lockstep_vec_t) ((r < a) != (b > 0)) + 1;
+      break;
+    case OP_RSB:
+      r = b - a;
+      c = (lockstep_vec_t) ((r < a) != (b > 0)) + 1;
+      break;
+    case OP_ADD:
+      r = a + b;
+      c -= (lockstep_vec_t) (r < a);
+      break;
+    case OP_TST:
+      r = a & b;
+      writes = false;
+      break;
+    case OP_TEQ:
+      r = a ^ b;
+      writes = false;
+      break;
+    case OP_CMP:
+      r = a - b;
+      c = (lockstep_vec_t) ((r < a) != (b > 0)) + 1;
+      writes = false;
+      break;
+    case OP_ORR:
+      r = a | b;
+      break;
+    case OP_MOV:
+      r = b;
+      break;
+    default:
+      r = zero;
+      writes = false;
+      break;
+  }
+
+  // All ones in the lanes to update
+  memcpy(&bits, ls->lane_bits, sizeof(bits));
+  lockstep_vec_t m = (lockstep_vec_t) ((bits & run) != 0);
+
+  if (writes) {
+    memcpy(&old, ls->registers[inst->r_d], sizeof(old));
+    old = (r & m) | (old & ~m);
+    memcpy(ls->registers[inst->r_d], &old, sizeof(old));
+  }
+
+  if (inst->s) {
+    lockstep_vec_t cpsr;
+    memcpy(&cpsr, ls->registers[16], sizeof(cpsr));
+
+    lockstep_vec_t flags = (r & 0x80000000u)
+        | (((lockstep_vec_t) (r == 0) & 1) << 30)
+        | (((lockstep_vec_t) (c > 0) & 1) << 29);
+    flags |= cpsr & 0x1FFFFFFFu;
+
+    cpsr = (flags & m) | (cpsr & ~m);
+    memcpy(ls->registers[16], &cpsr, sizeof(cpsr));
+  }
+}
+
+/**
+ * cpu_execute_sdt on the lanes in run, the addresses computed for all of
+ * them at once. Each lane then loads or stores its own word.
+ * Returns false, having done nothing, if a lane's address is not in its
+ * RAM or the store would not fit there.
+ */
+static bool lockstep_transfer(lockstep_t* ls, inst_sdt_t* inst,
+    uint32_t run) {
+  lockstep_vec_t base, offset, address;
+  lockstep_vec_t zero = { 0 };
+  lockstep_vec_t c    = zero;
+
+  if (inst->i) {
+    lockstep_shift(ls, inst->offset, &offset, &c);
+  } else {
+    offset = zero + inst->offset;
+  }
+  if (!inst->u) {
+    offset = -offset;
+  }
+  if (inst->r_n == 15) {
+    base = zero + (ls->fetch_pc + 4);
+  } else {
+    memcpy(&base, ls->registers[inst->r_n], sizeof(base));
+  }
+  address = inst->p ? base + offset : base;
+
+  // As address_decoder and memory_write would check them
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    uint32_t size = ls->cpus[l]->ram->size;
+    if ((run & (1u << l)) && (address[l] > size - 4
+        || (!inst->l && address[l] + 3 > size - 4))) {
+      return false;
+    }
+  }
+
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    if (!(run & (1u << l))) {
+      continue;
+    }
+
+    cpu_t* cpu = ls->cpus[l];
+    if (cpu->stats != NULL) {
+      stats_access(cpu->stats, cpu->ram, !inst->l, 1);
+    }
+    if (inst->l) {
+      cpu->events[PMU_LOADS]++;
+      ls->registers[inst->r_d][l] = memory_read(cpu->ram, address[l]);
+    } else {
+      cpu->events[PMU_STORES]++;
+      memory_write(cpu->ram, address[l], ls->registers[inst->r_d][l]);
+    }
+    if (!inst->p) {
+      ls->registers[inst->r_n][l] += offset[l];
+    }
+  }
+  return true;
+}
+
+/**
+ * A branch taken by some lanes only splits the group: the lanes going
+ * the other way from the first active lane leave it. The lanes taking it
+ * count down the cycle cpu_step spends refilling the pipeline.
+ */
+static void lockstep_branch(lockstep_t* ls, inst_branch_t* inst,
+    uint32_t run) {
+  uint32_t r15    = ls->fetch_pc + 4;
+  uint32_t target = r15 + cpu_branch_offset(inst);
+  uint32_t lead   = 1u << __builtin_ctz(ls->active);
+
+  if (run != 0 && run != ls->active) {
+    for (uint32_t l = 0; l < ls->lanes; l++) {
+      uint32_t bit = 1u << l;
+      if (!(ls->active & bit) || !(run & bit) == !(run & lead)) {
+        continue;
+      }
+      if (run & bit) {
+        if (inst->l) {
+          ls->registers[14][l] = r15 - 4;
+        }
+        ls->cpus[l]->events[PMU_BRANCHES]++;
+        ls->cpus[l]->events[PMU_FLUSHES]++;
+        lockstep_tick(ls->cpus[l]);
+        lockstep_retire(ls, l, target, target + 4);
+      } else {
+        lockstep_retire(ls, l, ls->fetch_pc, r15);
+      }
+      ls->stats.divergences++;
+    }
+  }
+
+  if (run & lead) {
+    for (uint32_t l = 0; l < ls->lanes; l++) {
+      if (!(ls->active & (1u << l))) {
+        continue;
+      }
+      if (inst->l) {
+        ls->registers[14][l] = r15 - 4;
+      }
+      ls->cpus[l]->events[PMU_BRANCHES]++;
+      ls->cpus[l]->events[PMU_FLUSHES]++;
+      lockstep_tick(ls->cpus[l]);
+    }
+    ls->pc       = target;
+    ls->fetch_pc = target + 4;
+  } else {
+    ls->pc       = ls->fetch_pc;
+    ls->fetch_pc = r15;
+  }
+}
+
+/**
+ * Runs the instruction on each lane's own cpu_t. Lanes that end up
+ * somewhere else than the first one leave the group.
+ */
+static void lockstep_scalar(lockstep_t* ls, decoded_t* decoded) {
+  uint32_t next_pc[LOCKSTEP_LANES];
+  uint32_t next_fetch[LOCKSTEP_LANES];
+  uint32_t lead = __builtin_ctz(ls->active);
+
+  for (uint32_t l = 0; l < ls->lanes; l++) {
+    if (!(ls->active & (1u << l))) {
+      continue;
+    }
+
+    cpu_t* cpu = ls->cpus[l];
+    for (uint32_t r = 0; r < REG_NUM; r++) {
+      cpu->registers[r] = ls->registers[r][l];
+    }
+    cpu->registers[15]   = ls->fetch_pc + 4;
+    cpu->decoded_inst    = *decoded;
+    cpu->has_instruction = true;
+
+    cpu_execute(cpu);
+
+    if (!cpu->has_instruction) {
+      next_pc[l]    = cpu->registers[15];
+      next_fetch[l] = cpu->registers[15] + 4;
+      lockstep_tick(cpu);
+    } else {
+      next_pc[l]    = ls->fetch_pc;
+      next_fetch[l] = cpu->registers[15];
+    }
+    for (uint32_t r = 0; r < REG_NUM; r++) {
+      ls->registers[r][l] = cpu->registers[r];
+    }
+  }
+
+  for (uint32_t l = lead + 1; l < ls->lanes; l++) {
+    if ((ls->active & (1u << l))
+        && (next_pc[l] != next_pc[lead] || next_fetch[l] != next_fetch[lead])) {
+      lockstep_retire(ls, l, next_pc[l], next_fetch[l]);
+      ls->stats.divergences++;
+    }
+  }
+
+  ls->pc       = next_pc[lead];
+  ls->fetch_pc = next_fetch[lead];
+}
+
+/**
+ * Takes a lane out of the group, handing its state back to its cpu_t
+ * with the pipeline about to execute the instruction at pc.
+ */
+static void lockstep_retire(lockstep_t* ls, uint32_t lane, uint32_t pc,
+    uint32_t fetch_pc) {
+  cpu_t* cpu = ls->cpus[lane];
+
+  for (uint32_t r = 0; r < REG_NUM; r++) {
+    cpu->registers[r] = ls->registers[r][lane];
+  }
+  cpu->decoded_inst    = instruction_decode(memory_read(cpu->ram, pc));
+  cpu->decoded_pc      = pc;
+  cpu->fetched_inst    = memory_read(cpu->ram, fetch_pc);
+  cpu->fetched_pc      = fetch_pc;
+  cpu->has_instruction = true;
+  cpu->registers[15]   = fetch_pc + 4;
+
+  ls->active &= ~(1u << lane);
+}
+
+void lockstep_dump_stats(lockstep_stats_t* stats, FILE* out) {
+  fprintf(out, "lockstep steps    : %llu\n",
+      (unsigned long long) stats->instructions);
+  fprintf(out, "vector ops        : %llu\n",
+      (unsigned long long) stats->vector_ops);
+  fprintf(out, "scalar ops        : %llu\n",
+      (unsigned long long) stats->scalar_ops);
+  fprintf(out, "divergences       : %llu\n",
+      (unsigned long long) stats->divergences);
+}
+
+void lockstep_free(lockstep_t* ls) {
+  free(ls);
+}
@@ -0,0 +1,65 @@
+#ifndef HEADER_LOCKSTEP
+#define HEADER_LOCKSTEP
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "instruction.h"
+#include "memory.h"
+
+/**
+ * Number of guests run by one vector instruction: 8 fill an AVX2
+ * register, 16 an AVX-512 one. Without those the compiler splits the
+ * vectors over the registers the host has.
+ */
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 8
+#endif
+
+/**
+ * One register, or the CPSR, of every lane
+ */
+typedef uint32_t lockstep_vec_t
+    __attribute__ ((vector_size (4 * LOCKSTEP_LANES)));
+typedef int32_t  lockstep_mask_t
+    __attribute__ ((vector_size (4 * LOCKSTEP_LANES)));
+
+typedef struct {
+  uint64_t instructions;
+  uint64_t vector_ops;   // Data processing and transfers run on all lanes
+                         // at once
+  uint64_t scalar_ops;   // Run lane by lane through cpu_execute
+  uint64_t divergences;  // Times lanes had to leave the group
+} lockstep_stats_t;
+
+/**
+ * Guests running the same instruction stream. The register files are
+ * kept as struct of arrays, so that a data processing instruction, or the
+ * address of a load or store, is a few vector operations for all lanes,
+ * masked by the condition of each.
+ * The lanes share a pc; one that would go elsewhere leaves the group and
+ * finishes on its own cpu_t. Each cpu_t counts the instructions and
+ * events of its lane as they run, so that its PMU reads as in cpu_loop,
+ * and polls its devices as often; a lane leaves to take an interrupt.
+ */
+typedef struct {
+  cpu_t*   cpus[LOCKSTEP_LANES];
+  uint32_t registers[REG_NUM][LOCKSTEP_LANES];
+  uint32_t lane_bits[LOCKSTEP_LANES];
+  uint32_t lanes;
+  uint32_t active;      // One bit per lane still in the group
+
+  // Sequential view of the pipeline, as in the IR engine
+  uint32_t pc;
+  uint32_t fetch_pc;
+
+  lockstep_stats_t stats;
+} lockstep_t;
+
+lockstep_t* lockstep_init(cpu_t**, uint32_t);
+void        lockstep_loop(lockstep_t*);
+void        lockstep_dump_stats(lockstep_stats_t*, FILE*);
+void        lockstep_free(lockstep_t*);
+
+#endif
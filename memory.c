@@ -1,14 +1,91 @@
 #include "memory.h"
+#include "dedup.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Size of the host mapping backing a device of the given size.
+ * Backing memory is page aligned so that it can be protected per page.
+ */
+size_t memory_mapped_size(uint32_t size) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
 
 void memory_init(memory_t* memory, uint32_t start, uint32_t size) {
-  memory->mem      = calloc(size, sizeof(uint8_t));
-  if(memory->mem == NULL) {
+  memory->mem      = mmap(NULL, memory_mapped_size(size),
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(memory->mem == MAP_FAILED) {
+    fprintf(stderr,"mmap failure");
+    exit(EXIT_FAILURE);
+  }
+  memory->start    = start;
+  memory->size     = size;
+  memory->ops      = NULL;
+  memory->state    = NULL;
+  memory->in_arena = false;
+  memory->pooled   = false;
+  memory->mapped   = false;
+  memory->dedup    = NULL;
+
+  memory->dirty    = calloc(memory_pages(memory), sizeof(uint8_t));
+  if(memory->dirty == NULL) {
     fprintf(stderr,"calloc failure");
     exit(EXIT_FAILURE);
   }
+}
+
+/**
+ * Allocates a device in a machine's arena, its mem page aligned there or
+ * taken from the RAM pool if pooled, which it has to fit in. memory_free
+ * only gives the slot back: the arena goes with the machine.
+ */
+memory_t* memory_new(arena_t* arena, uint32_t start, uint32_t size,
+    bool pooled) {
+  size_t    page   = (size_t) sysconf(_SC_PAGESIZE);
+  memory_t* memory = arena_alloc(arena, sizeof(memory_t), 0);
+
   memory->start    = start;
   memory->size     = size;
-  memory->callback = NULL;
+  memory->in_arena = true;
+  memory->pooled   = pooled && memory_mapped_size(size) <= POOL_SLOT;
+  memory->mapped   = false;
+  memory->mem      = memory->pooled ? pool_take()
+      : arena_alloc(arena, memory_mapped_size(size), page);
+  memory->dirty    = arena_alloc(arena, memory_pages(memory), 0);
+  if (memory->pooled) {
+    dedup_track(arena, memory);
+  }
+  return memory;
+}
+
+/**
+ * Number of dirty tracking pages covering the memory
+ */
+uint32_t memory_pages(memory_t* memory) {
+  return (memory->size + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+}
+
+/**
+ * Marks the pages in the relative range [address, address + length) as
+ * written, and no longer shared. Needed wherever mem is written without
+ * memory_write_unsafe.
+ */
+void memory_mark_dirty(memory_t* memory, uint32_t address, uint32_t length) {
+  if (length == 0) {
+    return;
+  }
+
+  uint32_t last = (address + length - 1) >> MEMORY_PAGE_SHIFT;
+  for (uint32_t page = address >> MEMORY_PAGE_SHIFT;
+      page <= last && page < memory_pages(memory); page++) {
+    if (memory->dirty[page] & MEMORY_PAGE_SHARED) {
+      dedup_unshare(memory, page);
+    }
+    memory->dirty[page] = MEMORY_PAGE_TOUCHED;
+  }
 }
 
 bool memory_write(memory_t* memory, uint32_t address, uint32_t value) {
@@ -21,16 +98,28 @@ bool memory_write(memory_t* memory, uint32_t address, uint32_t value) {
   }
 
 
-  if (memory->callback != NULL) {
-    memory->callback(memory, address, true);
+  if (memory->ops != NULL) {
+    memory->ops->write(memory, address, value);
+  } else {
+    memory_write_unsafe(memory, address, value);
   }
 
-  memory_write_unsafe(memory, address, value);
-
   return true;
 }
 
+/**
+ * Stores a word at a relative address. Its pages are only marked on the
+ * first store since a checkpoint or the deduplicator last looked at them,
+ * later ones just test the flags.
+ */
 void memory_write_unsafe(memory_t* memory, uint32_t address, uint32_t value) {
+  uint32_t first = address >> MEMORY_PAGE_SHIFT;
+  uint32_t last  = (address + 3) >> MEMORY_PAGE_SHIFT;
+
+  if (memory->dirty[first] != MEMORY_PAGE_TOUCHED
+      || memory->dirty[last] != MEMORY_PAGE_TOUCHED) {
+    memory_mark_dirty(memory, address, 4);
+  }
   memcpy(memory->mem + address, &value, 4);
 }
 
@@ -39,8 +128,8 @@ uint32_t memory_read(memory_t* memory, uint32_t address) {
   // Convert the address to relative
   address -= memory->start;
 
-  if (memory->callback != NULL) {
-    memory->callback(memory, address, false);
+  if (memory->ops != NULL) {
+    return memory->ops->read(memory, address);
   }
 
   return memory_read_unsafe(memory, address);
@@ -51,14 +140,90 @@ uint32_t memory_read_unsafe(memory_t* memory, uint32_t address) {
   return *first_address;
 }
 
+/**
+ * Whether the 16 bytes at the address are all zero
+ */
+static bool memory_zero_16(const uint8_t* bytes) {
+#ifdef __SSE2__
+  __m128i chunk = _mm_loadu_si128((const __m128i *) bytes);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128()))
+      == 0xFFFF;
+#else
+  uint64_t halves[2];
+  memcpy(halves, bytes, 16);
+  return (halves[0] | halves[1]) == 0;
+#endif
+}
+
+static char* memory_format_word(char* out, uint32_t value) {
+  static const char digits[] = "0123456789abcdef";
+
+  *out++ = '0';
+  *out++ = 'x';
+  for (int shift = 28; shift >= 0; shift -= 4) {
+    *out++ = digits[(value >> shift) & 0xF];
+  }
+  return out;
+}
+
+/**
+ * Prints the non-zero words. Only pages that have been written are
+ * scanned, skipping zero runs 16 bytes at a time, and the output goes
+ * through a single buffer.
+ */
 void memory_dump_state(memory_t* memory) {
   printf("Non-zero memory:\n");
-  for (uint32_t i = 0; i <= (memory->size - 4); i += 4) {
-    uint32_t value = memory_read(memory, i);
-    if (value) {
-      printf("0x%08x: 0x%08x\n", i, endian_swap(value));
+
+  if (memory->ops != NULL) {
+    // Reading a device has side effects, go through memory_read
+    for (uint32_t i = 0; i <= (memory->size - 4); i += 4) {
+      uint32_t value = memory_read(memory, i);
+      if (value) {
+        printf("0x%08x: 0x%08x\n", i, endian_swap(value));
+      }
     }
+    return;
   }
+
+  char   buffer[MEMORY_DUMP_BUFFER];
+  char*  out   = buffer;
+  // The last word starts at size - 4
+  uint32_t limit = memory->size & ~3u;
+
+  for (uint32_t page = 0; page < memory_pages(memory); page++) {
+    if (!(memory->dirty[page] & MEMORY_PAGE_WRITTEN)) {
+      continue;
+    }
+
+    uint32_t end = (page + 1) << MEMORY_PAGE_SHIFT;
+    if (end > limit) {
+      end = limit;
+    }
+
+    for (uint32_t i = page << MEMORY_PAGE_SHIFT; i < end; i += 4) {
+      if ((i & 15) == 0 && i + 16 <= end && memory_zero_16(memory->mem + i)) {
+        i += 12;
+        continue;
+      }
+
+      uint32_t value = memory_read_unsafe(memory, i);
+      if (!value) {
+        continue;
+      }
+
+      if (out - buffer > MEMORY_DUMP_BUFFER - 32) {
+        fwrite(buffer, 1, (size_t) (out - buffer), stdout);
+        out = buffer;
+      }
+      out = memory_format_word(out, i);
+      *out++ = ':';
+      *out++ = ' ';
+      out = memory_format_word(out, endian_swap(value));
+      *out++ = '\n';
+    }
+  }
+
+  fwrite(buffer, 1, (size_t) (out - buffer), stdout);
 }
 
 void memory_free(memory_t* memory) {
@@ -66,9 +231,27 @@ void memory_free(memory_t* memory) {
     return; 
   }
 
+  if (memory->ops != NULL && memory->ops->release != NULL) {
+    memory->ops->release(memory);
+  }
+  if (memory->in_arena) {
+    if (memory->pooled) {
+      dedup_forget(memory);
+      // The next machine given the slot must not see this one's files
+      if (memory->mapped && mmap(memory->mem,
+          memory_mapped_size(memory->size), PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        fprintf(stderr,"mmap failure");
+        exit(EXIT_FAILURE);
+      }
+      pool_give(memory->mem);
+    }
+    return;
+  }
   if (memory->mem) {
-    free(memory->mem);
+    munmap(memory->mem, memory_mapped_size(memory->size));
   }
+  free(memory->dirty);
 
   free(memory);
 }
@@ -2,21 +2,73 @@
 #define HEADER_MEMORY
 
 #include "common.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arena.h"
 #include "instruction.h"
 #include "utils.h"
 
 #define RAM_SIZE (1 << 16) // 2^16 memory locations, byte addressable. 
                            // DONT delete the parenthese
+
+/**
+ * Granularity of the dirty page tracking
+ */
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE  (1 << MEMORY_PAGE_SHIFT)
+
+/**
+ * Page flags kept in memory_t.dirty.
+ * WRITTEN stays set once the page has been written, DELTA is cleared
+ * whenever a checkpoint saves the page.
+ */
+#define MEMORY_PAGE_WRITTEN 0x1
+#define MEMORY_PAGE_DELTA   0x2
+#define MEMORY_PAGE_TOUCHED (MEMORY_PAGE_WRITTEN | MEMORY_PAGE_DELTA)
+
+/**
+ * Flags of the deduplicator, see dedup_t. SHARED pages map memory shared
+ * with other pages, STABLE ones have not been written since it last
+ * scanned them; writes clear both.
+ */
+#define MEMORY_PAGE_SHARED  0x4
+#define MEMORY_PAGE_STABLE  0x8
+
+/**
+ * Size of the output buffer used when dumping memory
+ */
+#define MEMORY_DUMP_BUFFER 8192
                            
+struct memory_struct;
+struct dedup_ram_struct;
+
+/**
+ * Handlers of a device's registers, given the address relative to its
+ * start: read returns the word a guest load gets and write takes the
+ * word stored, deciding what lands in mem, so that an access is a single
+ * call. Devices keep the state a checkpoint has to save in words of mem
+ * past their registers. release, if any, frees the handlers' state when
+ * the device is.
+ */
+typedef struct {
+  uint32_t (*read)(struct memory_struct*, uint32_t rel_address);
+  void     (*write)(struct memory_struct*, uint32_t rel_address,
+      uint32_t value);
+  void     (*release)(struct memory_struct*);
+} device_ops_t;
+
 typedef struct memory_struct {
   uint32_t start;
   uint32_t size;
   uint8_t *mem;
-  void (*callback)(struct memory_struct*, uint32_t rel_address, bool write);
-
-  // Custom value can be stored, probably it should be an array...
-  uint64_t custom_buffer;
-} memory_t; // device_t maybe?
+  uint8_t *dirty; // MEMORY_PAGE_* flags, one byte per page
+  const device_ops_t* ops; // NULL for plain memory
+  void*    state;          // The handlers' own, not saved by checkpoints
+  bool     in_arena;       // It, mem and dirty belong to the machine's
+  bool     pooled;         // mem is a slot of the RAM pool
+  bool     mapped;         // Some of mem maps a file, undone when freed
+  struct dedup_ram_struct* dedup; // Pooled RAM's record, see dedup_t
+} memory_t;
 
 typedef union {
   uint32_t value;
@@ -36,7 +88,11 @@ typedef union {
   } dwords;
 } qword_t;
 
+size_t    memory_mapped_size(uint32_t);
 void      memory_init(memory_t*, uint32_t, uint32_t);
+memory_t* memory_new(arena_t*, uint32_t, uint32_t, bool);
+uint32_t  memory_pages(memory_t*);
+void      memory_mark_dirty(memory_t*, uint32_t, uint32_t);
 void      memory_write_unsafe(memory_t*, uint32_t, uint32_t);
 bool      memory_write(memory_t*, uint32_t, uint32_t);
 uint32_t  memory_read(memory_t*, uint32_t);
@@ -0,0 +1,270 @@
+#include "pmu.h"
+#include "timing.h"
+
+static uint32_t pmu_read(memory_t*, uint32_t);
+static void     pmu_write(memory_t*, uint32_t, uint32_t);
+static void     pmu_increment(memory_t*, uint32_t);
+static void     pmu_control(memory_t*, uint32_t);
+static bool     pmu_counter(uint32_t);
+static uint32_t pmu_register(uint32_t);
+static uint32_t pmu_bit(uint32_t);
+static uint32_t pmu_event(memory_t*, uint32_t);
+static uint64_t pmu_total(memory_t*, uint32_t);
+static bool     pmu_running(memory_t*, uint32_t);
+static uint64_t pmu_value(memory_t*, uint32_t);
+static void     pmu_stop(memory_t*);
+static void     pmu_start(memory_t*);
+
+const device_ops_t pmu_ops = { &pmu_read, &pmu_write };
+
+/**
+ * Bits of the counters in the enable, interrupt and overflow registers
+ */
+#define PMU_MASK (((1u << PMU_COUNTERS) - 1) | 1u << PMU_CYCLES)
+
+/**
+ * PMU initialiser, all counters stopped at 0. It counts nothing until
+ * attached to a core.
+ */
+memory_t* pmu_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, PMU_START, PMU_SIZE, false);
+  device->ops   = &pmu_ops;
+  device->state = arena_alloc(arena, sizeof(pmu_t), 0);
+  memory_write_unsafe(device, PMU_CR,
+      PMU_CR_IMP | PMU_COUNTERS << PMU_CR_N_SHIFT);
+  return device;
+}
+
+/**
+ * Counts the events of the core keeping the given totals
+ */
+void pmu_attach(memory_t* device, const uint64_t* instructions,
+    const uint64_t* events) {
+  pmu_t* pmu = device->state;
+
+  pmu->instructions = instructions;
+  pmu->events       = events;
+  pmu_start(device);
+}
+
+static uint32_t pmu_read(memory_t* pmu, uint32_t rel_addr) {
+  if (pmu_counter(rel_addr)) {
+    uint32_t n = rel_addr == PMU_CCNTR ? PMU_COUNTERS : rel_addr / 4;
+    return (uint32_t) pmu_value(pmu, n);
+  }
+
+  switch (rel_addr) {
+    case PMU_CNTENCLR:
+    case PMU_INTENCLR:
+      rel_addr -= PMU_CNTENCLR - PMU_CNTENSET;
+      break;
+    case PMU_OVSR:
+      pmu_stop(pmu);
+      pmu_start(pmu);
+      break;
+    default:break;
+  }
+  return memory_read_unsafe(pmu, rel_addr);
+}
+
+/**
+ * Whatever changes which counters run or what they count stops them all
+ * first, keeping what they have counted in their registers, and starts
+ * them again from the totals of their events once it is done
+ */
+static void pmu_write(memory_t* pmu, uint32_t rel_addr, uint32_t value) {
+  uint32_t current = memory_read_unsafe(pmu, rel_addr);
+
+  switch (rel_addr) {
+    case PMU_INTENSET:
+      memory_write_unsafe(pmu, PMU_INTENSET, current | (value & PMU_MASK));
+      return;
+    case PMU_INTENCLR:
+      memory_write_unsafe(pmu, PMU_INTENSET,
+          memory_read_unsafe(pmu, PMU_INTENSET) & ~value);
+      return;
+    default:break;
+  }
+
+  pmu_stop(pmu);
+  switch (rel_addr) {
+    case PMU_CNTENSET:
+      memory_write_unsafe(pmu, PMU_CNTENSET, current | (value & PMU_MASK));
+      break;
+    case PMU_CNTENCLR:
+      memory_write_unsafe(pmu, PMU_CNTENSET,
+          memory_read_unsafe(pmu, PMU_CNTENSET) & ~value);
+      break;
+    case PMU_OVSR:
+      memory_write_unsafe(pmu, PMU_OVSR, current & ~value);
+      break;
+    case PMU_SWINC:
+      pmu_increment(pmu, value);
+      break;
+    case PMU_CR:
+      pmu_control(pmu, value);
+      break;
+    default:
+      if (pmu_counter(rel_addr)) {
+        memory_write_unsafe(pmu, rel_addr, value);
+      } else if (rel_addr >= PMU_EVTYPER
+          && rel_addr < PMU_EVTYPER + 4 * PMU_COUNTERS) {
+        memory_write_unsafe(pmu, rel_addr, value & 0xFF);
+      }
+      break;
+  }
+  pmu_start(pmu);
+}
+
+/**
+ * PMSWINC: adds one to the counters given that run and count software
+ * increments
+ */
+static void pmu_increment(memory_t* pmu, uint32_t counters) {
+  for (uint32_t n = 0; n < PMU_COUNTERS; n++) {
+    if (!(counters & (1u << n)) || !pmu_running(pmu, n)
+        || pmu_event(pmu, n) != PMU_EVENT_SW_INCR) {
+      continue;
+    }
+    uint32_t count = memory_read_unsafe(pmu, pmu_register(n)) + 1;
+    memory_write_unsafe(pmu, pmu_register(n), count);
+    if (count == 0) {
+      memory_write_unsafe(pmu, PMU_OVSR,
+          memory_read_unsafe(pmu, PMU_OVSR) | 1u << n);
+    }
+  }
+}
+
+/**
+ * PMCR: only E is kept, P and C reset the counters when written
+ */
+static void pmu_control(memory_t* pmu, uint32_t value) {
+  uint32_t cr = memory_read_unsafe(pmu, PMU_CR);
+  memory_write_unsafe(pmu, PMU_CR, (cr & ~PMU_CR_E) | (value & PMU_CR_E));
+
+  for (uint32_t n = 0; n <= PMU_COUNTERS; n++) {
+    if (value & (n == PMU_COUNTERS ? PMU_CR_C : PMU_CR_P)) {
+      memory_write_unsafe(pmu, pmu_register(n), 0);
+    }
+  }
+}
+
+/**
+ * Flags the overflows since the last poll. Returns the PMU's line while
+ * an overflow it may interrupt for is flagged, until the guest clears
+ * it; the interrupt is taken up to a poll interval after the overflow.
+ */
+uint64_t pmu_update(memory_t* pmu) {
+  uint32_t interrupts = memory_read_unsafe(pmu, PMU_INTENSET);
+
+  if (interrupts == 0) {
+    return 0;
+  }
+  pmu_stop(pmu);
+  pmu_start(pmu);
+  return memory_read_unsafe(pmu, PMU_OVSR) & interrupts
+      ? 1ull << PMU_LINE : 0;
+}
+
+static bool pmu_counter(uint32_t rel_addr) {
+  return rel_addr < PMU_EVCNTR + 4 * PMU_COUNTERS || rel_addr == PMU_CCNTR;
+}
+
+/**
+ * Register of counter n, the cycle counter being n = PMU_COUNTERS
+ */
+static uint32_t pmu_register(uint32_t n) {
+  return n == PMU_COUNTERS ? PMU_CCNTR : PMU_EVCNTR + 4 * n;
+}
+
+static uint32_t pmu_bit(uint32_t n) {
+  return n == PMU_COUNTERS ? 1u << PMU_CYCLES : 1u << n;
+}
+
+static uint32_t pmu_event(memory_t* pmu, uint32_t n) {
+  if (n == PMU_COUNTERS) {
+    return PMU_EVENT_CYCLES;
+  }
+  return memory_read_unsafe(pmu, PMU_EVTYPER + 4 * n);
+}
+
+/**
+ * How many times the event has happened since the core started
+ */
+static uint64_t pmu_total(memory_t* device, uint32_t event) {
+  pmu_t* pmu = device->state;
+
+  if (pmu->events == NULL) {
+    return 0;
+  }
+  switch (event) {
+    case PMU_EVENT_LD:
+      return pmu->events[PMU_LOADS];
+    case PMU_EVENT_ST:
+      return pmu->events[PMU_STORES];
+    case PMU_EVENT_INST:
+      return *pmu->instructions;
+    case PMU_EVENT_PC_WRITE:
+      return pmu->events[PMU_FLUSHES];
+    case PMU_EVENT_BR_IMMED:
+      return pmu->events[PMU_BRANCHES];
+    case PMU_EVENT_CYCLES:
+      return *pmu->instructions
+          + TIMING_REFILL * pmu->events[PMU_FLUSHES];
+    case PMU_EVENT_BUS:
+      return pmu->events[PMU_DEVICE];
+    default:
+      return 0;
+  }
+}
+
+static bool pmu_running(memory_t* pmu, uint32_t n) {
+  return (memory_read_unsafe(pmu, PMU_CR) & PMU_CR_E)
+      && (memory_read_unsafe(pmu, PMU_CNTENSET) & pmu_bit(n));
+}
+
+/**
+ * Counter n, past 32 bits if it has overflowed since it was started
+ */
+static uint64_t pmu_value(memory_t* pmu, uint32_t n) {
+  uint64_t value = memory_read_unsafe(pmu, pmu_register(n));
+
+  if (pmu_running(pmu, n)) {
+    qword_t start;
+    start.dwords.lower.value  = memory_read_unsafe(pmu,
+        PMU_START_AT + 8 * n);
+    start.dwords.higher.value = memory_read_unsafe(pmu,
+        PMU_START_AT + 8 * n + 4);
+    value += pmu_total(pmu, pmu_event(pmu, n)) - start.value;
+  }
+  return value;
+}
+
+/**
+ * Keeps what the counters have counted in their registers, flagging
+ * those that overflowed
+ */
+static void pmu_stop(memory_t* pmu) {
+  uint32_t overflows = memory_read_unsafe(pmu, PMU_OVSR);
+
+  for (uint32_t n = 0; n <= PMU_COUNTERS; n++) {
+    uint64_t value = pmu_value(pmu, n);
+    memory_write_unsafe(pmu, pmu_register(n), (uint32_t) value);
+    overflows |= value >> 32 ? pmu_bit(n) : 0;
+  }
+  memory_write_unsafe(pmu, PMU_OVSR, overflows);
+}
+
+/**
+ * Starts the counters from the totals of their events
+ */
+static void pmu_start(memory_t* pmu) {
+  for (uint32_t n = 0; n <= PMU_COUNTERS; n++) {
+    qword_t start;
+    start.value = pmu_total(pmu, pmu_event(pmu, n));
+    memory_write_unsafe(pmu, PMU_START_AT + 8 * n,
+        start.dwords.lower.value);
+    memory_write_unsafe(pmu, PMU_START_AT + 8 * n + 4,
+        start.dwords.higher.value);
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef HEADER_PMU
+#define HEADER_PMU
+
+#include "common.h"
+
+#include "devices.h"
+
+/**
+ * Performance monitoring unit, with the memory mapped layout of the
+ * ARMv7 PMU: PMU_COUNTERS event counters and the cycle counter, enabled,
+ * reset and made to interrupt on overflow as that one's are. Counters are
+ * 32 bits wide; PMCR.D (counting every 64 cycles) is not emulated.
+ */
+#define PMU_START      0x20009000
+#define PMU_COUNTERS   4
+#define PMU_EVCNTR     0x000  // Counter n is at PMU_EVCNTR + 4 * n
+#define PMU_CCNTR      0x07C
+#define PMU_EVTYPER    0x400  // Event of counter n at PMU_EVTYPER + 4 * n
+#define PMU_CNTENSET   0xC00
+#define PMU_CNTENCLR   0xC20
+#define PMU_INTENSET   0xC40
+#define PMU_INTENCLR   0xC60
+#define PMU_OVSR       0xC80
+#define PMU_SWINC      0xCA0
+#define PMU_CR         0xE04
+
+/**
+ * Words past the registers: where each counter, the cycle counter last,
+ * started counting, as the total of its event then (PMU_START_AT + 8 * n
+ * and the word after). A running counter is the value in its register
+ * plus what its event's total has grown by since.
+ */
+#define PMU_START_AT   0xE08
+#define PMU_SIZE       (PMU_START_AT + 8 * (PMU_COUNTERS + 1))
+
+/**
+ * Bit of the cycle counter in the enable, interrupt and overflow
+ * registers, and the PMCR bits
+ */
+#define PMU_CYCLES     31
+#define PMU_CR_E       (1u << 0)   // Enables all the counters
+#define PMU_CR_P       (1u << 1)   // Resets the event counters
+#define PMU_CR_C       (1u << 2)   // Resets the cycle counter
+#define PMU_CR_N_SHIFT 11
+#define PMU_CR_IMP     (0x41u << 24)
+
+/**
+ * Events counted, with their ARMv7 numbers. Taken branches are the B and
+ * BL whose condition passed, PC writes every pipeline flush and bus
+ * accesses the loads and stores to devices other than RAM. Cycles are
+ * the instructions retired plus the ones lost refilling the pipeline, as
+ * the timing model counts them. Other numbers count nothing.
+ */
+#define PMU_EVENT_SW_INCR   0x00
+#define PMU_EVENT_LD        0x06
+#define PMU_EVENT_ST        0x07
+#define PMU_EVENT_INST      0x08
+#define PMU_EVENT_PC_WRITE  0x0C
+#define PMU_EVENT_BR_IMMED  0x0D
+#define PMU_EVENT_CYCLES    0x11
+#define PMU_EVENT_BUS       0x19
+
+/**
+ * Running totals the core keeps of the events it does not count
+ * otherwise, one add each wherever they happen. The PMU only reads them
+ * when the guest does, or when it polls for overflows.
+ */
+enum {
+  PMU_BRANCHES,
+  PMU_FLUSHES,
+  PMU_LOADS,
+  PMU_STORES,
+  PMU_DEVICE,
+  PMU_SOURCES
+};
+
+/**
+ * Interrupt line raised while an enabled overflow is flagged
+ */
+#define PMU_LINE 40
+
+/**
+ * The handlers' state: the totals of the core the PMU is attached to
+ */
+typedef struct {
+  const uint64_t* instructions;
+  const uint64_t* events;
+} pmu_t;
+
+extern const device_ops_t pmu_ops;
+
+memory_t* pmu_init(arena_t*);
+void      pmu_attach(memory_t*, const uint64_t*, const uint64_t*);
+uint64_t  pmu_update(memory_t*);
+
+#endif
@@ -0,0 +1,442 @@
+#include "profile.h"
+
+static uint32_t    profile_function(profile_t*, uint32_t);
+static uint32_t    profile_child(profile_t*, uint32_t, uint32_t);
+static void        profile_call(profile_t*, uint32_t, uint32_t);
+static void        profile_return(profile_t*, uint32_t);
+static void        profile_pop(profile_t*);
+static bool        profile_is_return(decoded_t*);
+static const char* profile_name(profile_t*, uint32_t, char*, size_t);
+static int         profile_symbol_compare(const void*, const void*);
+static int         profile_function_compare(const void*, const void*);
+
+/**
+ * Starts profiling at the cpu's current pc, which is taken to be the
+ * entry of the outermost function
+ */
+profile_t* profile_init(cpu_t* cpu) {
+  profile_t* profile = calloc(1, sizeof(profile_t));
+  if (profile == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  profile->cpu = cpu;
+
+  uint32_t entry = cpu->decoded_inst.type != EMPTY ? cpu->decoded_pc
+      : cpu->has_instruction ? cpu->fetched_pc : cpu->registers[15];
+  uint32_t root  = profile_function(profile, entry);
+
+  // Node 0 is the root of the tree, so 0 can mean no child
+  profile_child(profile, 0, root);
+  profile->functions[root].calls  = 1;
+  profile->functions[root].active = 1;
+  profile->stack[0].node           = 0;
+  profile->stack[0].return_address = UINT32_MAX;
+  profile->stack[0].entered        = 0;
+  profile->depth = 1;
+
+  return profile;
+}
+
+/**
+ * Reads the function and label symbols of an ELF32 file, to name the
+ * functions after. Returns false if the file cannot be read as one.
+ */
+bool profile_load_symbols(profile_t* profile, const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = (size_t) ftell(file);
+  rewind(file);
+
+  uint8_t* image = malloc(size);
+  if (image == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+  bool ok = fread(image, 1, size, file) == size;
+  fclose(file);
+
+  Elf32_Ehdr header;
+  if (!ok || size < sizeof(header)) {
+    free(image);
+    return false;
+  }
+  memcpy(&header, image, sizeof(header));
+  if (memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+      || header.e_ident[EI_CLASS] != ELFCLASS32
+      || header.e_shentsize != sizeof(Elf32_Shdr)
+      || header.e_shoff + (size_t) header.e_shnum * sizeof(Elf32_Shdr) > size) {
+    free(image);
+    return false;
+  }
+
+  for (uint32_t s = 0; s < header.e_shnum; s++) {
+    Elf32_Shdr table, strings;
+    memcpy(&table, image + header.e_shoff + s * sizeof(Elf32_Shdr),
+        sizeof(table));
+    if (table.sh_type != SHT_SYMTAB || table.sh_link >= header.e_shnum
+        || (size_t) table.sh_offset + table.sh_size > size) {
+      continue;
+    }
+    memcpy(&strings, image + header.e_shoff
+        + table.sh_link * sizeof(Elf32_Shdr), sizeof(strings));
+    if ((size_t) strings.sh_offset + strings.sh_size > size) {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < table.sh_size / sizeof(Elf32_Sym); i++) {
+      Elf32_Sym symbol;
+      memcpy(&symbol, image + table.sh_offset + i * sizeof(Elf32_Sym),
+          sizeof(symbol));
+
+      uint8_t type = ELF32_ST_TYPE(symbol.st_info);
+      if ((type != STT_FUNC && type != STT_NOTYPE)
+          || symbol.st_shndx == SHN_UNDEF || symbol.st_shndx >= SHN_LORESERVE
+          || symbol.st_name == 0 || symbol.st_name >= strings.sh_size) {
+        continue;
+      }
+
+      // $a, $d and $t only mark what kind of code or data follows
+      const char* name = (const char *) image + strings.sh_offset
+          + symbol.st_name;
+      size_t length = strnlen(name, strings.sh_size - symbol.st_name);
+      if (name[0] == '$' || length == strings.sh_size - symbol.st_name) {
+        continue;
+      }
+
+      profile->symbols = realloc(profile->symbols,
+          (profile->symbolc + 1) * sizeof(profile_symbol_t));
+      char* copy = malloc(length + 1);
+      if (profile->symbols == NULL || copy == NULL) {
+        fprintf(stderr,"malloc failure");
+        exit(EXIT_FAILURE);
+      }
+      memcpy(copy, name, length + 1);
+      profile->symbols[profile->symbolc].address = symbol.st_value & ~1u;
+      profile->symbols[profile->symbolc].name    = copy;
+      profile->symbolc++;
+    }
+  }
+
+  qsort(profile->symbols, profile->symbolc, sizeof(profile_symbol_t),
+      &profile_symbol_compare);
+  free(image);
+  return true;
+}
+
+/**
+ * cpu_loop, charging every executed instruction to the call stack it
+ * runs under
+ */
+void profile_loop(profile_t* profile) {
+  cpu_t* cpu = profile->cpu;
+
+  while (cpu->decoded_inst.type != HALT) {
+    if (cpu->decoded_inst.type == EMPTY) {
+      cpu_step(cpu);
+      continue;
+    }
+
+    decoded_t decoded = cpu->decoded_inst;
+    uint32_t  pc      = cpu->decoded_pc;
+    bool      taken   = cpu_eval(cpu, decoded.fields.generic.cond);
+
+    profile->nodes[profile->stack[profile->depth - 1].node].self++;
+    profile->instructions++;
+
+    cpu_step(cpu);
+
+    // Only a flush moves the pc elsewhere; the target has been fetched
+    if (!taken || cpu->decoded_inst.type != EMPTY) {
+      continue;
+    }
+    if (decoded.type == BRANCH && decoded.fields.branch.l) {
+      profile_call(profile, cpu->fetched_pc, pc + 4);
+    } else if (profile_is_return(&decoded)) {
+      profile_return(profile, cpu->fetched_pc);
+    }
+  }
+
+  while (profile->depth > 0) {
+    profile_pop(profile);
+  }
+  for (uint32_t i = 0; i < profile->nodec; i++) {
+    profile->functions[profile->nodes[i].function].exclusive
+        += profile->nodes[i].self;
+  }
+}
+
+static void profile_call(profile_t* profile, uint32_t target,
+    uint32_t return_address) {
+  if (profile->depth == PROFILE_MAX_DEPTH) {
+    profile->overflows++;
+    return;
+  }
+
+  profile_frame_t* caller = &profile->stack[profile->depth - 1];
+  uint32_t         node   = caller->node;
+  uint32_t         child;
+
+  // Calls mostly repeat, so look among the callees seen from here first
+  for (child = profile->nodes[node].child; child != 0;
+      child = profile->nodes[child].sibling) {
+    if (profile->functions[profile->nodes[child].function].entry == target) {
+      break;
+    }
+  }
+  if (child == 0) {
+    child = profile_child(profile, node, profile_function(profile, target));
+  }
+
+  profile_function_t* function
+      = &profile->functions[profile->nodes[child].function];
+  function->calls++;
+  function->active++;
+
+  profile_frame_t* frame = &profile->stack[profile->depth++];
+  frame->node           = child;
+  frame->return_address = return_address;
+  frame->entered        = profile->instructions;
+  profile->calls++;
+}
+
+/**
+ * Returns to the innermost frame whose caller continues at target.
+ * A jump matching no frame is not taken as a return.
+ */
+static void profile_return(profile_t* profile, uint32_t target) {
+  uint32_t depth = profile->depth;
+
+  while (depth > 1 && profile->stack[depth - 1].return_address != target) {
+    depth--;
+  }
+  if (depth <= 1) {
+    return;
+  }
+
+  while (profile->depth >= depth) {
+    profile_pop(profile);
+  }
+  profile->returns++;
+}
+
+static void profile_pop(profile_t* profile) {
+  profile_frame_t*    frame    = &profile->stack[--profile->depth];
+  profile_function_t* function
+      = &profile->functions[profile->nodes[frame->node].function];
+
+  // Recursive calls are included in the outermost one
+  if (--function->active == 0) {
+    function->inclusive += profile->instructions - frame->entered;
+  }
+}
+
+/**
+ * BX lr, MOV pc, lr, or LDM with the pc in its list
+ */
+static bool profile_is_return(decoded_t* decoded) {
+  switch (decoded->type) {
+    case BX:
+      return decoded->fields.bx.r_n == 14;
+    case PROC: ;
+      inst_data_proc_t* proc = &decoded->fields.data_proc;
+      return proc->opcode == OP_MOV && proc->r_d == 15 && !proc->i
+          && proc->op2 == 14;
+    case BDT:
+      return decoded->fields.bdt.l && (decoded->fields.bdt.reg_bits & 0x8000);
+    default:
+      return false;
+  }
+}
+
+/**
+ * Index of the function entered at address, added if new
+ */
+static uint32_t profile_function(profile_t* profile, uint32_t entry) {
+  for (uint32_t i = 0; i < profile->functionc; i++) {
+    if (profile->functions[i].entry == entry) {
+      return i;
+    }
+  }
+
+  if (profile->functionc == profile->function_capacity) {
+    profile->function_capacity = profile->function_capacity
+        ? profile->function_capacity * 2 : 64;
+    profile->functions = realloc(profile->functions,
+        profile->function_capacity * sizeof(profile_function_t));
+    if (profile->functions == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  profile_function_t* function = &profile->functions[profile->functionc];
+  memset(function, 0, sizeof(profile_function_t));
+  function->entry = entry;
+  return profile->functionc++;
+}
+
+/**
+ * Adds a node for function below parent. The first one added is the root.
+ */
+static uint32_t profile_child(profile_t* profile, uint32_t parent,
+    uint32_t function) {
+  if (profile->nodec == profile->node_capacity) {
+    profile->node_capacity = profile->node_capacity
+        ? profile->node_capacity * 2 : 256;
+    profile->nodes = realloc(profile->nodes,
+        profile->node_capacity * sizeof(profile_node_t));
+    if (profile->nodes == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  uint32_t        index = profile->nodec++;
+  profile_node_t* node  = &profile->nodes[index];
+  node->function = function;
+  node->parent   = parent;
+  node->child    = 0;
+  node->self     = 0;
+  node->sibling  = 0;
+
+  if (index != 0) {
+    node->sibling = profile->nodes[parent].child;
+    profile->nodes[parent].child = index;
+  }
+  return index;
+}
+
+/**
+ * Writes one line per call stack with the instructions run in it, outermost
+ * function first, in the folded format flamegraph.pl and speedscope read
+ */
+void profile_write_folded(profile_t* profile, FILE* out) {
+  uint32_t path[PROFILE_MAX_DEPTH];
+  char     name[128];
+
+  for (uint32_t i = 0; i < profile->nodec; i++) {
+    if (profile->nodes[i].self == 0) {
+      continue;
+    }
+
+    uint32_t length = 0;
+    uint32_t n = i;
+    while (length < PROFILE_MAX_DEPTH) {
+      path[length++] = n;
+      if (n == 0) {
+        break;
+      }
+      n = profile->nodes[n].parent;
+    }
+
+    while (length-- > 0) {
+      profile_node_t* node  = &profile->nodes[path[length]];
+      uint32_t        entry = profile->functions[node->function].entry;
+      fprintf(out, "%s%c", profile_name(profile, entry, name, sizeof(name)),
+          length ? ';' : ' ');
+    }
+    fprintf(out, "%llu\n", (unsigned long long) profile->nodes[i].self);
+  }
+}
+
+/**
+ * Prints the functions that ran the most instructions, themselves or
+ * through their callees
+ */
+void profile_report(profile_t* profile, FILE* out) {
+  profile_function_t* sorted = malloc(profile->functionc
+      * sizeof(profile_function_t) + 1);
+  char                name[128];
+  if (sorted == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(sorted, profile->functions,
+      profile->functionc * sizeof(profile_function_t));
+  qsort(sorted, profile->functionc, sizeof(profile_function_t),
+      &profile_function_compare);
+
+  fprintf(out, "instructions      : %llu\n",
+      (unsigned long long) profile->instructions);
+  fprintf(out, "calls             : %llu\n",
+      (unsigned long long) profile->calls);
+  fprintf(out, "returns           : %llu\n",
+      (unsigned long long) profile->returns);
+  fprintf(out, "functions         : %u\n", profile->functionc);
+  if (profile->overflows) {
+    fprintf(out, "calls too deep    : %llu\n",
+        (unsigned long long) profile->overflows);
+  }
+
+  fprintf(out, "%-32s %10s %14s %7s %14s %7s\n",
+      "function", "calls", "inclusive", "%", "exclusive", "%");
+  for (uint32_t i = 0; i < profile->functionc && i < PROFILE_REPORT_FUNCTIONS;
+      i++) {
+    double total = profile->instructions ? (double) profile->instructions : 1;
+    fprintf(out, "%-32s %10llu %14llu %6.2f%% %14llu %6.2f%%\n",
+        profile_name(profile, sorted[i].entry, name, sizeof(name)),
+        (unsigned long long) sorted[i].calls,
+        (unsigned long long) sorted[i].inclusive,
+        100.0 * (double) sorted[i].inclusive / total,
+        (unsigned long long) sorted[i].exclusive,
+        100.0 * (double) sorted[i].exclusive / total);
+  }
+
+  free(sorted);
+}
+
+/**
+ * Name of the symbol at or before address, with the offset from it if
+ * any, or the address itself
+ */
+static const char* profile_name(profile_t* profile, uint32_t address,
+    char* buffer, size_t size) {
+  uint32_t low = 0;
+  uint32_t high = profile->symbolc;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (profile->symbols[mid].address <= address) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low == 0) {
+    snprintf(buffer, size, "0x%08x", address);
+  } else if (profile->symbols[low - 1].address == address) {
+    snprintf(buffer, size, "%s", profile->symbols[low - 1].name);
+  } else {
+    snprintf(buffer, size, "%s+0x%x", profile->symbols[low - 1].name,
+        address - profile->symbols[low - 1].address);
+  }
+  return buffer;
+}
+
+static int profile_symbol_compare(const void* a, const void* b) {
+  const profile_symbol_t* x = a;
+  const profile_symbol_t* y = b;
+  return x->address < y->address ? -1 : x->address > y->address ? 1 : 0;
+}
+
+static int profile_function_compare(const void* a, const void* b) {
+  const profile_function_t* x = a;
+  const profile_function_t* y = b;
+  return x->inclusive < y->inclusive ? 1 : x->inclusive > y->inclusive ? -1
+      : x->exclusive < y->exclusive ? 1 : x->exclusive > y->exclusive ? -1 : 0;
+}
+
+void profile_free(profile_t* profile) {
+  for (uint32_t i = 0; i < profile->symbolc; i++) {
+    free(profile->symbols[i].name);
+  }
+  free(profile->symbols);
+  free(profile->functions);
+  free(profile->nodes);
+  free(profile);
+}
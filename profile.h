@@ -0,0 +1,92 @@
+#ifndef HEADER_PROFILE
+#define HEADER_PROFILE
+
+#include "common.h"
+#include <elf.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "instruction.h"
+
+/**
+ * Deepest shadow call stack followed. Calls beyond it are charged to the
+ * caller.
+ */
+#define PROFILE_MAX_DEPTH 1024
+
+/**
+ * Number of functions listed in the report
+ */
+#define PROFILE_REPORT_FUNCTIONS 20
+
+typedef struct {
+  uint32_t address;
+  char*    name;
+} profile_symbol_t;
+
+/**
+ * A function, known by the address it was called at
+ */
+typedef struct {
+  uint32_t entry;
+  uint64_t calls;
+  uint64_t inclusive;   // Instructions run in it and in what it called
+  uint64_t exclusive;   // Instructions run in it
+  uint32_t active;      // Activations on the shadow stack, for recursion
+} profile_function_t;
+
+/**
+ * Node of the calling context tree: one per distinct call stack
+ */
+typedef struct {
+  uint32_t function;
+  uint32_t parent;
+  uint32_t child;       // First child, 0 if none (0 is the root)
+  uint32_t sibling;
+  uint64_t self;        // Instructions run with exactly this stack
+} profile_node_t;
+
+typedef struct {
+  uint32_t node;
+  uint32_t return_address;
+  uint64_t entered;     // Instruction count at the call
+} profile_frame_t;
+
+/**
+ * Follows calls and returns of the guest on a shadow stack, to give the
+ * instructions run per function and per call stack. A call is a taken
+ * BL; a return is a BX lr, MOV pc, lr or LDM loading the pc that goes
+ * back to the address after a call on the stack, which also unwinds any
+ * frames left above it.
+ */
+typedef struct {
+  cpu_t*              cpu;
+
+  profile_function_t* functions;
+  uint32_t            functionc;
+  uint32_t            function_capacity;
+
+  profile_node_t*     nodes;
+  uint32_t            nodec;
+  uint32_t            node_capacity;
+
+  profile_frame_t     stack[PROFILE_MAX_DEPTH];
+  uint32_t            depth;
+
+  profile_symbol_t*   symbols;  // Sorted by address
+  uint32_t            symbolc;
+
+  uint64_t            instructions;
+  uint64_t            calls;
+  uint64_t            returns;
+  uint64_t            overflows;
+} profile_t;
+
+profile_t* profile_init(cpu_t*);
+bool       profile_load_symbols(profile_t*, const char*);
+void       profile_loop(profile_t*);
+void       profile_write_folded(profile_t*, FILE*);
+void       profile_report(profile_t*, FILE*);
+void       profile_free(profile_t*);
+
+#endif
@@ -0,0 +1,167 @@
+#include "replay.h"
+
+static replay_t* replay_init(FILE*, const uint64_t*, bool);
+static void      replay_put(FILE*, uint64_t);
+static bool      replay_get(FILE*, uint64_t*);
+static void      replay_diverged(replay_t*);
+
+/**
+ * Starts logging the inputs of the guest running image hash to path, or
+ * to an anonymous temporary file if it is NULL, installing itself on the
+ * devices.
+ * Returns NULL if the log cannot be written.
+ */
+replay_t* replay_record(const char* path, const uint64_t* instructions,
+    uint64_t hash) {
+  FILE* file = path != NULL ? fopen(path, "w+b") : tmpfile();
+  if (file == NULL) {
+    perror(path != NULL ? path : "tmpfile");
+    return NULL;
+  }
+
+  uint32_t version = REPLAY_VERSION;
+  fwrite(REPLAY_MAGIC, 1, 8, file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&hash, sizeof(hash), 1, file);
+
+  return replay_init(file, instructions, false);
+}
+
+/**
+ * Starts feeding back the inputs logged to path, which has to be a log
+ * of image hash.
+ * Returns NULL if it is not.
+ */
+replay_t* replay_open(const char* path, const uint64_t* instructions,
+    uint64_t hash) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  char     magic[8];
+  uint32_t version;
+  uint64_t recorded;
+  if (fread(magic, 1, 8, file) != 8 || memcmp(magic, REPLAY_MAGIC, 8) != 0
+      || fread(&version, sizeof(version), 1, file) != 1
+      || version != REPLAY_VERSION
+      || fread(&recorded, sizeof(recorded), 1, file) != 1) {
+    fprintf(stderr, "Error: %s is not a replay log.\n", path);
+    fclose(file);
+    return NULL;
+  }
+  if (recorded != hash) {
+    fprintf(stderr, "Error: %s was recorded with another binary.\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  return replay_init(file, instructions, true);
+}
+
+/**
+ * Goes back to the first input of the log, to feed the inputs back in
+ * from there, whether it was being recorded or replayed. The guest has
+ * to be back at its first instruction too.
+ */
+void replay_rewind(replay_t* replay) {
+  fflush(replay->file);
+  fseek(replay->file, REPLAY_HEADER, SEEK_SET);
+  replay->replaying   = true;
+  replay->instruction = *replay->instructions;
+  replay->value       = 0;
+  replay->events      = 0;
+}
+
+static replay_t* replay_init(FILE* file, const uint64_t* instructions,
+    bool replaying) {
+  replay_t* replay = calloc(1, sizeof(replay_t));
+  if (replay == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  replay->file         = file;
+  replay->replaying    = replaying;
+  replay->instructions = instructions;
+  replay->instruction  = *instructions;
+  setvbuf(file, NULL, _IOFBF, REPLAY_BUFFER);
+
+  device_set_input(&replay_input, replay);
+  return replay;
+}
+
+/**
+ * Device input: logs the value read, or replaces it with the logged one
+ */
+uint64_t replay_input(void* context, uint64_t value) {
+  replay_t* replay = context;
+  uint64_t  now    = *replay->instructions;
+
+  replay->events++;
+
+  if (!replay->replaying) {
+    int64_t change = (int64_t) (value - replay->value);
+    replay_put(replay->file, now - replay->instruction);
+    replay_put(replay->file,
+        (uint64_t) change << 1 ^ (uint64_t) (change >> 63));
+    replay->instruction = now;
+    replay->value       = value;
+    return value;
+  }
+
+  uint64_t distance, zigzag;
+  if (!replay_get(replay->file, &distance)
+      || !replay_get(replay->file, &zigzag)
+      || replay->instruction + distance != now) {
+    replay_diverged(replay);
+  }
+  replay->instruction = now;
+  replay->value      += zigzag >> 1 ^ -(zigzag & 1);
+  return replay->value;
+}
+
+static void replay_put(FILE* file, uint64_t n) {
+  while (n >= 0x80) {
+    putc((int) (n & 0x7F) | 0x80, file);
+    n >>= 7;
+  }
+  putc((int) n, file);
+}
+
+static bool replay_get(FILE* file, uint64_t* n) {
+  int c;
+
+  *n = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if ((c = getc(file)) == EOF) {
+      return false;
+    }
+    *n |= (uint64_t) (c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void replay_diverged(replay_t* replay) {
+  fprintf(stderr, "Error: the replay diverged from the log at instruction "
+      "%llu, input %llu. Was it recorded with other options?\n",
+      (unsigned long long) *replay->instructions,
+      (unsigned long long) replay->events);
+  exit(EXIT_FAILURE);
+}
+
+void replay_dump_stats(replay_t* replay, FILE* out) {
+  fprintf(out, "%s   : %llu\n",
+      replay->replaying ? "inputs replayed" : "inputs recorded",
+      (unsigned long long) replay->events);
+  fprintf(out, "log size          : %ld bytes\n", ftell(replay->file));
+}
+
+void replay_free(replay_t* replay) {
+  device_set_input(NULL, NULL);
+  fclose(replay->file);
+  free(replay);
+}
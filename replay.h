@@ -0,0 +1,47 @@
+#ifndef HEADER_REPLAY
+#define HEADER_REPLAY
+
+#include "common.h"
+#include <string.h>
+
+#include "devices.h"
+
+/**
+ * Log header: magic, version and the hash of the image recorded
+ */
+#define REPLAY_MAGIC   "ARMRPLOG"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER  (8 + sizeof(uint32_t) + sizeof(uint64_t))
+
+/**
+ * Size of the stdio buffer of the log
+ */
+#define REPLAY_BUFFER (1 << 16)
+
+/**
+ * Records the values the devices read off the host, the timers' clock
+ * and what the UART receives, or feeds them back in. Each one is logged
+ * as two LEB128 varints: the instructions executed since the previous
+ * one and the zigzag encoded change in value, a couple of bytes for a
+ * timer read. A replay that
+ * does not read the same inputs at the same instructions stops: it has
+ * to use the engine the log was recorded with, as they poll the devices
+ * at different instructions.
+ */
+typedef struct {
+  FILE*           file;
+  bool            replaying;
+  const uint64_t* instructions;   // Executed by the guest
+  uint64_t        instruction;    // At the previous value
+  uint64_t        value;
+  uint64_t        events;
+} replay_t;
+
+replay_t* replay_record(const char*, const uint64_t*, uint64_t);
+replay_t* replay_open(const char*, const uint64_t*, uint64_t);
+void      replay_rewind(replay_t*);
+uint64_t  replay_input(void*, uint64_t);
+void      replay_dump_stats(replay_t*, FILE*);
+void      replay_free(replay_t*);
+
+#endif
@@ -0,0 +1,513 @@
+#include "sample.h"
+
+static void  sample_profile(sample_t*);
+static void  sample_vector(sample_t*, uint32_t*);
+static void  sample_cluster(sample_t*);
+static float sample_distance(const float*, const float*);
+static void  sample_replay(sample_t*);
+static void  sample_fork(sample_t*, sample_cluster_t*);
+static void  sample_measure(sample_t*, sample_cluster_t*, sample_result_t*);
+static void  sample_reap(sample_t*);
+static int   sample_compare(const void*, const void*);
+static int   sample_silence(void);
+
+/**
+ * Parses an "interval[,clusters]" setup, the interval in instructions.
+ * Returns false if it is invalid.
+ */
+bool sample_parse(const char* text, sample_config_t* config) {
+  char* end;
+
+  config->interval = strtoull(text, &end, 10);
+  config->clusters = SAMPLE_CLUSTERS;
+  if (*end == ',') {
+    config->clusters = (uint32_t) strtoul(end + 1, &end, 10);
+  }
+  return *end == '\0' && config->interval > 0 && config->clusters > 0
+      && config->clusters <= SAMPLE_MAX_CLUSTERS;
+}
+
+/**
+ * Sets up sampling the cpu, from its current state. With cache
+ * geometries the detailed model is the caches, otherwise the timing.
+ */
+sample_t* sample_init(cpu_t* cpu, sample_config_t* config,
+    cache_config_t* icache, cache_config_t* dcache) {
+  sample_t* sample = calloc(1, sizeof(sample_t));
+  if (sample == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  sample->cpu    = cpu;
+  sample->config = *config;
+  sample->cached = icache != NULL;
+  if (sample->cached) {
+    sample->icache = *icache;
+    sample->dcache = *dcache;
+  }
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  sample->workers = cores > 0 ? (uint32_t) cores : 1;
+
+  // Both passes have to read the same inputs off the host
+  if (cpu->replay == NULL) {
+    cpu->replay = replay_record(NULL, &cpu->instructions, cpu->image->hash);
+    if (cpu->replay == NULL) {
+      free(sample);
+      return NULL;
+    }
+    sample->own_replay = true;
+  }
+
+  sample->start = checkpoint_init(cpu, 0, SIZE_MAX);
+  return sample;
+}
+
+/**
+ * Profiles the whole run, picks the representative intervals and runs
+ * the detailed model over them, leaving the cpu halted
+ */
+void sample_loop(sample_t* sample) {
+  sample_profile(sample);
+  sample_cluster(sample);
+  sample_replay(sample);
+}
+
+/**
+ * The functional pass: counts the instructions run by every basic block,
+ * projected onto SAMPLE_DIMENSIONS, over each interval
+ */
+static void sample_profile(sample_t* sample) {
+  cpu_t*   cpu    = sample->cpu;
+  uint32_t counts[SAMPLE_DIMENSIONS] = { 0 };
+  uint32_t bucket = 0;
+  bool     leader = true;
+  uint64_t next   = cpu->instructions + sample->config.interval;
+
+  // The guest's output is left to the second pass
+  int output = sample_silence();
+
+  while (cpu->decoded_inst.type != HALT) {
+    if (cpu->decoded_inst.type == EMPTY) {
+      leader = true;
+    } else {
+      if (leader) {
+        bucket = (cpu->decoded_pc >> 2) * 2654435761u
+            >> (32 - SAMPLE_DIMENSION_BITS);
+        leader = false;
+      }
+      counts[bucket]++;
+    }
+
+    cpu_step(cpu);
+
+    if (cpu->instructions >= next) {
+      sample_vector(sample, counts);
+      next += sample->config.interval;
+    }
+  }
+
+  // The last interval is cut short by the HALT
+  for (uint32_t i = 0; i < SAMPLE_DIMENSIONS; i++) {
+    if (counts[i]) {
+      sample_vector(sample, counts);
+      break;
+    }
+  }
+  sample->instructions = cpu->instructions;
+
+  uart_flush(cpu->uart);
+  fflush(stdout);
+  if (output >= 0) {
+    dup2(output, STDOUT_FILENO);
+    close(output);
+  }
+}
+
+/**
+ * Adds the vector of an interval, normalised to a sum of 1, and clears
+ * the counts for the next one
+ */
+static void sample_vector(sample_t* sample, uint32_t* counts) {
+  if (sample->intervals == sample->capacity) {
+    sample->capacity = sample->capacity ? sample->capacity * 2 : 256;
+    sample->vectors  = realloc(sample->vectors,
+        (size_t) sample->capacity * SAMPLE_DIMENSIONS * sizeof(float));
+    if (sample->vectors == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  float*   vector = &sample->vectors[(size_t) sample->intervals++
+      * SAMPLE_DIMENSIONS];
+  uint64_t total  = 0;
+  for (uint32_t i = 0; i < SAMPLE_DIMENSIONS; i++) {
+    total += counts[i];
+  }
+  for (uint32_t i = 0; i < SAMPLE_DIMENSIONS; i++) {
+    vector[i] = total ? (float) counts[i] / (float) total : 0;
+    counts[i] = 0;
+  }
+}
+
+/**
+ * k-means over the interval vectors, seeded with the first interval and
+ * then the one farthest from the seeds so far, so that the phases come
+ * out the same on every run. Each phase is stood for by its member
+ * closest to the centre.
+ */
+static void sample_cluster(sample_t* sample) {
+  uint32_t n = sample->intervals;
+  uint32_t k = sample->config.clusters < n ? sample->config.clusters : n;
+
+  float*    centres  = malloc((size_t) k * SAMPLE_DIMENSIONS * sizeof(float)
+      + 1);
+  float*    nearest  = malloc((size_t) n * sizeof(float) + 1);
+  uint32_t* phases   = calloc((size_t) n + 1, sizeof(uint32_t));
+  uint32_t* members  = calloc((size_t) k + 1, sizeof(uint32_t));
+  if (centres == NULL || nearest == NULL || phases == NULL
+      || members == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t seeds = 0;
+  for (uint32_t seed = 0; seeds < k; seeds++) {
+    const float* chosen = &sample->vectors[(size_t) seed * SAMPLE_DIMENSIONS];
+    memcpy(&centres[seeds * SAMPLE_DIMENSIONS], chosen,
+        SAMPLE_DIMENSIONS * sizeof(float));
+
+    float farthest = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      float d = sample_distance(
+          &sample->vectors[(size_t) i * SAMPLE_DIMENSIONS], chosen);
+      if (seeds == 0 || d < nearest[i]) {
+        nearest[i] = d;
+      }
+      if (nearest[i] > farthest) {
+        farthest = nearest[i];
+        seed     = i;
+      }
+    }
+    // Every interval is already on a seed
+    if (farthest == 0) {
+      seeds++;
+      break;
+    }
+  }
+  k = seeds;
+
+  bool changed = true;
+  for (uint32_t round = 0; changed && round < SAMPLE_ITERATIONS; round++) {
+    changed = false;
+    for (uint32_t i = 0; i < n; i++) {
+      const float* vector = &sample->vectors[(size_t) i * SAMPLE_DIMENSIONS];
+      uint32_t     best   = phases[i];
+      float        least  = sample_distance(vector,
+          &centres[best * SAMPLE_DIMENSIONS]);
+      for (uint32_t c = 0; c < k; c++) {
+        float d = sample_distance(vector, &centres[c * SAMPLE_DIMENSIONS]);
+        if (d < least) {
+          least = d;
+          best  = c;
+        }
+      }
+      changed  |= best != phases[i] || round == 0;
+      phases[i] = best;
+    }
+
+    memset(centres, 0, (size_t) k * SAMPLE_DIMENSIONS * sizeof(float));
+    memset(members, 0, (size_t) k * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+      float* centre = &centres[phases[i] * SAMPLE_DIMENSIONS];
+      for (uint32_t d = 0; d < SAMPLE_DIMENSIONS; d++) {
+        centre[d] += sample->vectors[(size_t) i * SAMPLE_DIMENSIONS + d];
+      }
+      members[phases[i]]++;
+    }
+    for (uint32_t c = 0; c < k; c++) {
+      for (uint32_t d = 0; d < SAMPLE_DIMENSIONS && members[c]; d++) {
+        centres[c * SAMPLE_DIMENSIONS + d] /= (float) members[c];
+      }
+    }
+  }
+
+  for (uint32_t c = 0; c < k; c++) {
+    if (members[c] == 0) {
+      continue;
+    }
+    sample_cluster_t* cluster = &sample->clusters[sample->count++];
+    float             least   = -1;
+    cluster->members = members[c];
+    for (uint32_t i = 0; i < n; i++) {
+      float d = sample_distance(
+          &sample->vectors[(size_t) i * SAMPLE_DIMENSIONS],
+          &centres[c * SAMPLE_DIMENSIONS]);
+      if (phases[i] == c && (least < 0 || d < least)) {
+        least             = d;
+        cluster->interval = i;
+      }
+    }
+  }
+
+  free(centres);
+  free(nearest);
+  free(phases);
+  free(members);
+}
+
+/**
+ * Squared euclidean distance between two vectors
+ */
+static float sample_distance(const float* a, const float* b) {
+  float sum = 0;
+
+  for (uint32_t i = 0; i < SAMPLE_DIMENSIONS; i++) {
+    sum += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return sum;
+}
+
+/**
+ * The second pass: goes back to the start and replays the inputs of the
+ * first one, forking a worker at the start of each representative
+ * interval's warm up, then runs on to the HALT.
+ */
+static void sample_replay(sample_t* sample) {
+  cpu_t* cpu = sample->cpu;
+
+  qsort(sample->clusters, sample->count, sizeof(sample_cluster_t),
+      &sample_compare);
+
+  // The timer is not read when polling at the start, so the log can be
+  // wound back after the machine
+  checkpoint_rewind(sample->start, 0);
+  replay_rewind(cpu->replay);
+
+  for (uint32_t c = 0; c < sample->count; c++) {
+    sample_cluster_t* cluster = &sample->clusters[c];
+    uint64_t warm = cluster->interval > 0 ? cluster->interval - 1 : 0;
+
+    cpu_run(cpu, warm * sample->config.interval - cpu->instructions);
+    sample_fork(sample, cluster);
+  }
+  cpu_loop(cpu);
+
+  while (sample->running > 0) {
+    sample_reap(sample);
+  }
+}
+
+/**
+ * Starts a worker on a copy of the machine, waiting for one to finish if
+ * they all are busy
+ */
+static void sample_fork(sample_t* sample, sample_cluster_t* cluster) {
+  int ends[2];
+
+  if (sample->running == sample->workers) {
+    sample_reap(sample);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  if (pipe(ends) != 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (child == 0) {
+    sample_result_t result;
+
+    // The log's file offset is the parent's too, the worker reads the
+    // host clock instead
+    device_set_input(NULL, NULL);
+    sample->cpu->replay = NULL;
+
+    close(ends[0]);
+    sample_silence();
+    sample_measure(sample, cluster, &result);
+    _exit(write(ends[1], &result, sizeof(result)) == sizeof(result)
+        ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  close(ends[1]);
+  cluster->worker = child;
+  cluster->pipe   = ends[0];
+  sample->running++;
+}
+
+/**
+ * Runs the detailed model over the interval before the cluster's, if any,
+ * then measures it over the cluster's. Run by the worker.
+ */
+static void sample_measure(sample_t* sample, sample_cluster_t* cluster,
+    sample_result_t* result) {
+  cpu_t*   cpu      = sample->cpu;
+  uint64_t interval = sample->config.interval;
+  uint64_t warm     = cluster->interval > 0 ? interval : 0;
+
+  memset(result, 0, sizeof(sample_result_t));
+
+  if (sample->cached) {
+    caches_t* caches = cache_init(cpu, &sample->icache, &sample->dcache);
+    cache_run(caches, warm);
+
+    uint64_t instructions = cpu->instructions;
+    result->accesses[0] = caches->icache.accesses;
+    result->accesses[1] = caches->dcache.accesses;
+    result->misses[0]   = caches->icache.misses;
+    result->misses[1]   = caches->dcache.misses;
+
+    cache_run(caches, interval);
+    result->instructions = cpu->instructions - instructions;
+    result->accesses[0]  = caches->icache.accesses - result->accesses[0];
+    result->accesses[1]  = caches->dcache.accesses - result->accesses[1];
+    result->misses[0]    = caches->icache.misses - result->misses[0];
+    result->misses[1]    = caches->dcache.misses - result->misses[1];
+    cache_free(caches);
+  } else {
+    timing_t* timing = timing_init(cpu);
+    timing_run(timing, warm);
+
+    uint64_t instructions = timing->instructions;
+    uint64_t cycles       = timing->cycles;
+    timing_run(timing, interval);
+    result->instructions = timing->instructions - instructions;
+    result->cycles       = timing->cycles - cycles;
+    timing_free(timing);
+  }
+}
+
+/**
+ * Waits for a worker and collects its result
+ */
+static void sample_reap(sample_t* sample) {
+  int   status;
+  pid_t child = waitpid(-1, &status, 0);
+
+  for (uint32_t c = 0; c < sample->count; c++) {
+    sample_cluster_t* cluster = &sample->clusters[c];
+    if (cluster->worker != child || child <= 0) {
+      continue;
+    }
+
+    ssize_t got = read(cluster->pipe, &cluster->result,
+        sizeof(sample_result_t));
+    close(cluster->pipe);
+    cluster->worker = 0;
+    sample->running--;
+
+    if (got != sizeof(sample_result_t) || !WIFEXITED(status)
+        || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      fprintf(stderr, "Error: the detailed run of interval %u failed.\n",
+          cluster->interval);
+      exit(EXIT_FAILURE);
+    }
+    return;
+  }
+
+  perror("waitpid");
+  exit(EXIT_FAILURE);
+}
+
+static int sample_compare(const void* a, const void* b) {
+  const sample_cluster_t* x = a;
+  const sample_cluster_t* y = b;
+  return x->interval < y->interval ? -1 : x->interval > y->interval;
+}
+
+/**
+ * Sends stdout to /dev/null.
+ * Returns a copy of the previous stdout, or -1.
+ */
+static int sample_silence(void) {
+  fflush(stdout);
+
+  int output = dup(STDOUT_FILENO);
+  int null   = open("/dev/null", O_WRONLY);
+  if (null >= 0) {
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  }
+  return output;
+}
+
+/**
+ * Prints the phases and the whole run's estimate: each phase's rates per
+ * instruction, weighted by the share of the intervals it has
+ */
+void sample_report(sample_t* sample, FILE* out) {
+  double weights = 0;
+  double rates[5] = { 0 };  // Cycles, then accesses and misses per cache
+
+  fprintf(out, "intervals         : %u of %llu instructions\n",
+      sample->intervals, (unsigned long long) sample->config.interval);
+  fprintf(out, "phases            : %u, %u workers\n", sample->count,
+      sample->workers);
+  fprintf(out, "%-10s %8s %8s %14s %8s\n", "interval", "members", "weight",
+      "instructions", sample->cached ? "misses" : "CPI");
+
+  for (uint32_t c = 0; c < sample->count; c++) {
+    sample_cluster_t* cluster = &sample->clusters[c];
+    sample_result_t*  result  = &cluster->result;
+    double weight = (double) cluster->members / (double) sample->intervals;
+    double count  = (double) result->instructions;
+
+    fprintf(out, "%-10u %8u %7.2f%% %14llu ", cluster->interval,
+        cluster->members, 100.0 * weight,
+        (unsigned long long) result->instructions);
+    if (sample->cached) {
+      fprintf(out, "%8llu\n",
+          (unsigned long long) (result->misses[0] + result->misses[1]));
+    } else {
+      fprintf(out, "%8.3f\n", count ? (double) result->cycles / count : 0.0);
+    }
+
+    // An interval the HALT cut down to nothing says nothing
+    if (result->instructions == 0) {
+      continue;
+    }
+    weights  += weight;
+    rates[0] += weight * (double) result->cycles / count;
+    for (uint32_t i = 0; i < 2; i++) {
+      rates[1 + 2 * i] += weight * (double) result->accesses[i] / count;
+      rates[2 + 2 * i] += weight * (double) result->misses[i] / count;
+    }
+  }
+
+  double total = (double) sample->instructions / (weights ? weights : 1);
+  fprintf(out, "instructions      : %llu\n",
+      (unsigned long long) sample->instructions);
+  if (sample->cached) {
+    const char* names[2] = { "L1 I", "L1 D" };
+    for (uint32_t i = 0; i < 2; i++) {
+      double accesses = rates[1 + 2 * i] * total;
+      double misses   = rates[2 + 2 * i] * total;
+      fprintf(out, "%s: ~%.0f accesses, ~%.0f misses, hit rate %.2f%%\n",
+          names[i], accesses, misses,
+          accesses ? 100.0 * (accesses - misses) / accesses : 100.0);
+    }
+  } else {
+    fprintf(out, "estimated cycles  : %.0f\n", rates[0] * total);
+    fprintf(out, "estimated CPI     : %.3f\n",
+        weights ? rates[0] / weights : 0.0);
+  }
+}
+
+void sample_free(sample_t* sample) {
+  if (sample->own_replay) {
+    replay_free(sample->cpu->replay);
+    sample->cpu->replay = NULL;
+  }
+  checkpoint_free(sample->start);
+  free(sample->vectors);
+  free(sample);
+}
@@ -0,0 +1,97 @@
+#ifndef HEADER_SAMPLE
+#define HEADER_SAMPLE
+
+#include "common.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+#include "cpu.h"
+#include "replay.h"
+#include "timing.h"
+
+/**
+ * Default and largest number of phases the intervals are clustered into
+ */
+#define SAMPLE_CLUSTERS     10
+#define SAMPLE_MAX_CLUSTERS 64
+
+/**
+ * Basic block vectors are projected onto this many dimensions, by
+ * hashing the address the blocks start at
+ */
+#define SAMPLE_DIMENSION_BITS 6
+#define SAMPLE_DIMENSIONS     (1 << SAMPLE_DIMENSION_BITS)
+
+/**
+ * Limit on the rounds of k-means
+ */
+#define SAMPLE_ITERATIONS 100
+
+typedef struct {
+  uint64_t interval;
+  uint32_t clusters;
+} sample_config_t;
+
+/**
+ * What a detailed model measured over one interval
+ */
+typedef struct {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t accesses[2];   // L1 I, L1 D
+  uint64_t misses[2];
+} sample_result_t;
+
+/**
+ * A phase of the program, stood for by the interval closest to its
+ * centre. The members weigh it in the estimate.
+ */
+typedef struct {
+  uint32_t        interval;
+  uint32_t        members;
+  pid_t           worker;
+  int             pipe;
+  sample_result_t result;
+} sample_cluster_t;
+
+/**
+ * SimPoint style sampled simulation. A functional pass records the basic
+ * block vector of every interval and the inputs read off the host, the
+ * intervals are clustered by k-means, and a second pass replaying the
+ * same inputs forks a copy of the machine at the start of each
+ * representative interval. The copies, one per host core at a time, run
+ * the detailed model over the interval before it, to warm it up, and
+ * over the interval itself.
+ */
+typedef struct {
+  cpu_t*           cpu;
+  sample_config_t  config;
+  bool             cached;      // The detailed model is the caches,
+  cache_config_t   icache;      // otherwise the pipeline timing
+  cache_config_t   dcache;
+  checkpoints_t*   start;
+  bool             own_replay;
+
+  float*           vectors;     // SAMPLE_DIMENSIONS per interval
+  uint32_t         intervals;
+  uint32_t         capacity;
+  uint64_t         instructions;
+
+  sample_cluster_t clusters[SAMPLE_MAX_CLUSTERS];
+  uint32_t         count;
+  uint32_t         workers;
+  uint32_t         running;
+} sample_t;
+
+bool      sample_parse(const char*, sample_config_t*);
+sample_t* sample_init(cpu_t*, sample_config_t*, cache_config_t*,
+    cache_config_t*);
+void      sample_loop(sample_t*);
+void      sample_report(sample_t*, FILE*);
+void      sample_free(sample_t*);
+
+#endif
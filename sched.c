@@ -0,0 +1,210 @@
+#include "sched.h"
+
+static bool     sched_slice(cpu_t*, uint64_t);
+static uint32_t sched_timer_read(memory_t*, uint32_t);
+static void     sched_timer_write(memory_t*, uint32_t, uint32_t);
+
+static const device_ops_t sched_timer_ops = {
+  &sched_timer_read, &sched_timer_write
+};
+
+sched_t* sched_init(uint64_t quantum, sched_policy_t policy) {
+  sched_t* sched = calloc(1, sizeof(sched_t));
+  if (sched == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  sched->quantum = quantum ? quantum : SCHED_QUANTUM;
+  sched->policy  = policy;
+  return sched;
+}
+
+/**
+ * Adds a guest and switches its system timer to the virtual clock.
+ * The cpu stays owned by the caller. Returns the guest's index.
+ */
+uint32_t sched_add(sched_t* sched, cpu_t* cpu, uint8_t priority) {
+  if (sched->count == sched->capacity) {
+    sched->capacity = sched->capacity ? sched->capacity * 2 : 64;
+    sched->guests = realloc(sched->guests,
+        sched->capacity * sizeof(sched_guest_t));
+    if (sched->guests == NULL) {
+      fprintf(stderr,"realloc failure");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  sched_guest_t* guest = &sched->guests[sched->count];
+  guest->cpu      = cpu;
+  guest->wake     = 0;
+  guest->priority = priority;
+  guest->halted   = cpu->decoded_inst.type == HALT;
+  sched->running += !guest->halted;
+
+  cpu->timer->ops = &sched_timer_ops;
+  memory_write_unsafe(cpu->timer, TIMER_WAKE, 0);
+  if (cpu->stats != NULL) {
+    stats_set(&cpu->stats->scheduled, 1);
+  }
+
+  return sched->count++;
+}
+
+/**
+ * Gives every runnable guest a quantum, then moves the clock on.
+ * If all guests sleep the clock jumps to the first wake up instead.
+ * Returns false once every guest has halted.
+ */
+bool sched_round(sched_t* sched) {
+  uint64_t now_us = sched->now / 1000;
+  uint64_t next   = UINT64_MAX;
+  uint8_t  top    = 0;
+  bool     ran    = false;
+
+  for (uint32_t i = 0; i < sched->count; i++) {
+    sched_guest_t* guest = &sched->guests[i];
+    if (guest->halted) {
+      continue;
+    }
+    if (guest->wake > sched->now) {
+      next = guest->wake < next ? guest->wake : next;
+      continue;
+    }
+    guest->wake = 0;
+    top = guest->priority > top ? guest->priority : top;
+  }
+
+  for (uint32_t i = 0; i < sched->count; i++) {
+    sched_guest_t* guest = &sched->guests[i];
+    if (guest->halted || guest->wake) {
+      continue;
+    }
+    if (sched->policy == SCHED_PRIORITY && guest->priority < top) {
+      continue;
+    }
+
+    memory_t* timer = guest->cpu->timer;
+    memory_write_unsafe(timer, TIMER_CLO, (uint32_t) now_us);
+    memory_write_unsafe(timer, TIMER_CHI, (uint32_t) (now_us >> 32));
+    if (guest->cpu->stats != NULL) {
+      stats_set(&guest->cpu->stats->virtual_time, sched->now);
+    }
+
+    ran = true;
+    sched->slices++;
+    if (sched_slice(guest->cpu, sched->quantum)) {
+      guest->halted = true;
+      sched->running--;
+      continue;
+    }
+
+    // The guest waited for a compare register to match
+    uint32_t compare = memory_read_unsafe(timer, TIMER_WAKE);
+    if (compare) {
+      uint64_t wake = ((now_us & ~(uint64_t) UINT32_MAX) | compare) * 1000;
+      memory_write_unsafe(timer, TIMER_WAKE, 0);
+      if (wake > sched->now) {
+        guest->wake = wake;
+        sched->sleeps++;
+      }
+    }
+  }
+
+  if (ran) {
+    uint64_t step = sched->quantum * 1000 / SCHED_CLOCK_MHZ;
+    sched->now += step ? step : 1;
+  } else if (next != UINT64_MAX) {
+    sched->now = next;
+    sched->idle_skips++;
+  }
+  sched->rounds++;
+
+  if (sched->dedup > 0) {
+    dedup_scan(sched->dedup);
+  }
+
+  return sched->running > 0;
+}
+
+/**
+ * cpu_run, also yielding as soon as the guest starts waiting on its timer
+ */
+static bool sched_slice(cpu_t* cpu, uint64_t quantum) {
+  uint64_t end    = cpu->instructions + quantum;
+  bool     halted = cpu->decoded_inst.type == HALT;
+
+  while (!halted && cpu->instructions < end
+      && !memory_read_unsafe(cpu->timer, TIMER_WAKE)) {
+    halted = cpu_step(cpu);
+  }
+  return halted;
+}
+
+void sched_run(sched_t* sched) {
+  while (sched_round(sched)) {
+  }
+}
+
+/**
+ * System timer of a scheduled guest. CLO and CHI are written by the
+ * scheduler before each quantum; reading CS reports which compare
+ * registers have matched, and with none matched yet but one set for
+ * the future, asks for the guest to sleep until then.
+ */
+static uint32_t sched_timer_read(memory_t* timer, uint32_t rel_addr) {
+  if (rel_addr != TIMER_CS) {
+    return memory_read_unsafe(timer, rel_addr);
+  }
+
+  uint32_t now    = memory_read_unsafe(timer, TIMER_CLO);
+  uint32_t status = 0;
+  uint32_t wait   = 0;
+
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t compare = memory_read_unsafe(timer, TIMER_C0 + 4 * i);
+    if (compare == 0) {
+      continue;
+    }
+    if (compare <= now) {
+      status |= 1u << i;
+    } else if (wait == 0 || compare < wait) {
+      wait = compare;
+    }
+  }
+
+  memory_write_unsafe(timer, TIMER_CS, status);
+  if (status == 0) {
+    memory_write_unsafe(timer, TIMER_WAKE, wait);
+  }
+  return status;
+}
+
+static void sched_timer_write(memory_t* timer, uint32_t rel_addr,
+    uint32_t value) {
+  timer_track(timer, rel_addr, value);
+  if (rel_addr != TIMER_CS) {
+    memory_write_unsafe(timer, rel_addr, value);
+  }
+}
+
+void sched_dump_stats(sched_t* sched, FILE* out) {
+  fprintf(out, "guests            : %u\n", sched->count);
+  fprintf(out, "rounds            : %llu\n",
+      (unsigned long long) sched->rounds);
+  fprintf(out, "time slices       : %llu\n",
+      (unsigned long long) sched->slices);
+  fprintf(out, "sleeps            : %llu\n",
+      (unsigned long long) sched->sleeps);
+  fprintf(out, "idle rounds       : %llu\n",
+      (unsigned long long) sched->idle_skips);
+  fprintf(out, "virtual time      : %llu us\n",
+      (unsigned long long) (sched->now / 1000));
+  if (sched->dedup > 0) {
+    dedup_dump_stats(out);
+  }
+}
+
+void sched_free(sched_t* sched) {
+  free(sched->guests);
+  free(sched);
+}
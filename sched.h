@@ -0,0 +1,67 @@
+#ifndef HEADER_SCHED
+#define HEADER_SCHED
+
+#include "common.h"
+
+#include "cpu.h"
+#include "dedup.h"
+#include "devices.h"
+#include "memory.h"
+
+/**
+ * Default number of instructions a guest runs before it has to yield
+ */
+#define SCHED_QUANTUM 1000
+
+/**
+ * Clock of the emulated core, one instruction per cycle. Sets how fast
+ * virtual time goes.
+ */
+#define SCHED_CLOCK_MHZ 700
+
+typedef enum {
+  SCHED_ROUND_ROBIN,  // Every runnable guest gets a quantum per round
+  SCHED_PRIORITY      // Only the highest priority runnable guests do
+} sched_policy_t;
+
+typedef struct {
+  cpu_t*   cpu;
+  uint64_t wake;      // Virtual time (ns) the guest sleeps until, 0 if awake
+  uint8_t  priority;
+  bool     halted;
+} sched_guest_t;
+
+/**
+ * Runs many guests on one host thread. All guests share a virtual clock
+ * that moves on by a quantum every round, and their system timers read
+ * it instead of the host clock. A guest that polls the timer status
+ * while a compare register is set for the future is taken to be
+ * waiting: it sleeps, and is skipped, until the clock gets there. So
+ * is a guest in WFI with a timer interrupt to come. Between rounds the
+ * deduplicator may scan the guests' RAM for pages to merge.
+ */
+typedef struct {
+  sched_guest_t* guests;
+  uint32_t       count;
+  uint32_t       capacity;
+  uint32_t       running;   // Guests that have not halted
+
+  uint64_t       quantum;
+  sched_policy_t policy;
+  uint64_t       now;       // Virtual time in ns
+  uint32_t       dedup;     // RAM pages scanned for merging every round
+
+  uint64_t       rounds;
+  uint64_t       slices;
+  uint64_t       sleeps;
+  uint64_t       idle_skips;
+} sched_t;
+
+sched_t* sched_init(uint64_t, sched_policy_t);
+uint32_t sched_add(sched_t*, cpu_t*, uint8_t);
+bool     sched_round(sched_t*);
+void     sched_run(sched_t*);
+void     sched_dump_stats(sched_t*, FILE*);
+void     sched_free(sched_t*);
+
+#endif
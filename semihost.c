@@ -0,0 +1,323 @@
+#include "semihost.h"
+
+static int32_t          semihost_open(semihost_t*, memory_t*, uint32_t*);
+static int32_t          semihost_read(semihost_t*, semihost_file_t*,
+    memory_t*, uint32_t, uint32_t);
+static int32_t          semihost_write(semihost_t*, semihost_file_t*,
+    memory_t*, uint32_t, uint32_t);
+static size_t           semihost_pread(int, uint8_t*, size_t, uint64_t);
+static semihost_file_t* semihost_file(semihost_t*, uint32_t);
+static bool             semihost_args(memory_t*, uint32_t, uint32_t,
+    uint32_t*);
+
+/**
+ * Opens the directory guest file names are relative to.
+ * Returns NULL if it cannot be opened.
+ */
+semihost_t* semihost_init(const char* root) {
+  int fd = open(root, O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    perror(root);
+    return NULL;
+  }
+
+  semihost_t* semihost = calloc(1, sizeof(semihost_t));
+  if (semihost == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  semihost->root = fd;
+  for (uint32_t i = 0; i < SEMIHOST_FILES; i++) {
+    semihost->files[i].fd = -1;
+  }
+  return semihost;
+}
+
+/**
+ * Runs the call in r0 with the parameter in r1, leaving the result in r0.
+ * Returns true if the guest asked to exit.
+ */
+bool semihost_call(semihost_t* semihost, uint32_t* registers,
+    memory_t* ram) {
+  uint32_t         args[3];
+  semihost_file_t* file   = NULL;
+  int32_t          result = -1;
+  uint32_t         op     = registers[0];
+
+  semihost->calls++;
+
+  // Calls on a file take its handle first
+  if (op == SYS_CLOSE || op == SYS_WRITE || op == SYS_READ
+      || op == SYS_ISTTY || op == SYS_SEEK || op == SYS_FLEN) {
+    uint32_t count = op == SYS_WRITE || op == SYS_READ ? 3
+        : op == SYS_SEEK ? 2 : 1;
+    if (!semihost_args(ram, registers[1], count, args)) {
+      semihost->error = EFAULT;
+      registers[0] = (uint32_t) -1;
+      return false;
+    }
+    file = semihost_file(semihost, args[0]);
+    if (file == NULL) {
+      semihost->error = EBADF;
+      registers[0] = (uint32_t) -1;
+      return false;
+    }
+  }
+
+  struct stat info;
+  switch (op) {
+    case SYS_OPEN:
+      result = semihost_open(semihost, ram, registers);
+      break;
+    case SYS_CLOSE:
+      result = file->console || close(file->fd) == 0 ? 0 : -1;
+      file->fd = -1;
+      break;
+    case SYS_WRITEC:
+      if (registers[1] < ram->size) {
+        putchar(ram->mem[registers[1]]);
+      }
+      break;
+    case SYS_WRITE0:
+      for (uint32_t a = registers[1]; a < ram->size && ram->mem[a]; a++) {
+        putchar(ram->mem[a]);
+      }
+      break;
+    case SYS_WRITE:
+      result = semihost_write(semihost, file, ram, args[1], args[2]);
+      // The number of bytes not written
+      result = result < 0 ? (int32_t) args[2] : (int32_t) args[2] - result;
+      break;
+    case SYS_READ:
+      result = semihost_read(semihost, file, ram, args[1], args[2]);
+      // The number of bytes not read
+      result = result < 0 ? (int32_t) args[2] : (int32_t) args[2] - result;
+      break;
+    case SYS_ISTTY:
+      result = isatty(file->fd);
+      break;
+    case SYS_SEEK:
+      if (!file->console) {
+        file->position = args[1];
+        result = 0;
+      }
+      break;
+    case SYS_FLEN:
+      if (fstat(file->fd, &info) == 0) {
+        result = (int32_t) info.st_size;
+      }
+      break;
+    case SYS_ERRNO:
+      result = semihost->error;
+      break;
+    case SYS_EXIT:
+      fflush(stdout);
+      return true;
+    default:
+      semihost->error = ENOSYS;
+      break;
+  }
+
+  if (result == -1 && op != SYS_ERRNO && semihost->error == 0) {
+    semihost->error = errno;
+  }
+  registers[0] = (uint32_t) result;
+  return false;
+}
+
+/**
+ * SYS_OPEN: name, fopen mode index (r, rb, r+, r+b, w, ...) and name
+ * length. Names may not leave the root directory.
+ * Returns the handle, or -1.
+ */
+static int32_t semihost_open(semihost_t* semihost, memory_t* ram,
+    uint32_t* registers) {
+  static const int modes[3] = {
+    O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND
+  };
+  uint32_t args[3];
+
+  if (!semihost_args(ram, registers[1], 3, args) || args[1] > 11
+      || args[0] >= ram->size || args[2] > ram->size - args[0]) {
+    semihost->error = EINVAL;
+    return -1;
+  }
+
+  uint32_t slot = 0;
+  while (slot < SEMIHOST_FILES && semihost->files[slot].fd >= 0) {
+    slot++;
+  }
+  if (slot == SEMIHOST_FILES) {
+    semihost->error = EMFILE;
+    return -1;
+  }
+
+  char name[args[2] + 1];
+  memcpy(name, ram->mem + args[0], args[2]);
+  name[args[2]] = '\0';
+
+  semihost_file_t* file = &semihost->files[slot];
+  file->position = 0;
+  file->append   = args[1] >= 8;
+  file->console  = strcmp(name, SEMIHOST_CONSOLE) == 0;
+
+  if (file->console) {
+    file->fd = args[1] < 4 ? STDIN_FILENO : STDOUT_FILENO;
+    return (int32_t) slot + 1;
+  }
+
+  if (name[0] == '/' || strstr(name, "..") != NULL) {
+    semihost->error = EACCES;
+    return -1;
+  }
+
+  int flags = modes[args[1] / 4];
+  if (args[1] & 2) {
+    flags = (flags & ~(O_RDONLY | O_WRONLY)) | O_RDWR;
+  }
+  file->fd = openat(semihost->root, name, flags, 0644);
+  if (file->fd < 0) {
+    semihost->error = errno;
+    return -1;
+  }
+  return (int32_t) slot + 1;
+}
+
+/**
+ * Reads into guest RAM at buffer.
+ * Returns the bytes read, or -1.
+ */
+static int32_t semihost_read(semihost_t* semihost, semihost_file_t* file,
+    memory_t* ram, uint32_t buffer, uint32_t length) {
+  if (buffer >= ram->size || length > ram->size - buffer) {
+    semihost->error = EFAULT;
+    return -1;
+  }
+
+  uint8_t* to   = ram->mem + buffer;
+  size_t   done = 0;
+
+  if (file->console) {
+    fflush(stdout);
+    done = fread(to, 1, length, stdin);
+    memory_mark_dirty(ram, buffer, (uint32_t) done);
+    semihost->bytes_read += done;
+    return (int32_t) done;
+  }
+
+  done = semihost_pread(file->fd, to, length, file->position);
+  if (done == 0 && errno != 0 && length > 0) {
+    semihost->error = errno;
+  }
+
+  file->position += done;
+  memory_mark_dirty(ram, buffer, (uint32_t) done);
+  semihost->bytes_read += done;
+  return (int32_t) done;
+}
+
+/**
+ * Reads until length bytes, the end of file or an error.
+ * Returns the bytes read.
+ */
+static size_t semihost_pread(int fd, uint8_t* to, size_t length,
+    uint64_t offset) {
+  size_t done = 0;
+
+  errno = 0;
+  while (done < length) {
+    ssize_t got = pread(fd, to + done, length - done, (off_t) (offset + done));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    done += (size_t) got;
+  }
+  return done;
+}
+
+/**
+ * Writes from guest RAM at buffer.
+ * Returns the bytes written, or -1.
+ */
+static int32_t semihost_write(semihost_t* semihost, semihost_file_t* file,
+    memory_t* ram, uint32_t buffer, uint32_t length) {
+  if (buffer >= ram->size || length > ram->size - buffer) {
+    semihost->error = EFAULT;
+    return -1;
+  }
+
+  uint8_t* from = ram->mem + buffer;
+  size_t   done = 0;
+
+  if (file->console) {
+    done = fwrite(from, 1, length, stdout);
+    semihost->bytes_written += done;
+    return (int32_t) done;
+  }
+
+  while (done < length) {
+    ssize_t put = file->append
+        ? write(file->fd, from + done, length - done)
+        : pwrite(file->fd, from + done, length - done,
+          (off_t) (file->position + done));
+    if (put < 0 && errno == EINTR) {
+      continue;
+    }
+    if (put <= 0) {
+      semihost->error = errno;
+      break;
+    }
+    done += (size_t) put;
+  }
+
+  file->position += done;
+  semihost->bytes_written += done;
+  return (int32_t) done;
+}
+
+static semihost_file_t* semihost_file(semihost_t* semihost, uint32_t handle) {
+  if (handle == 0 || handle > SEMIHOST_FILES
+      || semihost->files[handle - 1].fd < 0) {
+    return NULL;
+  }
+  return &semihost->files[handle - 1];
+}
+
+/**
+ * Reads the count words of a parameter block in RAM.
+ * Returns false if it is not all in RAM.
+ */
+static bool semihost_args(memory_t* ram, uint32_t address, uint32_t count,
+    uint32_t* args) {
+  if (address >= ram->size || 4 * count > ram->size - address
+      || (address & 3)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    args[i] = memory_read_unsafe(ram, address + 4 * i);
+  }
+  return true;
+}
+
+void semihost_dump_stats(semihost_t* semihost, FILE* out) {
+  fprintf(out, "semihosting calls : %llu\n",
+      (unsigned long long) semihost->calls);
+  fprintf(out, "bytes read        : %llu\n",
+      (unsigned long long) semihost->bytes_read);
+  fprintf(out, "bytes written     : %llu\n",
+      (unsigned long long) semihost->bytes_written);
+}
+
+void semihost_free(semihost_t* semihost) {
+  for (uint32_t i = 0; i < SEMIHOST_FILES; i++) {
+    semihost_file_t* file = &semihost->files[i];
+    if (file->fd >= 0 && !file->console) {
+      close(file->fd);
+    }
+  }
+  close(semihost->root);
+  free(semihost);
+}
@@ -0,0 +1,71 @@
+#ifndef HEADER_SEMIHOST
+#define HEADER_SEMIHOST
+
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+/**
+ * SWI comment of a semihosting call in ARM state
+ */
+#define SEMIHOST_SWI 0x123456
+
+/**
+ * Operations, in r0. r1 points to their parameter block, or for WRITEC,
+ * WRITE0 and EXIT is the parameter itself.
+ */
+#define SYS_OPEN   0x01
+#define SYS_CLOSE  0x02
+#define SYS_WRITEC 0x03
+#define SYS_WRITE0 0x04
+#define SYS_WRITE  0x05
+#define SYS_READ   0x06
+#define SYS_ISTTY  0x09
+#define SYS_SEEK   0x0A
+#define SYS_FLEN   0x0C
+#define SYS_ERRNO  0x13
+#define SYS_EXIT   0x18
+
+/**
+ * Files open at the same time, handles being their slot plus one
+ */
+#define SEMIHOST_FILES 32
+
+/**
+ * The special file name standing for the console
+ */
+#define SEMIHOST_CONSOLE ":tt"
+
+typedef struct {
+  int      fd;        // -1 if the slot is free
+  uint64_t position;
+  bool     console;   // stdin or stdout, never closed
+  bool     append;
+} semihost_file_t;
+
+/**
+ * Host file access for the guest through SYS_* calls. Transfers go
+ * straight between the files and guest RAM, and file names are taken
+ * relative to the root directory given.
+ */
+typedef struct {
+  int             root;
+  semihost_file_t files[SEMIHOST_FILES];
+  int             error;    // errno of the last call that failed
+
+  uint64_t        calls;
+  uint64_t        bytes_read;
+  uint64_t        bytes_written;
+} semihost_t;
+
+semihost_t* semihost_init(const char*);
+bool        semihost_call(semihost_t*, uint32_t*, memory_t*);
+void        semihost_dump_stats(semihost_t*, FILE*);
+void        semihost_free(semihost_t*);
+
+#endif
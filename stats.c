@@ -0,0 +1,127 @@
+#include "stats.h"
+
+#include "sched.h"
+
+static void stats_path(char*, size_t, const char*);
+
+/**
+ * Creates, or replaces, the stats page called name and maps it.
+ * The devices are given a slot each, in order.
+ * Returns NULL if the page cannot be created.
+ */
+stats_t* stats_create(const char* name, memory_t** devices, uint8_t devicesc) {
+  char path[256];
+  stats_path(path, sizeof(path), name);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(stats_t)) != 0) {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+
+  stats_t* stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+
+  // The file starts zeroed
+  stats->version = STATS_VERSION;
+  stats->pid     = (uint64_t) getpid();
+  stats->running = 1;
+
+  stats->devicesc = devicesc < STATS_DEVICES ? devicesc : STATS_DEVICES;
+  for (uint64_t i = 0; i < stats->devicesc; i++) {
+    stats->devices[i].start = devices[i]->start;
+    stats->devices[i].size  = devices[i]->size;
+  }
+
+  // Published last, so that a monitor never sees half a header
+  __atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+  return stats;
+}
+
+/**
+ * Maps an existing stats page read only, for monitoring.
+ * Returns NULL if there is none or it has another layout.
+ */
+stats_t* stats_open(const char* name) {
+  char path[256];
+  stats_path(path, sizeof(path), name);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (lseek(fd, 0, SEEK_END) < (off_t) sizeof(stats_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  stats_t* stats = mmap(NULL, sizeof(stats_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (__atomic_load_n(&stats->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC
+      || stats->version != STATS_VERSION) {
+    munmap(stats, sizeof(stats_t));
+    return NULL;
+  }
+  return stats;
+}
+
+/**
+ * Counts the instruction of the given type about to be executed, with
+ * instructions the total so far
+ */
+void stats_step(stats_t* stats, inst_t type, uint64_t instructions) {
+  stats_add(&stats->inst_counts[type], 1);
+  stats_set(&stats->instructions, instructions);
+
+  if (!stats->scheduled) {
+    stats_set(&stats->virtual_time, instructions * 1000 / SCHED_CLOCK_MHZ);
+  }
+}
+
+/**
+ * Counts count word accesses to device
+ */
+void stats_access(stats_t* stats, memory_t* device, bool write,
+    uint32_t count) {
+  for (uint64_t i = 0; i < stats->devicesc; i++) {
+    if (stats->devices[i].start == device->start) {
+      stats_add(write ? &stats->devices[i].writes : &stats->devices[i].reads,
+          count);
+      return;
+    }
+  }
+}
+
+/**
+ * Marks the instance as stopped and unmaps the page. The page stays in
+ * STATS_DIR for the monitor to read the final values.
+ */
+void stats_close(stats_t* stats) {
+  stats_set(&stats->running, 0);
+  munmap(stats, sizeof(stats_t));
+}
+
+void stats_remove(const char* name) {
+  char path[256];
+  stats_path(path, sizeof(path), name);
+  unlink(path);
+}
+
+static void stats_path(char* path, size_t size, const char* name) {
+  snprintf(path, size, "%s/%s%s", STATS_DIR, STATS_PREFIX, name);
+}
@@ -0,0 +1,83 @@
+#ifndef HEADER_STATS
+#define HEADER_STATS
+
+#include "common.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "instruction.h"
+#include "memory.h"
+
+/**
+ * Stats pages live in STATS_DIR, named STATS_PREFIX followed by the name
+ * given to the instance
+ */
+#define STATS_DIR    "/dev/shm"
+#define STATS_PREFIX "armemu."
+
+#define STATS_MAGIC   0x41524D53 // "ARMS"
+#define STATS_VERSION 2
+
+/**
+ * Device slots in a page, devices added after these are not counted
+ */
+#define STATS_DEVICES 16
+
+/**
+ * Number of inst_t values, EMPTY being the last
+ */
+#define STATS_INST_TYPES (EMPTY + 1)
+
+typedef struct {
+  uint64_t start;
+  uint64_t size;
+  uint64_t reads;
+  uint64_t writes;
+} stats_device_t;
+
+/**
+ * Layout of a stats page. Only the emulator writes it, with relaxed
+ * atomic stores, so a monitor can read the counters at any time without
+ * locks; a value read may be a few instructions old but is never torn.
+ */
+typedef struct stats_struct {
+  uint32_t       magic;
+  uint32_t       version;
+  uint64_t       pid;
+  uint64_t       running;       // 0 once the instance has exited
+  uint64_t       instructions;
+  uint64_t       flushes;
+  uint64_t       virtual_time;  // ns, at SCHED_CLOCK_MHZ if not scheduled
+  uint64_t       scheduled;     // The scheduler keeps virtual_time
+  uint64_t       inst_counts[STATS_INST_TYPES];
+  uint64_t       devicesc;
+  stats_device_t devices[STATS_DEVICES];
+} stats_t;
+
+/**
+ * Adds to a counter of the page. There is a single writer, so a relaxed
+ * load and store are enough and no locked instruction is needed.
+ */
+static inline void stats_add(uint64_t* counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+      __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(uint64_t* counter, uint64_t value) {
+  __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_get(uint64_t* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+stats_t* stats_create(const char*, memory_t**, uint8_t);
+stats_t* stats_open(const char*);
+void     stats_step(stats_t*, inst_t, uint64_t);
+void     stats_access(stats_t*, memory_t*, bool, uint32_t);
+void     stats_close(stats_t*);
+void     stats_remove(const char*);
+
+#endif
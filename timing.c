@@ -0,0 +1,165 @@
+#include "timing.h"
+
+static int timing_compare(const void*, const void*);
+
+timing_t* timing_init(cpu_t* cpu) {
+  timing_t* timing = calloc(1, sizeof(timing_t));
+  if (timing == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  timing->cpu    = cpu;
+  timing->slots  = cpu->ram->size >> 2;
+  timing->leader = true;
+  timing->blocks = calloc(timing->slots, sizeof(timing_block_t));
+  if (timing->blocks == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  return timing;
+}
+
+/**
+ * cpu_loop, charging every executed instruction to the basic block it
+ * belongs to. The empty pipeline slots after a flush are not counted as
+ * instructions, their cost is the refill penalty.
+ */
+void timing_loop(timing_t* timing) {
+  timing_run(timing, UINT64_MAX);
+}
+
+/**
+ * timing_loop for at most max instructions.
+ * Returns true once the instruction to execute next is a HALT.
+ */
+bool timing_run(timing_t* timing, uint64_t max) {
+  cpu_t*   cpu = timing->cpu;
+  uint64_t end = max < UINT64_MAX - cpu->instructions
+      ? cpu->instructions + max : UINT64_MAX;
+
+  while (cpu->decoded_inst.type != HALT && cpu->instructions < end) {
+    if (cpu->decoded_inst.type == EMPTY) {
+      cpu_step(cpu);
+      continue;
+    }
+
+    if (timing->leader) {
+      uint32_t slot = cpu->decoded_pc >> 2;
+      timing->block  = slot < timing->slots ? &timing->blocks[slot] : NULL;
+      timing->leader = false;
+      if (timing->block != NULL) {
+        timing->block->entries++;
+      }
+    }
+
+    uint32_t cycles = timing_cost(cpu, &cpu->decoded_inst);
+    cpu_step(cpu);
+
+    if (cpu->decoded_inst.type == EMPTY) {
+      cycles += TIMING_REFILL;
+      timing->refills++;
+      timing->leader = true;
+    }
+
+    timing->cycles += cycles;
+    timing->instructions++;
+    if (timing->block != NULL) {
+      timing->block->cycles += cycles;
+      timing->block->instructions++;
+    }
+  }
+  return cpu->decoded_inst.type == HALT;
+}
+
+/**
+ * Cycles taken by an instruction, not counting a pipeline refill.
+ * Must be called before the instruction is executed.
+ */
+uint32_t timing_cost(cpu_t* cpu, decoded_t* decoded) {
+  if (!cpu_eval(cpu, decoded->fields.generic.cond)) {
+    return TIMING_SKIPPED;
+  }
+
+  switch (decoded->type) {
+    case PROC: ;
+      inst_data_proc_t* proc = &decoded->fields.data_proc;
+      return TIMING_ALU + (!proc->i && (proc->op2 & 0x10) ? TIMING_SHIFT_REG : 0);
+    case MULT: ;
+      // Early termination: one cycle per significant byte of Rs,
+      // bytes of all zeros or all ones at the top are skipped
+      inst_mult_t* mult = &decoded->fields.mult;
+      uint32_t rs = cpu->registers[mult->r_s];
+      uint32_t m  = 4;
+      for (int shift = 8; shift < 32; shift += 8) {
+        uint32_t top = rs >> shift;
+        if (top == 0 || top == (0xFFFFFFFF >> shift)) {
+          m = (uint32_t) shift / 8;
+          break;
+        }
+      }
+      return TIMING_MUL + m + (mult->a ? TIMING_MLA : 0);
+    case SDT:
+      return decoded->fields.sdt.l ? TIMING_LOAD : TIMING_STORE;
+    case BDT: ;
+      uint32_t n = (uint32_t) __builtin_popcount(decoded->fields.bdt.reg_bits);
+      return n + (decoded->fields.bdt.l ? TIMING_LDM : TIMING_STM);
+    case BRANCH:
+    case BX:
+      return TIMING_BRANCH;
+    default:
+      return 0;
+  }
+}
+
+static int timing_compare(const void* a, const void* b) {
+  const timing_block_t* x = *(const timing_block_t* const*) a;
+  const timing_block_t* y = *(const timing_block_t* const*) b;
+  return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : 0;
+}
+
+/**
+ * Prints the estimated cycles and the blocks that took the most of them
+ */
+void timing_report(timing_t* timing, FILE* out) {
+  timing_block_t** sorted = malloc(timing->slots * sizeof(timing_block_t*) + 1);
+  uint32_t         count  = 0;
+  if (sorted == NULL) {
+    fprintf(stderr,"malloc failure");
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint32_t slot = 0; slot < timing->slots; slot++) {
+    if (timing->blocks[slot].entries) {
+      sorted[count++] = &timing->blocks[slot];
+    }
+  }
+  qsort(sorted, count, sizeof(timing_block_t*), &timing_compare);
+
+  fprintf(out, "cycles            : %llu\n",
+      (unsigned long long) timing->cycles);
+  fprintf(out, "instructions      : %llu\n",
+      (unsigned long long) timing->instructions);
+  fprintf(out, "pipeline refills  : %llu\n",
+      (unsigned long long) timing->refills);
+  fprintf(out, "CPI               : %.3f\n", timing->instructions
+      ? (double) timing->cycles / (double) timing->instructions : 0.0);
+
+  fprintf(out, "%-10s %12s %14s %14s %7s\n",
+      "block", "entries", "instructions", "cycles", "CPI");
+  for (uint32_t i = 0; i < count && i < TIMING_REPORT_BLOCKS; i++) {
+    timing_block_t* block = sorted[i];
+    fprintf(out, "0x%08x %12llu %14llu %14llu %7.3f\n",
+        (uint32_t) (block - timing->blocks) << 2,
+        (unsigned long long) block->entries,
+        (unsigned long long) block->instructions,
+        (unsigned long long) block->cycles,
+        (double) block->cycles / (double) block->instructions);
+  }
+
+  free(sorted);
+}
+
+void timing_free(timing_t* timing) {
+  free(timing->blocks);
+  free(timing);
+}
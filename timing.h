@@ -0,0 +1,65 @@
+#ifndef HEADER_TIMING
+#define HEADER_TIMING
+
+#include "common.h"
+#include <string.h>
+
+#include "cpu.h"
+#include "instruction.h"
+
+/**
+ * Cycle costs of the instruction classes. They follow the three stage
+ * pipeline the emulator models (ARM7TDMI style S/N/I cycle counts with
+ * single cycle memory); retune them here for other cores.
+ */
+#define TIMING_ALU        1 // Data processing
+#define TIMING_SHIFT_REG  1 // Extra for a shift by a register
+#define TIMING_MUL        1 // Multiply, plus 1 to 4 cycles for the multiplier
+#define TIMING_MLA        1 // Extra for accumulating
+#define TIMING_LOAD       3 // ldr: address, data, write back to the register
+#define TIMING_STORE      2 // str: address, data
+#define TIMING_LDM        2 // ldm: plus 1 per register
+#define TIMING_STM        1 // stm: plus 1 per register
+#define TIMING_BRANCH     1
+#define TIMING_SKIPPED    1 // Any instruction whose condition failed
+
+/**
+ * Cycles lost refilling the pipeline after cpu_flush_pipeline
+ */
+#define TIMING_REFILL     2
+
+/**
+ * Number of basic blocks listed in the report
+ */
+#define TIMING_REPORT_BLOCKS 20
+
+/**
+ * Counters of a basic block, indexed by the word address it starts at.
+ * A block runs from a flush target up to the next flush.
+ */
+typedef struct {
+  uint64_t entries;
+  uint64_t instructions;
+  uint64_t cycles;
+} timing_block_t;
+
+typedef struct {
+  cpu_t*          cpu;
+  timing_block_t* blocks;
+  uint32_t        slots;
+  timing_block_t* block;   // Being run
+  bool            leader;  // The next instruction starts a block
+
+  uint64_t        cycles;
+  uint64_t        instructions;
+  uint64_t        refills;
+} timing_t;
+
+timing_t* timing_init(cpu_t*);
+void      timing_loop(timing_t*);
+bool      timing_run(timing_t*, uint64_t);
+uint32_t  timing_cost(cpu_t*, decoded_t*);
+void      timing_report(timing_t*, FILE*);
+void      timing_free(timing_t*);
+
+#endif
@@ -0,0 +1,266 @@
+#include "uart.h"
+
+static uint32_t uart_read(memory_t*, uint32_t);
+static void     uart_write(memory_t*, uint32_t, uint32_t);
+static void     uart_release(memory_t*);
+static void     uart_send(uart_t*, uint8_t);
+static uint32_t uart_receive(uart_t*);
+static uint32_t uart_flags(uart_t*);
+static uint32_t uart_input(memory_t*, uint32_t);
+static void     uart_start(uart_t*, pthread_t*, void* (*)(void*),
+    uint32_t*);
+static void*    uart_console(void*);
+static void*    uart_reader(void*);
+static void     uart_register(void);
+static void     uart_forked(void);
+static void     uart_sleep(long);
+
+const device_ops_t uart_ops = { &uart_read, &uart_write, &uart_release };
+
+/**
+ * Forks made by the process so far, plus one. A copy of the machine in a
+ * child has none of its parent's threads, which it can tell from the
+ * count they were started at.
+ */
+static uint32_t       uart_forks      = 1;
+static pthread_once_t uart_registered = PTHREAD_ONCE_INIT;
+
+/**
+ * UART initialiser. The host threads are only started once the guest
+ * uses the UART.
+ */
+memory_t* uart_init(arena_t* arena) {
+  memory_t* device = memory_new(arena, UART_START, UART_SIZE, false);
+  device->ops = &uart_ops;
+  memory_write_unsafe(device, UART_CR, UART_CR_RESET);
+
+  uart_t* uart = calloc(1, sizeof(uart_t));
+  if (uart == NULL) {
+    fprintf(stderr,"calloc failure");
+    exit(EXIT_FAILURE);
+  }
+  device->state = uart;
+
+  pthread_once(&uart_registered, &uart_register);
+  return device;
+}
+
+static uint32_t uart_read(memory_t* device, uint32_t rel_addr) {
+  uart_t* uart = device->state;
+
+  switch (rel_addr) {
+    case UART_DR:
+      return uart_input(device, uart_receive(uart));
+    case UART_FR:
+      return uart_input(device, uart_flags(uart));
+    default:
+      return memory_read_unsafe(device, rel_addr);
+  }
+}
+
+static void uart_write(memory_t* device, uint32_t rel_addr,
+    uint32_t value) {
+  uart_t* uart = device->state;
+
+  switch (rel_addr) {
+    case UART_DR:
+      uart_send(uart, (uint8_t) value);
+      break;
+    case UART_FR:
+    case UART_RIS:
+    case UART_MIS:
+      break;
+    case UART_CR:
+      memory_write_unsafe(device, rel_addr, value);
+      if ((value & UART_CR_RX) == UART_CR_RX
+          && uart->reader_forks != uart_forks) {
+        uart_start(uart, &uart->reader, &uart_reader, &uart->reader_forks);
+      }
+      break;
+    default:
+      memory_write_unsafe(device, rel_addr, value);
+      break;
+  }
+}
+
+/**
+ * Puts a byte in the transmit ring, waiting for the console if it is
+ * full rather than dropping it
+ */
+static void uart_send(uart_t* uart, uint8_t byte) {
+  if (uart->console_forks != uart_forks) {
+    // Anything a parent left in the ring is its own to print
+    uart->tx_tail = uart->tx_head;
+    uart_start(uart, &uart->console, &uart_console, &uart->console_forks);
+  }
+
+  uint32_t head = uart->tx_head;
+  while (head - __atomic_load_n(&uart->tx_tail, __ATOMIC_ACQUIRE)
+      == UART_TX_RING) {
+    uart_sleep(UART_FULL_US);
+  }
+  uart->tx[head & (UART_TX_RING - 1)] = byte;
+  __atomic_store_n(&uart->tx_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Takes a byte off the receive ring, 0 if it is empty
+ */
+static uint32_t uart_receive(uart_t* uart) {
+  uint32_t tail = uart->rx_tail;
+  if (__atomic_load_n(&uart->rx_head, __ATOMIC_ACQUIRE) == tail) {
+    return 0;
+  }
+
+  uint32_t byte = uart->rx[tail & (UART_RX_RING - 1)];
+  __atomic_store_n(&uart->rx_tail, tail + 1, __ATOMIC_RELEASE);
+  return byte;
+}
+
+static uint32_t uart_flags(uart_t* uart) {
+  uint32_t tx = uart->tx_head - __atomic_load_n(&uart->tx_tail,
+      __ATOMIC_ACQUIRE);
+  uint32_t rx = __atomic_load_n(&uart->rx_head, __ATOMIC_ACQUIRE)
+      - uart->rx_tail;
+
+  if (uart->console_forks != uart_forks) {
+    tx = 0;
+  }
+  return (tx == UART_TX_RING ? UART_FR_TXFF | UART_FR_BUSY : UART_FR_TXFE)
+      | (rx == 0 ? UART_FR_RXFE : 0)
+      | (rx == UART_RX_RING ? UART_FR_RXFF : 0);
+}
+
+/**
+ * What the guest reads while receiving is passed through the input filter
+ */
+static uint32_t uart_input(memory_t* device, uint32_t value) {
+  if ((memory_read_unsafe(device, UART_CR) & UART_CR_RX) != UART_CR_RX) {
+    return value;
+  }
+  return (uint32_t) device_input(value);
+}
+
+static void uart_start(uart_t* uart, pthread_t* thread,
+    void* (*run)(void*), uint32_t* forks) {
+  if (pthread_create(thread, NULL, run, uart) != 0) {
+    fprintf(stderr,"pthread_create failure");
+    exit(EXIT_FAILURE);
+  }
+  *forks = uart_forks;
+}
+
+/**
+ * Console thread: writes out whatever the ring holds, at most two calls
+ * for all of it, until the UART is released and the ring is empty
+ */
+static void* uart_console(void* context) {
+  uart_t* uart = context;
+
+  for (;;) {
+    uint32_t tail = uart->tx_tail;
+    uint32_t head = __atomic_load_n(&uart->tx_head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+      if (__atomic_load_n(&uart->stopping, __ATOMIC_ACQUIRE)
+          && __atomic_load_n(&uart->tx_head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+      }
+      uart_sleep(UART_IDLE_US);
+      continue;
+    }
+
+    uint32_t start = tail & (UART_TX_RING - 1);
+    uint32_t run   = head - tail;
+    if (run > UART_TX_RING - start) {
+      run = UART_TX_RING - start;
+    }
+    ssize_t put = write(STDOUT_FILENO, uart->tx + start, run);
+    if (put <= 0) {
+      // Nowhere to print, drop it rather than stall the guest
+      put = (ssize_t) run;
+    }
+    __atomic_store_n(&uart->tx_tail, tail + (uint32_t) put,
+        __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Reader thread: fills the receive ring from stdin until it ends. It is
+ * cancelled while blocked in read when the UART is released.
+ */
+static void* uart_reader(void* context) {
+  uart_t* uart = context;
+
+  for (;;) {
+    uint32_t head = uart->rx_head;
+    uint32_t room = UART_RX_RING
+        - (head - __atomic_load_n(&uart->rx_tail, __ATOMIC_ACQUIRE));
+
+    if (room == 0) {
+      uart_sleep(UART_IDLE_US);
+      continue;
+    }
+
+    uint32_t start = head & (UART_RX_RING - 1);
+    if (room > UART_RX_RING - start) {
+      room = UART_RX_RING - start;
+    }
+    ssize_t got = read(STDIN_FILENO, uart->rx + start, room);
+    if (got <= 0) {
+      return NULL;
+    }
+    __atomic_store_n(&uart->rx_head, head + (uint32_t) got,
+        __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Waits until the console has written out everything sent so far
+ */
+void uart_flush(memory_t* device) {
+  uart_t* uart = device->state;
+
+  if (uart->console_forks != uart_forks) {
+    return;
+  }
+  while (__atomic_load_n(&uart->tx_tail, __ATOMIC_ACQUIRE)
+      != uart->tx_head) {
+    uart_sleep(UART_FULL_US);
+  }
+}
+
+/**
+ * Stops the threads this process started, after the console has written
+ * out the ring
+ */
+static void uart_release(memory_t* device) {
+  uart_t* uart = device->state;
+
+  if (uart->console_forks == uart_forks) {
+    __atomic_store_n(&uart->stopping, true, __ATOMIC_RELEASE);
+    pthread_join(uart->console, NULL);
+  }
+  if (uart->reader_forks == uart_forks) {
+    pthread_cancel(uart->reader);
+    pthread_join(uart->reader, NULL);
+  }
+  free(uart);
+}
+
+/**
+ * Has forks counted, once for the process as machines may be made on
+ * several threads
+ */
+static void uart_register(void) {
+  pthread_atfork(NULL, NULL, &uart_forked);
+}
+
+static void uart_forked(void) {
+  uart_forks++;
+}
+
+static void uart_sleep(long microseconds) {
+  struct timespec wait = { 0, microseconds * 1000 };
+  nanosleep(&wait, NULL);
+}
@@ -0,0 +1,95 @@
+#ifndef HEADER_UART
+#define HEADER_UART
+
+#include "common.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "devices.h"
+
+/**
+ * PL011 UART0 of the BCM2835
+ */
+#define UART_START  0x20201000
+#define UART_SIZE   0x90
+#define UART_DR     0x0
+#define UART_RSRECR 0x4
+#define UART_FR     0x18
+#define UART_IBRD   0x24
+#define UART_FBRD   0x28
+#define UART_LCRH   0x2C
+#define UART_CR     0x30
+#define UART_IFLS   0x34
+#define UART_IMSC   0x38
+#define UART_RIS    0x3C
+#define UART_MIS    0x40
+#define UART_ICR    0x44
+
+/**
+ * Flag register bits
+ */
+#define UART_FR_BUSY (1u << 3)
+#define UART_FR_RXFE (1u << 4)
+#define UART_FR_TXFF (1u << 5)
+#define UART_FR_RXFF (1u << 6)
+#define UART_FR_TXFE (1u << 7)
+
+/**
+ * Control register bits, with its reset value
+ */
+#define UART_CR_UARTEN (1u << 0)
+#define UART_CR_TXE    (1u << 8)
+#define UART_CR_RXE    (1u << 9)
+#define UART_CR_RESET  (UART_CR_TXE | UART_CR_RXE)
+#define UART_CR_RX     (UART_CR_UARTEN | UART_CR_RXE)
+
+/**
+ * Sizes of the rings, powers of two. The transmit one stands in for a
+ * FIFO deep enough that a guest logging at full speed does not wait on
+ * the host console.
+ */
+#define UART_TX_RING (1u << 20)
+#define UART_RX_RING (1u << 12)
+
+/**
+ * Microseconds the host threads sleep for when they have nothing to do,
+ * and the guest waits for when the transmit ring is full
+ */
+#define UART_IDLE_US 1000
+#define UART_FULL_US 50
+
+/**
+ * Host side of the UART, the device's state. Bytes the guest sends go
+ * into the transmit ring, which a console thread writes to stdout in as
+ * few write calls as it can, and a reader thread fills the receive ring
+ * from stdin once the guest enables the receiver. Each ring has a single
+ * producer and a single consumer, the guest's thread being one of them,
+ * so the indices are only ever stored by one side. Neither is saved by
+ * checkpoints: rewinding does not take back what was printed.
+ * The guest sees the transmit ring as empty until it fills up, so that
+ * how far the console has got does not change what it runs. Once it
+ * enables the receiver, the flags and data it reads are host inputs and
+ * go through device_input, to be recorded and replayed.
+ */
+typedef struct {
+  uint8_t   tx[UART_TX_RING];
+  uint32_t  tx_head;            // Stored by the guest
+  uint32_t  tx_tail;            // Stored by the console
+  uint8_t   rx[UART_RX_RING];
+  uint32_t  rx_head;            // Stored by the reader
+  uint32_t  rx_tail;            // Stored by the guest
+
+  pthread_t console;
+  pthread_t reader;
+  uint32_t  console_forks;      // Forks seen when started, 0 if not yet
+  uint32_t  reader_forks;
+  bool      stopping;
+} uart_t;
+
+extern const device_ops_t uart_ops;
+
+memory_t* uart_init(arena_t*);
+void      uart_flush(memory_t*);
+
+#endif